@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Arena (bump) allocator
+ *
+ * An arena hands out memory by bumping a pointer through a chunk of memory. Allocations
+ *	have no header and are never freed individually. Instead, every allocation is released
+ *	at once with arena_reset() or arena_destroy(). This suits many short-lived objects which
+ *	die together, such as per-frame or per-request work.
+ *
+ * Arenas are not thread-safe. Each arena should be used by one thread at a time.
+ */
+typedef struct arena arena_t;
+
+/**
+ * @brief Create an arena on the heap
+ *
+ * The arena starts with a chunk of `size` bytes allocated with malloc(). When a chunk is
+ *	full, another chunk of at least `size` bytes is allocated and chained to it.
+ *
+ * @param size Usable size of each chunk. Must be > 0.
+ *
+ * @return The new arena, or NULL if the memory could not be allocated.
+ */
+arena_t* arena_create(size_t size);
+
+/**
+ * @brief Create an arena in a caller-supplied buffer
+ *
+ * The arena bookkeeping is stored at the start of `buffer`, and the rest of the buffer is
+ *	used for allocations. The arena never grows: arena_alloc() returns NULL once the buffer
+ *	is full.
+ *
+ * @param buffer Memory which the arena will use. It must remain valid until arena_destroy().
+ * @param size Size of `buffer` in bytes.
+ *
+ * @return The new arena, or NULL if the buffer is too small to hold the arena bookkeeping.
+ */
+arena_t* arena_create_from_buffer(void* buffer, size_t size);
+
+/**
+ * @brief Allocate memory from an arena
+ *
+ * @param arena The arena to allocate from.
+ * @param size Size of the allocation.
+ * @param align Alignment of the allocation. Must be a power of two. Alignments smaller than
+ *	sizeof(void*), including 0, are raised to sizeof(void*).
+ *
+ * @return Pointer to the allocated memory, or NULL if `size` is 0 or the arena could not
+ *	satisfy the request.
+ */
+void* arena_alloc(arena_t* arena, size_t size, size_t align);
+
+/**
+ * @brief Release every allocation made from an arena
+ *
+ * Runs in constant time. Chained chunks are kept, and they are reused by later allocations.
+ *
+ * @param arena The arena to reset.
+ */
+void arena_reset(arena_t* arena);
+
+/**
+ * @brief Destroy an arena
+ *
+ * Returns the memory allocated for the arena to the heap. For an arena created with
+ *	arena_create_from_buffer(), the buffer may be reused once this function returns.
+ *
+ * @param arena The arena to destroy. May be NULL.
+ */
+void arena_destroy(arena_t* arena);
+
+/**
+ * @brief Get the number of bytes allocated from an arena since it was created or reset
+ *
+ * Includes padding inserted for alignment. Space left unused at the end of a chunk,
+ *	when an allocation did not fit in it, is not counted.
+ *
+ * @param arena The arena to query.
+ *
+ * @return The number of bytes which are in use.
+ */
+size_t arena_used(const arena_t* arena);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // ARENA_H_
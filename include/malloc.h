@@ -10,6 +10,8 @@
 extern "C" {
 #endif //__cplusplus
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 /**
@@ -28,6 +30,422 @@ extern "C" {
  */
 void malloc_addblock(void* addr, size_t size);
 
+/// Region tag used for memory added with malloc_addblock()
+#define MALLOC_REGION_DEFAULT 0
+
+/**
+ * @brief Assign a tagged block of memory for use by malloc().
+ *
+ * Works like malloc_addblock(), but the memory is associated with a region tag.
+ * Tags are application-defined values (e.g., tightly-coupled SRAM, regular SRAM, external SDRAM),
+ *	which can be used to target allocations to a specific type of memory with malloc_region().
+ *	Memory with different tags is never combined into a single block.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param addr Pointer to the memory block address that you are providing to malloc()
+ * @param size Size of the memory block that you are providing to malloc()
+ * @param tag The region tag to associate with this memory block
+ */
+void malloc_addblock_ex(void* addr, size_t size, unsigned tag);
+
+/**
+ * @brief Allocate memory from a specific region
+ *
+ * Memory is allocated from a region tagged with `tag` if possible. If there is not enough
+ *	memory in that region, the search falls back to the order specified with
+ *	malloc_region_preference(), and then to any region.
+ *
+ * Memory allocated with malloc_region() is freed with free().
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param tag The region tag to allocate from.
+ * @param size Size of the memory allocation
+ *
+ * @return Pointer to allocated memory, or NULL if the allocation could not be satisfied.
+ */
+void* malloc_region(unsigned tag, size_t size);
+
+/**
+ * @brief Set the region preference order
+ *
+ * malloc() searches the regions in the specified order before falling back to any region.
+ *	malloc_region() uses this order if the requested region does not have enough memory.
+ *	By default, no preference is set, and malloc() uses the first block that fits.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param tags Array of region tags, in order of preference. May be NULL if `count` is 0.
+ * @param count Number of entries in `tags`. Pass 0 to clear the preference order.
+ */
+void malloc_region_preference(const unsigned* tags, size_t count);
+
+/**
+ * @brief Alignment of every pointer returned by malloc()
+ *
+ * Requests which need no stricter alignment can use malloc() and free_sized() instead of
+ *	malloc_aligned(), which would leave a gap in front of each block to meet the alignment.
+ *	The default is the smallest alignment of any configuration. Builds which raise
+ *	FREELIST_ALIGNMENT can raise this to match.
+ */
+#ifndef MALLOC_NATIVE_ALIGNMENT
+#define MALLOC_NATIVE_ALIGNMENT sizeof(void*)
+#endif
+
+/**
+ * @brief Allocate aligned memory which can be released with free()
+ *
+ * Unlike aligned_malloc(), the alignment is handled by the allocator itself, so no extra
+ *	offset header is stored and the memory is released with free().
+ *
+ * This API is supported by the freelist and framework RTOS implementations.
+ *
+ * @param align Alignment of the memory block. Must be a power of two.
+ * @param size Size of the memory allocation
+ *
+ * @return Pointer to allocated memory, or NULL if the allocation could not be satisfied.
+ */
+void* malloc_aligned(size_t align, size_t size);
+
+/**
+ * @brief Release memory when its size is known
+ *
+ * Equivalent to free(), matching the C23 API. Debug builds assert that `size` does not exceed
+ *	the usable size of the allocation.
+ *
+ * This API is supported by the freelist and framework RTOS implementations.
+ *
+ * @param ptr Pointer returned by malloc() or malloc_region(). May be NULL.
+ * @param size Size which was requested when `ptr` was allocated.
+ */
+void free_sized(void* ptr, size_t size);
+
+/**
+ * @brief Release aligned memory when its size and alignment are known
+ *
+ * Equivalent to free(), matching the C23 API. Debug builds assert that `ptr` has the
+ *	alignment and that `size` does not exceed the usable size of the allocation.
+ *
+ * This API is supported by the freelist and framework RTOS implementations.
+ *
+ * @param ptr Pointer returned by malloc_aligned(). May be NULL.
+ * @param align Alignment which was requested when `ptr` was allocated.
+ * @param size Size which was requested when `ptr` was allocated.
+ */
+void free_aligned_sized(void* ptr, size_t align, size_t size);
+
+/**
+ * @brief malloc_aligned() without calling malloc_lock()
+ *
+ * For callers which already serialize access to the heap, such as a single-threaded
+ *	application with a thread-safe malloc_lock(), or code which holds the lock itself.
+ *
+ * This API is supported by the freelist implementation.
+ */
+void* malloc_aligned_unlocked(size_t align, size_t size);
+
+/**
+ * @brief free_aligned_sized() without calling malloc_lock()
+ *
+ * The caller must serialize access to the heap, see malloc_aligned_unlocked().
+ *
+ * This API is supported by the freelist implementation.
+ */
+void free_aligned_sized_unlocked(void* ptr, size_t align, size_t size);
+
+/**
+ * @brief Release memory from an interrupt handler
+ *
+ * The block is pushed onto a lock-free pending list, which is threaded through the block's own
+ *	header, so the call takes a few instructions and never waits for the malloc lock. The next
+ *	malloc() or free() from thread context, or a call to malloc_drain(), returns the pending
+ *	blocks to the heap in one batch.
+ *
+ * This API is supported by the freelist implementation. It requires the library to be built
+ *	with FREELIST_ISR_FREE=1. Otherwise, it is the same as free(), which is only safe in an
+ *	interrupt handler if malloc_lock() masks interrupts.
+ *
+ * @param ptr Pointer returned by malloc(), malloc_region(), or malloc_aligned(). May be NULL.
+ */
+void free_from_isr(void* ptr);
+
+/**
+ * @brief Return blocks released with free_from_isr() to the heap
+ *
+ * malloc() and free() drain the pending list automatically. Call this function from thread
+ *	context when memory released by interrupt handlers should be coalesced before the next
+ *	allocation, e.g. before checking heap statistics.
+ *
+ * This API is supported by the freelist implementation.
+ */
+void malloc_drain(void);
+
+/**
+ * @brief Reserve blocks for allocation from interrupt handlers
+ *
+ * Allocates `count` blocks of `size_class` bytes from the heap and holds them in a lock-free
+ *	pool for malloc_from_isr(). Reserving a size class which already has a pool adds `count`
+ *	blocks to it. When malloc_from_isr() takes a pool below half of its capacity, the next
+ *	malloc(), free(), or malloc_drain() from thread context refills it.
+ *
+ * Call this function from thread context during initialization, before any interrupt handler
+ *	calls malloc_from_isr().
+ *
+ * This API is supported by the freelist implementation. It requires the library to be built
+ *	with FREELIST_ISR_POOL_CLASSES > 0, which is the number of size classes which can be
+ *	reserved.
+ *
+ * @param size_class Usable size of each block.
+ * @param count Number of blocks to reserve.
+ *
+ * @return true if the blocks were reserved. false if the arguments are 0, no more size classes
+ *	are available, or the heap could not supply the blocks. If the pool could only be
+ *	partially filled, it is kept, and it is refilled later.
+ */
+bool malloc_isr_reserve(size_t size_class, size_t count);
+
+/**
+ * @brief Allocate memory from an interrupt handler
+ *
+ * Takes a block from the smallest reserved pool (see malloc_isr_reserve()) which fits `size`
+ *	and is not empty. This runs in constant time with respect to the heap, and it never takes
+ *	the malloc lock. The block is released with free() or free_from_isr().
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param size The number of bytes requested.
+ *
+ * @return Pointer to the allocated memory, or NULL if `size` is 0 or no pool can satisfy the
+ *	request.
+ */
+void* malloc_from_isr(size_t size);
+
+/**
+ * @brief Get the usable size of an allocation
+ *
+ * This API is supported by the freelist, bitmap, and framework RTOS implementations. The
+ *	framework RTOS implementation needs os::Heap::usableSize().
+ *
+ * @param ptr Pointer returned by malloc(), malloc_region(), or malloc_aligned().
+ *
+ * @return The number of bytes which can be used at `ptr`, which is at least the requested size.
+ *	Returns 0 if `ptr` is NULL.
+ */
+size_t malloc_usable_size(void* ptr);
+
+/// Heap statistics reported by malloc_get_stats()
+typedef struct
+{
+	/// Total size of the free blocks. This is not the largest block that can be allocated.
+	size_t free_bytes;
+	/// Lowest value of free_bytes after any allocation since the heap was initialized
+	size_t min_free_bytes;
+	/// Size of the largest free block
+	size_t largest_free_block;
+	/// Size of the smallest free block
+	size_t smallest_free_block;
+	/// Number of free blocks
+	size_t free_blocks;
+	/// Number of allocations which succeeded
+	size_t allocations;
+	/// Number of blocks which were released
+	size_t frees;
+} malloc_stats_t;
+
+/**
+ * @brief Get statistics for the heap used by malloc()
+ *
+ * The free blocks are walked to find the block statistics, so this takes time proportional to
+ *	the number of free blocks. free_bytes and min_free_bytes are tracked as the heap changes,
+ *	and malloc_free_bytes() and malloc_min_free_bytes() read them in constant time.
+ *
+ * Blocks which are held in the deferred free buffer, or which were released with
+ *	free_from_isr() and have not been drained yet, are counted as free blocks once they are
+ *	merged into the free list.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param stats Receives the statistics. Must not be NULL.
+ */
+void malloc_get_stats(malloc_stats_t* stats);
+
+/**
+ * @brief Get the total size of the free blocks in the heap used by malloc()
+ *
+ * This is the free_bytes value of malloc_get_stats(), without walking the free blocks.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @return The number of free bytes.
+ */
+size_t malloc_free_bytes(void);
+
+/**
+ * @brief Get the lowest number of free bytes since the heap was initialized
+ *
+ * This is the min_free_bytes value of malloc_get_stats(), without walking the free blocks.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @return The lowest number of free bytes after any allocation.
+ */
+size_t malloc_min_free_bytes(void);
+
+/**
+ * @brief Remove a block of memory from the heap.
+ *
+ * This is the inverse of malloc_addblock(). The range is only removed if it is entirely free.
+ *	On success, the memory is no longer used by malloc() and can be used by the caller.
+ *	Partial ranges can be removed, as long as the memory left on either side of the range
+ *	is large enough to remain in the heap.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param addr Start address of the range to remove.
+ * @param size Size of the range to remove.
+ *
+ * @return true if the range was removed, false if any part of the range is in use.
+ */
+bool malloc_removeblock(void* addr, size_t size);
+
+/**
+ * @brief Callback which receives memory released by malloc_trim()
+ *
+ * @param addr Start address of the released memory.
+ * @param size Size of the released memory.
+ * @param tag Region tag of the released memory.
+ */
+typedef void (*malloc_trim_callback_t)(void* addr, size_t size, unsigned tag);
+
+/**
+ * @brief Return the free tail of each heap region.
+ *
+ * For each region whose end is free, everything past the first `pad` bytes of the final free
+ *	block is removed from the heap and handed to `release`. If a region is entirely free
+ *	and `pad` is 0, the whole region is released.
+ *
+ * The callback is invoked after the malloc lock is released.
+ *
+ * This API is supported by the freelist implementation.
+ *	Only regions tracked in the region table (see FREELIST_MAX_REGIONS) are trimmed.
+ *
+ * @param pad Number of free bytes to leave at the end of each region.
+ * @param release Callback which receives the released memory. Must not be NULL.
+ *
+ * @return The total number of bytes released.
+ */
+size_t malloc_trim(size_t pad, malloc_trim_callback_t release);
+
+/**
+ * @brief Heap growth callback
+ *
+ * Returns a new block of memory which is at least `size` bytes long, or NULL if no more
+ *	memory is available. The memory is owned by malloc() from that point on.
+ *
+ * The callback is invoked with the malloc lock held, so it must not call malloc() or free().
+ *
+ * @param size The number of bytes requested.
+ */
+typedef void* (*malloc_morecore_t)(size_t size);
+
+/**
+ * @brief Register a heap growth callback.
+ *
+ * When malloc() cannot find a large enough free block, it calls `morecore` to request more
+ *	memory, which is then added to the heap as if by malloc_addblock(). If the new memory
+ *	directly follows an existing region (e.g., with an sbrk-style provider), it is merged
+ *	with that region. By default, no callback is registered and malloc() returns NULL when
+ *	the heap is exhausted.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param morecore The growth callback. Pass NULL to disable heap growth.
+ * @param granularity Requests are rounded up to a multiple of this size. Must be a power
+ *	of two, or 0 to disable rounding.
+ */
+void malloc_set_morecore(malloc_morecore_t morecore, size_t granularity);
+
+/**
+ * @brief mmap()-based heap growth callback
+ *
+ * A malloc_morecore_t implementation for hosted systems, which maps anonymous memory pages.
+ *
+ * This function is provided by the native freelist library on hosts which support mmap().
+ *
+ * @param size The number of bytes requested.
+ * @returns Pointer to the new memory, or NULL if the mapping failed.
+ */
+void* malloc_morecore_mmap(size_t size);
+
+/// Timeout for malloc_timed() which waits until the request is satisfied
+#define MALLOC_WAIT_FOREVER UINT32_MAX
+
+/**
+ * @brief Allocate memory without blocking
+ *
+ * Returns NULL instead of waiting for memory to be released, or for the heap to be initialized.
+ *
+ * This API is supported by the freelist, ThreadX, and FreeRTOS implementations.
+ *
+ * @param size The number of bytes requested.
+ *
+ * @return Pointer to the allocated memory, or NULL if the request cannot be satisfied now.
+ */
+void* malloc_try(size_t size);
+
+/**
+ * @brief Allocate memory, waiting up to a timeout for memory to be released
+ *
+ * A task can use this to degrade gracefully under memory pressure, instead of blocking
+ *	indefinitely.
+ *
+ * This API is supported by the freelist, ThreadX, and FreeRTOS implementations. The freelist
+ *	implementation only waits if hooks have been registered with malloc_set_wait_hooks().
+ *
+ * @param size The number of bytes requested.
+ * @param timeout_ticks Maximum time to wait, in RTOS ticks. 0 does not wait, and
+ *	MALLOC_WAIT_FOREVER waits until the request is satisfied.
+ *
+ * @return Pointer to the allocated memory, or NULL if the request was not satisfied in time.
+ */
+void* malloc_timed(size_t size, uint32_t timeout_ticks);
+
+/**
+ * @brief Wait hook for malloc_timed()
+ *
+ * Blocks until the release hook is called, or until `timeout_ticks` elapse. A binary
+ *	semaphore is a good fit: the release hook gives it, and the wait hook takes it, so a
+ *	release which happens before the wait is not lost.
+ *
+ * @param timeout_ticks Maximum time to wait, or MALLOC_WAIT_FOREVER.
+ *
+ * @return false if the timeout elapsed.
+ */
+typedef bool (*malloc_wait_hook_t)(uint32_t timeout_ticks);
+
+/// Release hook, called by free() when memory is released while malloc_timed() is waiting
+typedef void (*malloc_release_hook_t)(void);
+
+/// Tick counter, used by malloc_timed() to track the remaining time. It may wrap around.
+typedef uint32_t (*malloc_tick_hook_t)(void);
+
+/**
+ * @brief Register the hooks which let malloc_timed() wait for memory
+ *
+ * The hooks are called without the malloc lock held. Memory released with free_from_isr()
+ *	only calls the release hook once malloc_drain() merges it.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param wait Blocks until memory is released. Pass NULL to disable waiting.
+ * @param release Signals a waiting malloc_timed() call.
+ * @param ticks Returns the current tick count. May be NULL, in which case malloc_timed() calls
+ *	with a finite timeout wait at most once.
+ */
+void malloc_set_wait_hooks(malloc_wait_hook_t wait, malloc_release_hook_t release,
+						   malloc_tick_hook_t ticks);
+
 /**
  * @brief Initialize Malloc
  *
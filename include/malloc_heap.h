@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef MALLOC_HEAP_H_
+#define MALLOC_HEAP_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Independent heap instance
+ *
+ * malloc() and free() use a default heap. Additional heaps can be created with heap_init(),
+ *	so that subsystems have their own memory and their own locking. Allocations in one heap
+ *	do not fragment the others, and threads using different heaps do not contend for a lock.
+ *
+ * Latency instrumentation and the heap profiler only cover the default heap.
+ *
+ * These APIs are supported by the freelist implementation.
+ */
+typedef struct heap heap_t;
+
+/// Lock callback for a heap instance. `context` is the value registered in heap_lock_t.
+typedef void (*heap_lock_fn_t)(void* context);
+
+/// Locking for a heap instance
+typedef struct
+{
+	/// Called before the heap is accessed. It should lock a mutex.
+	heap_lock_fn_t lock;
+	/// Called after the heap is accessed. It should unlock the mutex.
+	heap_lock_fn_t unlock;
+	/// Passed to the callbacks
+	void* context;
+} heap_lock_t;
+
+/**
+ * @brief Create a heap instance in a block of memory
+ *
+ * The heap bookkeeping is stored at the start of the block, and the rest of the block is
+ *	available for allocations.
+ *
+ * @param addr Start of the memory block.
+ * @param size Size of the memory block.
+ * @param lock Lock callbacks for the heap. Copied into the heap. If NULL or if the callbacks are
+ *	NULL, the heap is not thread-safe.
+ *
+ * @return The new heap, or NULL if the block is too small.
+ */
+heap_t* heap_init(void* addr, size_t size, const heap_lock_t* lock);
+
+/**
+ * @brief Get the heap used by malloc() and free()
+ *
+ * The default heap is locked with malloc_lock() and malloc_unlock().
+ */
+heap_t* heap_default(void);
+
+/**
+ * @brief Add a block of memory to a heap
+ *
+ * Works like malloc_addblock() for the heap instance.
+ */
+void heap_addblock(heap_t* heap, void* addr, size_t size);
+
+/**
+ * @brief Allocate memory from a heap
+ *
+ * @return Pointer to allocated memory, or NULL if the allocation could not be satisfied.
+ */
+void* heap_alloc(heap_t* heap, size_t size);
+
+/**
+ * @brief Allocate aligned memory from a heap
+ *
+ * @param align Alignment of the memory block. Must be a power of two.
+ *
+ * @return Pointer to allocated memory, or NULL if the allocation could not be satisfied.
+ *	The memory is released with heap_free().
+ */
+void* heap_aligned_alloc(heap_t* heap, size_t align, size_t size);
+
+/**
+ * @brief Release memory to the heap it was allocated from
+ *
+ * Memory must be released to the heap that allocated it. free() may only be used for
+ *	memory from the default heap. malloc_usable_size() works for memory from any heap.
+ *
+ * @param ptr Pointer returned by heap_alloc() or heap_aligned_alloc(). May be NULL.
+ */
+void heap_free(heap_t* heap, void* ptr);
+
+/**
+ * @brief Release memory from a thread other than the heap's owner
+ *
+ * The block is pushed onto the heap's remote free queue with an atomic operation, without
+ *	taking the heap's lock. The next heap_alloc() or heap_free() merges the queued blocks into
+ *	the free list in one batch.
+ *
+ * When the library is built without remote free queues (FREELIST_MAX_SEGMENTS and
+ *	FREELIST_ISR_FREE are both 0), this is the same as heap_free().
+ *
+ * @param ptr Pointer returned by heap_alloc() or heap_aligned_alloc(). May be NULL.
+ */
+void heap_free_remote(heap_t* heap, void* ptr);
+
+/**
+ * @brief Create a thread-owned heap segment
+ *
+ * The segment's memory is allocated from the default heap. Only the thread which owns the
+ *	segment may call heap_alloc(), heap_aligned_alloc(), and heap_free() for it, so the segment
+ *	has no lock.
+ *
+ * Any thread may release memory from the segment with free(). Instead of taking the malloc lock,
+ *	free() pushes the block onto the segment's remote free queue, and the owner merges the queue
+ *	on its next allocation. This keeps producer/consumer pipelines, where one thread allocates
+ *	and others release, from contending for a single lock.
+ *
+ * Requires the library to be built with FREELIST_MAX_SEGMENTS > 0, which is the maximum number of
+ *	segments that can exist at once.
+ *
+ * @param size Size of the segment, including its bookkeeping.
+ *
+ * @return The segment's heap, or NULL if segments are disabled, the segment table is full,
+ *	or the memory could not be allocated.
+ */
+heap_t* heap_segment_create(size_t size);
+
+/**
+ * @brief Return a segment's memory to the default heap
+ *
+ * Allocations from the segment must not be used after this call, and no other thread may be
+ *	releasing memory to the segment.
+ *
+ * @param segment Heap returned by heap_segment_create(). May be NULL.
+ */
+void heap_segment_destroy(heap_t* segment);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MALLOC_HEAP_H_
@@ -0,0 +1,549 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef MALLOC_HEAP_HPP_
+#define MALLOC_HEAP_HPP_
+
+/**
+ * Header-only heap template, which implements the freelist algorithm from malloc_freelist.c.
+ *
+ * Free blocks are kept on a list which is sorted by address. An allocation is carved from a
+ * free block chosen by the fit policy, and the rest of the block is split off when it is large
+ * enough to be useful. Released blocks are merged with the free blocks next to them.
+ *
+ * Behavior is selected with policies, which are resolved at compile time:
+ *	- FitPolicy chooses the free block: FirstFit (like malloc_freelist.c) or BestFit
+ *	- LockPolicy serializes access to the heap: NullLock or MutexLock<Mutex>
+ *	- StatsPolicy tracks the counters reported by stats(): NoStats or CountingStats
+ *	- Alignment is the minimum alignment of the memory returned by allocate()
+ *
+ * Empty policies take no space, and their calls compile to nothing. A
+ * Heap<FirstFit, NullLock, NoStats> is a single pointer.
+ *
+ * Like the freelist's compact header mode, allocated blocks only carry a size word in front of
+ * the payload. The free list links are stored in the payload of free blocks.
+ *
+ * Heap instances are independent of malloc() and of each other. This header requires C++17.
+ */
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <malloc.h>
+
+namespace libmemory
+{
+/**
+ * @brief Use the first free block which is large enough
+ *
+ * This is the strategy used by malloc_freelist.c. The search stops early, and because the free
+ * list is sorted by address, allocations are packed toward the start of the heap.
+ */
+struct FirstFit
+{
+	/// Returns true if a free block of `candidate` bytes should replace the current choice of
+	/// `chosen` bytes. `chosen` is 0 when no block has been chosen yet.
+	static constexpr bool better(std::size_t candidate, std::size_t chosen) noexcept
+	{
+		(void)candidate;
+		return chosen == 0;
+	}
+
+	/// Returns true if the search can stop with a block of `chosen` bytes for `size` bytes
+	static constexpr bool done(std::size_t chosen, std::size_t size) noexcept
+	{
+		(void)chosen;
+		(void)size;
+		return true;
+	}
+};
+
+/**
+ * @brief Use the smallest free block which is large enough
+ *
+ * Every free block is checked unless one fits exactly. This is slower than FirstFit, but large
+ * free blocks are kept intact for large requests, which reduces fragmentation for workloads
+ * with a wide range of sizes.
+ */
+struct BestFit
+{
+	static constexpr bool better(std::size_t candidate, std::size_t chosen) noexcept
+	{
+		return (chosen == 0) || (candidate < chosen);
+	}
+
+	static constexpr bool done(std::size_t chosen, std::size_t size) noexcept
+	{
+		return chosen == size;
+	}
+};
+
+/// No locking. The heap must only be used from one thread at a time.
+struct NullLock
+{
+	void lock() noexcept {}
+	void unlock() noexcept {}
+};
+
+/**
+ * @brief Lock the heap with a mutex
+ *
+ * `Mutex` is any type with lock() and unlock() members, such as std::mutex or a wrapper for an
+ * RTOS mutex. The mutex is stored in the heap.
+ */
+template<typename Mutex>
+class MutexLock
+{
+  public:
+	void lock()
+	{
+		mutex_.lock();
+	}
+
+	void unlock()
+	{
+		mutex_.unlock();
+	}
+
+  private:
+	Mutex mutex_;
+};
+
+/// No counters. stats() only reports what it can find by walking the free list.
+struct NoStats
+{
+	void add_free(std::size_t) noexcept {}
+	void remove_free(std::size_t) noexcept {}
+	void allocated() noexcept {}
+	void released() noexcept {}
+	void fill(malloc_stats_t&) const noexcept {}
+};
+
+/// Track free_bytes, min_free_bytes, allocations, and frees, like malloc_get_stats()
+class CountingStats
+{
+  public:
+	void add_free(std::size_t bytes) noexcept
+	{
+		free_bytes_ += bytes;
+	}
+
+	void remove_free(std::size_t bytes) noexcept
+	{
+		free_bytes_ -= bytes;
+	}
+
+	void allocated() noexcept
+	{
+		allocations_++;
+
+		if(free_bytes_ < min_free_bytes_)
+		{
+			min_free_bytes_ = free_bytes_;
+		}
+	}
+
+	void released() noexcept
+	{
+		frees_++;
+	}
+
+	void fill(malloc_stats_t& stats) const noexcept
+	{
+		// The running total must match the free list
+		assert(stats.free_bytes == free_bytes_);
+
+		stats.min_free_bytes = (min_free_bytes_ < free_bytes_) ? min_free_bytes_ : free_bytes_;
+		stats.allocations = allocations_;
+		stats.frees = frees_;
+	}
+
+  private:
+	std::size_t free_bytes_ = 0;
+	std::size_t min_free_bytes_ = SIZE_MAX;
+	std::size_t allocations_ = 0;
+	std::size_t frees_ = 0;
+};
+
+namespace detail
+{
+/// Hold a lock policy for the lifetime of the guard
+template<typename Lock>
+class lock_guard
+{
+  public:
+	explicit lock_guard(Lock& lock) : lock_(lock)
+	{
+		lock_.lock();
+	}
+
+	~lock_guard()
+	{
+		lock_.unlock();
+	}
+
+	lock_guard(const lock_guard&) = delete;
+	lock_guard& operator=(const lock_guard&) = delete;
+
+  private:
+	Lock& lock_;
+};
+} // namespace detail
+
+/**
+ * @brief Heap instance which allocates from memory added with add_block()
+ *
+ * The policies are private bases, so empty policies take no space.
+ */
+template<typename FitPolicy = FirstFit, typename LockPolicy = NullLock,
+		 typename StatsPolicy = NoStats, std::size_t Alignment = alignof(std::max_align_t)>
+class Heap : private LockPolicy, private StatsPolicy
+{
+	static_assert((Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two");
+	static_assert(Alignment >= sizeof(void*), "Alignment must be at least sizeof(void*)");
+
+  public:
+	constexpr Heap() noexcept = default;
+	Heap(const Heap&) = delete;
+	Heap& operator=(const Heap&) = delete;
+
+	/**
+	 * @brief Add a block of memory to the heap
+	 *
+	 * Works like malloc_addblock(). Blocks which are too small to hold an allocation are
+	 *	ignored.
+	 */
+	void add_block(void* addr, std::size_t size)
+	{
+		auto start = reinterpret_cast<std::uintptr_t>(addr);
+		std::uintptr_t node_addr = align_up(start, Alignment);
+
+		if((size < (node_addr - start)) || ((size - (node_addr - start)) < sizeof(node_t)))
+		{
+			return;
+		}
+
+		auto* block = reinterpret_cast<node_t*>(node_addr);
+		block->size = align_down(start + size - node_addr - header_size, Alignment);
+
+		detail::lock_guard<LockPolicy> guard(*this);
+		insert_free_block(block);
+	}
+
+	/**
+	 * @brief Allocate memory from the heap
+	 *
+	 * @return Pointer to allocated memory, or nullptr if the allocation could not be satisfied.
+	 */
+	void* allocate(std::size_t size)
+	{
+		return allocate_aligned(Alignment, size);
+	}
+
+	/**
+	 * @brief Allocate aligned memory from the heap
+	 *
+	 * @param align Alignment of the memory block. Must be a power of two.
+	 *
+	 * @return Pointer to allocated memory, or nullptr if the allocation could not be satisfied.
+	 *	The memory is released with deallocate().
+	 */
+	void* allocate_aligned(std::size_t align, std::size_t size)
+	{
+		// We want it to be a power of two since align_up operates on powers of two
+		assert((align & (align - 1)) == 0);
+
+		if((size == 0) || (size > (SIZE_MAX / 2)))
+		{
+			return nullptr;
+		}
+
+		size = block_alloc_size(size);
+		align = (align < Alignment) ? Alignment : align;
+
+		detail::lock_guard<LockPolicy> guard(*this);
+
+		node_t* prev = nullptr;
+		node_t* found_block = find_free_block(size, align, prev);
+
+		if(!found_block)
+		{
+			return nullptr;
+		}
+
+		found_block = carve_free_block(prev, found_block, size, align);
+		StatsPolicy::allocated();
+
+		return payload(found_block);
+	}
+
+	/**
+	 * @brief Release memory to the heap
+	 *
+	 * @param ptr Pointer returned by allocate() or allocate_aligned(). May be nullptr.
+	 */
+	void deallocate(void* ptr)
+	{
+		if(ptr)
+		{
+			detail::lock_guard<LockPolicy> guard(*this);
+			StatsPolicy::released();
+			insert_free_block(block_of(ptr));
+		}
+	}
+
+	/// Number of bytes which can be used at `ptr`, which is at least the requested size
+	std::size_t usable_size(void* ptr) const noexcept
+	{
+		return ptr ? block_of(ptr)->size : 0;
+	}
+
+	/**
+	 * @brief Get statistics for the heap, like malloc_get_stats()
+	 *
+	 * The free list is walked for the block statistics. min_free_bytes, allocations, and frees
+	 *	are only tracked with CountingStats, and are 0 otherwise.
+	 */
+	malloc_stats_t stats()
+	{
+		malloc_stats_t stats{};
+
+		detail::lock_guard<LockPolicy> guard(*this);
+
+		for(node_t* block = free_list_; block; block = block->next)
+		{
+			if(block->size > stats.largest_free_block)
+			{
+				stats.largest_free_block = block->size;
+			}
+
+			if(!stats.free_blocks || (block->size < stats.smallest_free_block))
+			{
+				stats.smallest_free_block = block->size;
+			}
+
+			stats.free_blocks++;
+			stats.free_bytes += block->size;
+		}
+
+		StatsPolicy::fill(stats);
+
+		return stats;
+	}
+
+  private:
+	/// Block header. Allocated blocks only use `size`, and `next` overlays the payload.
+	struct node_t
+	{
+		std::size_t size;
+		/// Only valid while the block is on the free list
+		alignas(Alignment) node_t* next;
+	};
+
+	/// Space in front of the payload of each block
+	static constexpr std::size_t header_size = offsetof(node_t, next);
+
+	/// Smallest payload a block can have, which must be able to hold the free list link
+	static constexpr std::size_t min_block_size = sizeof(node_t) - header_size;
+
+	/// Blocks are only split if the remainder has a payload of at least 32 bytes
+	static constexpr std::size_t min_split_size =
+		header_size + ((min_block_size > 32) ? min_block_size : 32);
+
+	static constexpr std::uintptr_t align_up(std::uintptr_t num, std::size_t align) noexcept
+	{
+		return (num + (align - 1)) & ~static_cast<std::uintptr_t>(align - 1);
+	}
+
+	static constexpr std::uintptr_t align_down(std::uintptr_t num, std::size_t align) noexcept
+	{
+		return num & ~static_cast<std::uintptr_t>(align - 1);
+	}
+
+	/// Round a requested size up to the size of the block which holds it
+	static constexpr std::size_t block_alloc_size(std::size_t size) noexcept
+	{
+		// Align the size so that the next block stays aligned
+		size = align_up(size, Alignment);
+
+		return (size < min_block_size) ? min_block_size : size;
+	}
+
+	static void* payload(node_t* block) noexcept
+	{
+		return reinterpret_cast<std::byte*>(block) + header_size;
+	}
+
+	static node_t* block_of(void* ptr) noexcept
+	{
+		return reinterpret_cast<node_t*>(static_cast<std::byte*>(ptr) - header_size);
+	}
+
+	/// Address of the first byte past the end of a block
+	static std::uintptr_t block_end(const node_t* block) noexcept
+	{
+		return reinterpret_cast<std::uintptr_t>(block) + header_size + block->size;
+	}
+
+	/**
+	 * First payload address in a free block which satisfies `align`.
+	 * If the payload needs to move, the memory skipped in front must be able to stay on the free
+	 * list.
+	 */
+	static std::uintptr_t aligned_payload(const node_t* block, std::size_t align) noexcept
+	{
+		std::uintptr_t start = reinterpret_cast<std::uintptr_t>(block) + header_size;
+
+		if((start & (align - 1)) == 0)
+		{
+			return start;
+		}
+
+		return align_up(start + min_split_size, align);
+	}
+
+	/// Check whether a free block can hold `size` bytes with the requested alignment
+	static bool block_fits(const node_t* block, std::size_t size, std::size_t align) noexcept
+	{
+		return (block->size >= size) &&
+			   ((aligned_payload(block, align) + size) <= block_end(block));
+	}
+
+	/// Find a free block for `size` bytes with the fit policy. `prev` receives the block before it.
+	node_t* find_free_block(std::size_t size, std::size_t align, node_t*& prev) noexcept
+	{
+		node_t* chosen = nullptr;
+		std::size_t chosen_size = 0;
+
+		for(node_t *block = free_list_, *block_prev = nullptr; block;
+			block_prev = block, block = block->next)
+		{
+			if(block_fits(block, size, align) && FitPolicy::better(block->size, chosen_size))
+			{
+				chosen = block;
+				chosen_size = block->size;
+				prev = block_prev;
+
+				if(FitPolicy::done(chosen_size, size))
+				{
+					break;
+				}
+			}
+		}
+
+		return chosen;
+	}
+
+	/**
+	 * Remove `size` bytes with the requested alignment from a free block.
+	 * Unused memory in front of and behind the allocation stays on the free list.
+	 *
+	 * @returns The allocated block, which is no longer on the free list.
+	 */
+	node_t* carve_free_block(node_t* prev, node_t* block, std::size_t size,
+							 std::size_t align) noexcept
+	{
+		std::uintptr_t start = aligned_payload(block, align);
+
+		// Split off the memory in front of an aligned payload
+		if(start != reinterpret_cast<std::uintptr_t>(payload(block)))
+		{
+			auto* aligned_block = reinterpret_cast<node_t*>(start - header_size);
+			aligned_block->size = block_end(block) - start;
+			aligned_block->next = block->next;
+			block->size = reinterpret_cast<std::uintptr_t>(aligned_block) -
+						  reinterpret_cast<std::uintptr_t>(payload(block));
+			block->next = aligned_block;
+			StatsPolicy::remove_free(header_size);
+			prev = block;
+			block = aligned_block;
+		}
+
+		// Can we split the block?
+		if((block->size - size) >= min_split_size)
+		{
+			auto* new_block = reinterpret_cast<node_t*>(
+				reinterpret_cast<std::uintptr_t>(payload(block)) + size);
+			new_block->size = block->size - size - header_size;
+			new_block->next = block->next;
+			block->size = size;
+			block->next = new_block;
+			StatsPolicy::remove_free(header_size);
+		}
+
+		(prev ? prev->next : free_list_) = block->next;
+		StatsPolicy::remove_free(block->size);
+
+		return block;
+	}
+
+	/// Insert a block into the free list by address, and merge it with adjacent free blocks
+	void insert_free_block(node_t* block) noexcept
+	{
+		node_t* prev = nullptr;
+		node_t* next = free_list_;
+
+		while(next && (next < block))
+		{
+			prev = next;
+			next = next->next;
+		}
+
+		StatsPolicy::add_free(block->size);
+
+		if(next && (block_end(block) == reinterpret_cast<std::uintptr_t>(next)))
+		{
+			block->size += header_size + next->size;
+			block->next = next->next;
+			StatsPolicy::add_free(header_size);
+		}
+		else
+		{
+			block->next = next;
+		}
+
+		if(prev && (block_end(prev) == reinterpret_cast<std::uintptr_t>(block)))
+		{
+			prev->size += header_size + block->size;
+			prev->next = block->next;
+			StatsPolicy::add_free(header_size);
+		}
+		else
+		{
+			(prev ? prev->next : free_list_) = block;
+		}
+	}
+
+	/// Free blocks, sorted by address
+	node_t* free_list_ = nullptr;
+};
+
+/**
+ * @brief Heap with fixed storage
+ *
+ * The storage is a std::array inside the object, so a global instance is placed in .bss and its
+ * size is known at compile time. The storage is added to the heap by the constructor.
+ */
+template<std::size_t Size, typename FitPolicy = FirstFit, typename LockPolicy = NullLock,
+		 typename StatsPolicy = NoStats, std::size_t Alignment = alignof(std::max_align_t)>
+class FixedHeap : public Heap<FitPolicy, LockPolicy, StatsPolicy, Alignment>
+{
+  public:
+	/// Size of the storage, including the block headers
+	static constexpr std::size_t capacity = Size;
+
+	FixedHeap() noexcept
+	{
+		this->add_block(storage_.data(), storage_.size());
+	}
+
+  private:
+	alignas(Alignment) std::array<std::byte, Size> storage_{};
+};
+
+} // namespace libmemory
+
+#endif // MALLOC_HEAP_HPP_
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef MALLOC_INSTRUMENTATION_H_
+#define MALLOC_INSTRUMENTATION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/// Number of buckets in each latency histogram.
+/// Bucket 0 counts zero-cycle samples, bucket N counts samples in the range [2^(N-1), 2^N).
+#define MALLOC_HISTOGRAM_BUCKETS 33
+
+/**
+ * @brief Cycle counter callback
+ *
+ * Returns a free-running cycle (or time) counter value. The counter is allowed to wrap,
+ * since only the difference between two readings is used.
+ *
+ * Examples include DWT->CYCCNT on Cortex-M, or rdtsc/clock_gettime() on a host machine.
+ */
+typedef uint32_t (*malloc_cycle_counter_t)(void);
+
+/// Operations which are tracked by the instrumentation
+typedef enum
+{
+	/// Time spent inside of malloc(), including time spent waiting on the lock
+	MALLOC_OP_MALLOC = 0,
+	/// Time spent inside of free(), including time spent waiting on the lock
+	MALLOC_OP_FREE,
+	/// Time spent waiting in malloc_lock() by malloc() and free()
+	MALLOC_OP_LOCK_WAIT,
+	/// Number of tracked operations
+	MALLOC_OP_COUNT
+} malloc_op_t;
+
+/// Latency data for a single operation type
+typedef struct
+{
+	/// Number of samples recorded
+	uint32_t count;
+	/// Smallest sample recorded (in counter ticks)
+	uint32_t min;
+	/// Largest sample recorded (in counter ticks)
+	uint32_t max;
+	/// Sum of all samples (in counter ticks)
+	uint64_t total;
+	/// Log2-bucketed sample counts
+	uint32_t buckets[MALLOC_HISTOGRAM_BUCKETS];
+} malloc_histogram_t;
+
+/**
+ * @brief Enable latency instrumentation
+ *
+ * Once a counter is registered, the entry and exit of each malloc() and free() call is
+ * timestamped and the result is accumulated into a per-operation histogram.
+ * Instrumentation is disabled by default.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param counter The cycle counter callback to use. Pass NULL to disable instrumentation.
+ */
+void malloc_instrumentation_enable(malloc_cycle_counter_t counter);
+
+/**
+ * @brief Read the histogram for an operation
+ *
+ * @param op The operation to read.
+ * @param histogram Storage for the histogram contents. Must not be NULL.
+ * @param reset If true, the histogram for this operation is cleared after it is read.
+ */
+void malloc_histogram_read(malloc_op_t op, malloc_histogram_t* histogram, bool reset);
+
+/**
+ * @brief Reset all histograms
+ */
+void malloc_histogram_reset(void);
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif // MALLOC_INSTRUMENTATION_H_
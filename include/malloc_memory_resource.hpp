@@ -0,0 +1,275 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef MALLOC_MEMORY_RESOURCE_HPP_
+#define MALLOC_MEMORY_RESOURCE_HPP_
+
+/**
+ * std::pmr::memory_resource implementations backed by the libmemory freelist heap.
+ *
+ * Requests which need no more than MALLOC_NATIVE_ALIGNMENT use malloc() and free_sized().
+ * Over-aligned requests use malloc_aligned() and free_aligned_sized(), so the allocator handles
+ * them itself and no aligned_malloc() offset header is needed. The heap profiler attributes
+ * each allocation to the caller of do_allocate(), not to this header.
+ *
+ * Allocation failures throw std::bad_alloc. When exceptions are disabled, failures return nullptr.
+ *
+ * This header requires C++17.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <malloc.h>
+#include <malloc_profiler.h>
+#include <memory_resource>
+#include <new>
+
+namespace libmemory
+{
+namespace detail
+{
+/// Report a failed allocation in the way the memory_resource contract expects
+inline void* check_allocation(void* ptr)
+{
+#if defined(__cpp_exceptions)
+	if(!ptr)
+	{
+		throw std::bad_alloc();
+	}
+#endif
+
+	return ptr;
+}
+
+/// memory_resource allocations may be zero-sized, but must still return a unique pointer
+constexpr std::size_t nonzero_size(std::size_t bytes)
+{
+	return bytes ? bytes : 1;
+}
+
+/// Alignments which malloc() already provides do not need malloc_aligned()
+constexpr bool native_alignment(std::size_t alignment)
+{
+	return alignment <= MALLOC_NATIVE_ALIGNMENT;
+}
+} // namespace detail
+
+/**
+ * @brief Thread-safe memory_resource backed by the heap
+ *
+ * Every allocation and deallocation holds malloc_lock(). Use heap_resource() to access the
+ * shared instance.
+ */
+class heap_memory_resource final : public std::pmr::memory_resource
+{
+  protected:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		const std::size_t size = detail::nonzero_size(bytes);
+		void* caller = __builtin_return_address(0);
+
+		return detail::check_allocation(
+			detail::native_alignment(alignment)
+				? malloc_for_caller(size, caller)
+				: malloc_aligned_for_caller(alignment, size, caller));
+	}
+
+	void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+	{
+		if(detail::native_alignment(alignment))
+		{
+			free_sized(ptr, detail::nonzero_size(bytes));
+		}
+		else
+		{
+			free_aligned_sized(ptr, alignment, detail::nonzero_size(bytes));
+		}
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+/**
+ * @brief memory_resource backed by the heap, which does not call malloc_lock()
+ *
+ * Intended for code which already serializes access to the heap, such as a single thread
+ * in an application where malloc_lock() takes a mutex. The cost of the lock is skipped for
+ * each allocation and deallocation.
+ *
+ * Use unsynchronized_heap_resource() to access the shared instance.
+ */
+class unsynchronized_heap_memory_resource final : public std::pmr::memory_resource
+{
+  protected:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		// Alignments up to MALLOC_NATIVE_ALIGNMENT take the same path as malloc()
+		return detail::check_allocation(malloc_aligned_unlocked_for_caller(
+			alignment, detail::nonzero_size(bytes), __builtin_return_address(0)));
+	}
+
+	void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+	{
+		free_aligned_sized_unlocked(ptr, alignment, detail::nonzero_size(bytes));
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+/// Shared thread-safe heap resource
+inline std::pmr::memory_resource* heap_resource() noexcept
+{
+	static heap_memory_resource resource;
+	return &resource;
+}
+
+/// Shared heap resource which does not call malloc_lock()
+inline std::pmr::memory_resource* unsynchronized_heap_resource() noexcept
+{
+	static unsynchronized_heap_memory_resource resource;
+	return &resource;
+}
+
+/**
+ * @brief Monotonic memory_resource carved from heap blocks
+ *
+ * A block of `initial_size` bytes is allocated from the heap when the resource is constructed.
+ * Allocations are carved from the block by bumping a pointer, and deallocation is a no-op.
+ * When the block is exhausted, another block of twice the size is allocated from the heap.
+ * All blocks are returned to the heap by release() or the destructor.
+ *
+ * Like std::pmr::monotonic_buffer_resource, this class is not thread-safe. The heap blocks
+ * themselves are allocated with malloc_lock() held.
+ */
+class monotonic_heap_memory_resource final : public std::pmr::memory_resource
+{
+  public:
+	explicit monotonic_heap_memory_resource(std::size_t initial_size)
+		: initial_size_(initial_size < min_block_size ? min_block_size : initial_size),
+		  next_size_(initial_size_)
+	{
+		add_block(0);
+	}
+
+	monotonic_heap_memory_resource(const monotonic_heap_memory_resource&) = delete;
+	monotonic_heap_memory_resource& operator=(const monotonic_heap_memory_resource&) = delete;
+
+	~monotonic_heap_memory_resource() override
+	{
+		release();
+	}
+
+	/// Return every block to the heap
+	void release() noexcept
+	{
+		while(blocks_)
+		{
+			block_t* next = blocks_->next;
+			free_sized(blocks_, blocks_->size);
+			blocks_ = next;
+		}
+
+		current_ = 0;
+		end_ = 0;
+		next_size_ = initial_size_;
+	}
+
+	/// Number of bytes which can be allocated before another block is needed
+	std::size_t remaining() const noexcept
+	{
+		return end_ - current_;
+	}
+
+  protected:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		void* ptr = carve(bytes, alignment);
+
+		if(!ptr && add_block(bytes + alignment))
+		{
+			ptr = carve(bytes, alignment);
+		}
+
+		return detail::check_allocation(ptr);
+	}
+
+	void do_deallocate(void*, std::size_t, std::size_t) override
+	{
+		// Memory is only reclaimed by release()
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+
+  private:
+	/// Header at the start of each heap block
+	struct block_t
+	{
+		block_t* next;
+		std::size_t size;
+	};
+
+	static constexpr std::size_t min_block_size = 4 * sizeof(block_t);
+
+	/// Bump-allocate from the current block. Returns nullptr if it does not fit.
+	void* carve(std::size_t bytes, std::size_t alignment) noexcept
+	{
+		std::uintptr_t start = (current_ + (alignment - 1)) & ~(std::uintptr_t)(alignment - 1);
+
+		if(!blocks_ || (start < current_) || (start > end_) || ((end_ - start) < bytes))
+		{
+			return nullptr;
+		}
+
+		current_ = start + bytes;
+		return reinterpret_cast<void*>(start);
+	}
+
+	/// Allocate a new block with room for at least `min_bytes` after its header
+	bool add_block(std::size_t min_bytes) noexcept
+	{
+		std::size_t size = next_size_;
+
+		while((size - sizeof(block_t)) < min_bytes)
+		{
+			size *= 2;
+		}
+
+		// carve() aligns each allocation, so the block only needs malloc()'s alignment
+		auto* block = static_cast<block_t*>(malloc(size));
+
+		if(!block)
+		{
+			return false;
+		}
+
+		block->next = blocks_;
+		block->size = size;
+		blocks_ = block;
+		current_ = reinterpret_cast<std::uintptr_t>(block + 1);
+		end_ = reinterpret_cast<std::uintptr_t>(block) + size;
+		next_size_ = size * 2;
+
+		return true;
+	}
+
+	const std::size_t initial_size_;
+	std::size_t next_size_;
+	block_t* blocks_ = nullptr;
+	std::uintptr_t current_ = 0;
+	std::uintptr_t end_ = 0;
+};
+
+} // namespace libmemory
+
+#endif // MALLOC_MEMORY_RESOURCE_HPP_
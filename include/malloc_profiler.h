@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef MALLOC_PROFILER_H_
+#define MALLOC_PROFILER_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/// Maximum number of return addresses recorded for each call site.
+/// Your application can define this macro to record deeper call stacks.
+#ifndef MALLOC_PROFILER_MAX_FRAMES
+#define MALLOC_PROFILER_MAX_FRAMES 4
+#endif
+
+/**
+ * @brief Call stack unwinder callback
+ *
+ * Fills `frames` with up to `max_frames` return addresses for the current call stack.
+ *	The unwinder is invoked from within malloc() with the malloc lock held, so it must not
+ *	call malloc() or free(). Frames belonging to libmemory may be included.
+ *
+ * @param frames Storage for the return addresses.
+ * @param max_frames Number of entries in `frames`.
+ * @returns The number of frames that were recorded. If 0, the immediate caller of malloc()
+ *	is used instead.
+ */
+typedef size_t (*malloc_unwinder_t)(void** frames, size_t max_frames);
+
+/// Sampled allocation data for a single call site
+typedef struct
+{
+	/// Return addresses which identify the call site
+	void* frames[MALLOC_PROFILER_MAX_FRAMES];
+	/// Number of valid entries in `frames`
+	size_t frame_cnt;
+	/// Total size of the sampled allocations from this call site which are still live
+	size_t live_bytes;
+	/// Number of sampled allocations from this call site which are still live
+	size_t live_samples;
+	/// Number of samples ever recorded for this call site
+	size_t total_samples;
+} malloc_callsite_t;
+
+/**
+ * @brief Callback which receives call site data from malloc_profiler_dump()
+ *
+ * @param callsite The call site data. Only valid for the duration of the callback.
+ * @param context The context pointer which was passed to malloc_profiler_dump().
+ */
+typedef void (*malloc_profiler_dump_callback_t)(const malloc_callsite_t* callsite, void* context);
+
+/**
+ * @brief Enable the sampling heap profiler
+ *
+ * On average, one allocation is sampled every `sample_interval` bytes allocated. The distance
+ *	between samples follows a geometric distribution, so allocation patterns cannot hide
+ *	from the sampler. Allocations which are not sampled only pay for a counter decrement.
+ *
+ * Enabling the profiler discards all previously recorded samples.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param sample_interval Mean number of bytes allocated between samples. Pass 0 to disable
+ *	the profiler.
+ * @param unwinder Call stack unwinder. If NULL, the immediate caller of malloc() is recorded
+ *	using __builtin_return_address(). Allocations through calloc(), realloc(), operator new,
+ *	and the heap memory resources are recorded at their caller, see malloc_for_caller().
+ */
+void malloc_profiler_enable(size_t sample_interval, malloc_unwinder_t unwinder);
+
+/**
+ * @brief Report the sampled allocations for each call site
+ *
+ * The callback is invoked without the malloc lock held, so it may allocate memory.
+ *
+ * @param callback Invoked once for each recorded call site. Must not be NULL.
+ * @param context Passed through to the callback.
+ */
+void malloc_profiler_dump(malloc_profiler_dump_callback_t callback, void* context);
+
+/**
+ * @brief Get the number of samples which could not be recorded
+ *
+ * Samples are dropped when the call site table or live sample table is full.
+ *
+ * @returns The number of dropped samples since the profiler was enabled.
+ */
+size_t malloc_profiler_dropped_samples(void);
+
+/**
+ * @brief Allocate memory on behalf of another call site
+ *
+ * Allocation wrappers, such as calloc(), realloc(), and operator new, use these in place of
+ *	malloc(), malloc_aligned(), and malloc_aligned_unlocked(). When no unwinder is registered,
+ *	a sampled allocation is attributed to `caller` instead of to the wrapper. Pass the
+ *	wrapper's own return address, from __builtin_return_address(0), as `caller`.
+ *
+ * This API is supported by the freelist implementation.
+ *
+ * @param size The number of bytes to allocate.
+ * @param caller The return address which identifies the call site.
+ * @returns A pointer to the allocated memory, or NULL on failure.
+ */
+void* malloc_for_caller(size_t size, void* caller);
+
+/// malloc_aligned() on behalf of `caller`, see malloc_for_caller()
+void* malloc_aligned_for_caller(size_t align, size_t size, void* caller);
+
+/// malloc_aligned_unlocked() on behalf of `caller`, see malloc_for_caller()
+void* malloc_aligned_unlocked_for_caller(size_t align, size_t size, void* caller);
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif // MALLOC_PROFILER_H_
@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+#pragma mark - Definitions -
+
+// We forward declare these to prevent include header prevention from the OS
+extern void* malloc(size_t size);
+extern void free(void* ptr);
+
+/**
+ * Simple macro for making sure memory addresses are aligned
+ * to the nearest power of two
+ */
+#ifndef align_up
+#define align_up(num, align) (((num) + ((align)-1)) & ~((align)-1))
+#endif
+
+/// Smallest alignment handed out by arena_alloc()
+#define ARENA_MIN_ALIGNMENT sizeof(void*)
+
+/// Header in front of each chunk of memory
+typedef struct arena_chunk
+{
+	/// Next chunk in the chain, which is reused after arena_reset()
+	struct arena_chunk* next;
+	/// Address one past the end of the chunk
+	uintptr_t end;
+} arena_chunk_t;
+
+struct arena
+{
+	/// First chunk, which is allocated along with the arena
+	arena_chunk_t first;
+	/// Chunk which allocations are currently bumped from
+	arena_chunk_t* current;
+	/// Next free address in the current chunk
+	uintptr_t pos;
+	/// Bytes allocated from chunks before the current one
+	size_t used_before_current;
+	/// Usable size of the chunks which are added
+	size_t chunk_size;
+	/// Whether the arena was allocated by arena_create(), and can add chunks
+	bool on_heap;
+};
+
+/**
+ * Largest chunk size whose allocation, including its header and alignment padding, fits in
+ * a size_t. The arena header is larger than a chunk header, so this applies to both.
+ */
+#define ARENA_MAX_CHUNK_SIZE (SIZE_MAX - sizeof(arena_t) - ARENA_MIN_ALIGNMENT)
+
+#pragma mark - Private Functions -
+
+static inline uintptr_t chunk_start(const arena_chunk_t* chunk)
+{
+	return align_up((uintptr_t)(chunk + 1), ARENA_MIN_ALIGNMENT);
+}
+
+/// The first chunk's memory follows the arena structure, rather than its header
+static inline uintptr_t arena_chunk_start(const arena_t* arena, const arena_chunk_t* chunk)
+{
+	return (chunk == &arena->first) ? align_up((uintptr_t)(arena + 1), ARENA_MIN_ALIGNMENT)
+									: chunk_start(chunk);
+}
+
+/// Move to the next chunk in the chain, adding one which can hold `size` bytes if needed
+static bool next_chunk(arena_t* arena, size_t size, size_t align)
+{
+	arena_chunk_t* chunk = arena->current->next;
+
+	if(!chunk)
+	{
+		size_t chunk_size = arena->chunk_size;
+
+		if(!arena->on_heap || (align > ARENA_MAX_CHUNK_SIZE) ||
+		   (size > (ARENA_MAX_CHUNK_SIZE - align)))
+		{
+			return false;
+		}
+
+		// Oversized requests get a chunk of their own
+		if(chunk_size < (size + align))
+		{
+			chunk_size = size + align;
+		}
+
+		chunk = malloc(sizeof(arena_chunk_t) + ARENA_MIN_ALIGNMENT + chunk_size);
+
+		if(!chunk)
+		{
+			return false;
+		}
+
+		chunk->next = NULL;
+		chunk->end = chunk_start(chunk) + chunk_size;
+		arena->current->next = chunk;
+	}
+
+	arena->used_before_current += arena->pos - arena_chunk_start(arena, arena->current);
+	arena->current = chunk;
+	arena->pos = chunk_start(chunk);
+
+	return true;
+}
+
+#pragma mark - APIs -
+
+arena_t* arena_create(size_t size)
+{
+	arena_t* arena = NULL;
+
+	if(size && (size <= ARENA_MAX_CHUNK_SIZE))
+	{
+		arena = malloc(sizeof(arena_t) + ARENA_MIN_ALIGNMENT + size);
+
+		if(arena)
+		{
+			arena->on_heap = true;
+			arena->chunk_size = size;
+			arena->first.next = NULL;
+			arena->first.end = arena_chunk_start(arena, &arena->first) + size;
+			arena_reset(arena);
+		}
+	}
+
+	return arena;
+}
+
+arena_t* arena_create_from_buffer(void* buffer, size_t size)
+{
+	assert(buffer);
+
+	uintptr_t start = align_up((uintptr_t)buffer, _Alignof(arena_t));
+	uintptr_t end = (uintptr_t)buffer + size;
+	arena_t* arena = (arena_t*)start;
+
+	if(!buffer || (end < start) || ((end - start) < sizeof(arena_t)) ||
+	   (arena_chunk_start(arena, &arena->first) > end))
+	{
+		return NULL;
+	}
+
+	arena->on_heap = false;
+	arena->chunk_size = 0;
+	arena->first.next = NULL;
+	arena->first.end = end;
+	arena_reset(arena);
+
+	return arena;
+}
+
+void* arena_alloc(arena_t* arena, size_t size, size_t align)
+{
+	// We want it to be a power of two since align_up operates on powers of two
+	assert(arena && ((align & (align - 1)) == 0));
+
+	if(align < ARENA_MIN_ALIGNMENT)
+	{
+		align = ARENA_MIN_ALIGNMENT;
+	}
+
+	// Sizes which wrap around once aligned can never be served
+	if(!size || (size > (SIZE_MAX - align)))
+	{
+		return NULL;
+	}
+
+	do
+	{
+		uintptr_t start = align_up(arena->pos, align);
+
+		if((start >= arena->pos) && (start <= arena->current->end) &&
+		   ((arena->current->end - start) >= size))
+		{
+			arena->pos = start + size;
+			return (void*)start;
+		}
+	} while(next_chunk(arena, size, align));
+
+	return NULL;
+}
+
+void arena_reset(arena_t* arena)
+{
+	assert(arena);
+
+	arena->current = &arena->first;
+	arena->pos = arena_chunk_start(arena, &arena->first);
+	arena->used_before_current = 0;
+}
+
+void arena_destroy(arena_t* arena)
+{
+	if(arena && arena->on_heap)
+	{
+		arena_chunk_t* chunk = arena->first.next;
+
+		while(chunk)
+		{
+			arena_chunk_t* next = chunk->next;
+			free(chunk);
+			chunk = next;
+		}
+
+		free(arena);
+	}
+}
+
+size_t arena_used(const arena_t* arena)
+{
+	assert(arena);
+
+	return arena->used_before_current + (arena->pos - arena_chunk_start(arena, arena->current));
+}
@@ -0,0 +1,428 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This is a bitmap allocator intended for small heaps. Each block of memory added with
+ * malloc_addblock() is divided into fixed-size granules. Allocation state is kept in two
+ * bitmaps at the start of the block, out of band from the memory that is handed out:
+ *
+ *	- The "used" bitmap has a bit set for each allocated granule.
+ *	- The "last" bitmap marks the final granule of each allocation, which is used to
+ *	  recover the size of an allocation in free() and malloc_usable_size().
+ *
+ * This costs two bits per granule, and allocations carry no header.
+ * Free runs are found one word at a time with CTZ. On SSE2 and NEON targets,
+ * fully-allocated parts of the bitmap are skipped four words at a time.
+ */
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/// Allocation granularity in bytes. Must be a power of two which is at least sizeof(void*).
+/// Your application can define this macro to trade bitmap size against internal fragmentation.
+#ifndef BITMAP_GRANULE_SIZE
+#define BITMAP_GRANULE_SIZE 16
+#endif
+
+/// Maximum number of blocks which can be added with malloc_addblock().
+/// Your application can define this macro to increase the number of blocks.
+#ifndef BITMAP_MAX_HEAPS
+#define BITMAP_MAX_HEAPS 4
+#endif
+
+#pragma mark - Definitions -
+
+#ifndef align_up
+#define align_up(num, align) (((num) + ((align)-1)) & ~((align)-1))
+#endif
+
+typedef uint32_t bitmap_word_t;
+
+#define WORD_BITS (sizeof(bitmap_word_t) * 8)
+#define WORD_FULL ((bitmap_word_t)~(bitmap_word_t)0)
+
+/// Marker for a failed search
+#define NO_RUN SIZE_MAX
+
+/// A block of memory added with malloc_addblock()
+typedef struct
+{
+	/// Address of the first granule
+	uintptr_t base;
+	/// Number of granules in the heap
+	size_t granules;
+	/// Number of words in each bitmap
+	size_t words;
+	bitmap_word_t* used;
+	bitmap_word_t* last;
+} bitmap_heap_t;
+
+#pragma mark - Prototypes -
+
+/**
+ * @brief Lock malloc (for thread safety.)
+ *
+ * Weakly linked, can be overridden based on your needs.
+ * By default, this implementation is not thread safe, and malloc_lock() is a no-op.
+ * If you need a thread-safe version, define the function for your system - it should
+ * lock a mutex.
+ *
+ * @post The lock is held by a single thread.
+ */
+void malloc_lock();
+
+/**
+ * @brief Unlock malloc (for thread safety)
+ *
+ * Weakly linked, can be overridden based on your needs.
+ * By default, this implementation is not thread safe, and malloc_unlock() is a no-op.
+ * If you need a thread-safe version, define the function for your system - it should
+ * unlock a mutex.
+ *
+ * @post The lock is released.
+ */
+void malloc_unlock();
+
+#pragma mark - Declarations -
+
+static bitmap_heap_t heaps_[BITMAP_MAX_HEAPS];
+static size_t heap_cnt_ = 0;
+
+#pragma mark - Private Functions -
+
+/// Mask with bits [first, first + count) set. `count` must be in [1, WORD_BITS - first].
+static inline bitmap_word_t bit_range(size_t first, size_t count)
+{
+	bitmap_word_t mask = (count == WORD_BITS) ? WORD_FULL : (((bitmap_word_t)1 << count) - 1);
+
+	return mask << first;
+}
+
+/// Set or clear `count` bits in a bitmap, starting at `bit`
+static void set_bits(bitmap_word_t* map, size_t bit, size_t count, bool value)
+{
+	while(count)
+	{
+		size_t offset = bit % WORD_BITS;
+		size_t n = ((WORD_BITS - offset) < count) ? (WORD_BITS - offset) : count;
+		bitmap_word_t mask = bit_range(offset, n);
+
+		if(value)
+		{
+			map[bit / WORD_BITS] |= mask;
+		}
+		else
+		{
+			map[bit / WORD_BITS] &= ~mask;
+		}
+
+		bit += n;
+		count -= n;
+	}
+}
+
+/// Index of the first word at or after `word` which is not fully allocated
+static size_t skip_full_words(const bitmap_word_t* map, size_t word, size_t words)
+{
+#if defined(__SSE2__)
+	const __m128i full = _mm_set1_epi32(-1);
+
+	for(; (word + 4) <= words; word += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(const void*)&map[word]);
+
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(v, full)) != 0xFFFF)
+		{
+			break;
+		}
+	}
+#elif defined(__ARM_NEON)
+	for(; (word + 4) <= words; word += 4)
+	{
+		uint32x4_t v = vld1q_u32(&map[word]);
+		uint32x2_t folded = vand_u32(vget_low_u32(v), vget_high_u32(v));
+
+		if((vget_lane_u32(folded, 0) & vget_lane_u32(folded, 1)) != WORD_FULL)
+		{
+			break;
+		}
+	}
+#endif
+
+	while((word < words) && (map[word] == WORD_FULL))
+	{
+		word++;
+	}
+
+	return word;
+}
+
+/// Find the first run of `count` free granules. Returns NO_RUN if there is none.
+static size_t find_free_run(const bitmap_heap_t* heap, size_t count)
+{
+	size_t run_start = 0;
+	size_t run_len = 0;
+
+	for(size_t w = 0; w < heap->words; w++)
+	{
+		bitmap_word_t used = heap->used[w];
+
+		if(used == WORD_FULL)
+		{
+			w = skip_full_words(heap->used, w, heap->words) - 1;
+			run_len = 0;
+			continue;
+		}
+
+		if(used == 0)
+		{
+			if(run_len == 0)
+			{
+				run_start = w * WORD_BITS;
+			}
+
+			run_len += WORD_BITS;
+		}
+		else
+		{
+			// Walk the alternating free and used runs in this word
+			size_t bit = 0;
+
+			while(bit < WORD_BITS)
+			{
+				bitmap_word_t rest = used >> bit;
+
+				if(rest & 1)
+				{
+					// Bits shifted in at the top are zero, so ~rest always has a set bit
+					bit += (size_t)__builtin_ctz(~rest);
+					run_len = 0;
+					continue;
+				}
+
+				size_t zeros = rest ? (size_t)__builtin_ctz(rest) : (WORD_BITS - bit);
+
+				if(run_len == 0)
+				{
+					run_start = (w * WORD_BITS) + bit;
+				}
+
+				run_len += zeros;
+
+				if(run_len >= count)
+				{
+					return run_start;
+				}
+
+				bit += zeros;
+			}
+		}
+
+		if(run_len >= count)
+		{
+			return run_start;
+		}
+	}
+
+	return NO_RUN;
+}
+
+/// Find the next set bit at or after `bit`. The bit must exist.
+static size_t find_next_set(const bitmap_word_t* map, size_t bit)
+{
+	size_t w = bit / WORD_BITS;
+	bitmap_word_t word = map[w] & ~(bit_range(0, bit % WORD_BITS + 1) >> 1);
+
+	while(word == 0)
+	{
+		word = map[++w];
+	}
+
+	return (w * WORD_BITS) + (size_t)__builtin_ctz(word);
+}
+
+/// Look up the heap which contains `ptr`
+static bitmap_heap_t* find_heap(const void* ptr)
+{
+	uintptr_t addr = (uintptr_t)ptr;
+
+	for(size_t i = 0; i < heap_cnt_; i++)
+	{
+		bitmap_heap_t* heap = &heaps_[i];
+
+		if((addr >= heap->base) && (addr < (heap->base + (heap->granules * BITMAP_GRANULE_SIZE))))
+		{
+			return heap;
+		}
+	}
+
+	return NULL;
+}
+
+/// Granule index of an allocation. Asserts that `ptr` was returned by malloc().
+static size_t allocation_granule(const bitmap_heap_t* heap, const void* ptr)
+{
+	size_t granule = ((uintptr_t)ptr - heap->base) / BITMAP_GRANULE_SIZE;
+
+	assert((((uintptr_t)ptr - heap->base) % BITMAP_GRANULE_SIZE) == 0);
+	assert(heap->used[granule / WORD_BITS] & ((bitmap_word_t)1 << (granule % WORD_BITS)));
+
+	return granule;
+}
+
+#pragma mark - APIs -
+
+__attribute__((weak)) void malloc_init(void)
+{
+	// Unused here, override to specify your own init function
+	// Which includes malloc_addblock calls
+}
+
+__attribute__((weak)) void malloc_lock()
+{
+	// Intentional no-op
+}
+
+__attribute__((weak)) void malloc_unlock()
+{
+	// Intentional no-op
+}
+
+void malloc_addblock(void* addr, size_t size)
+{
+	uintptr_t start = align_up((uintptr_t)addr, sizeof(bitmap_word_t));
+	uintptr_t end = (uintptr_t)addr + size;
+
+	assert(addr && (size > 0));
+	assert((heap_cnt_ < BITMAP_MAX_HEAPS) && "Too many heaps!");
+
+	if((heap_cnt_ == BITMAP_MAX_HEAPS) || (end <= start))
+	{
+		return;
+	}
+
+	// Each granule costs BITMAP_GRANULE_SIZE bytes plus two bitmap bits.
+	// Start from that estimate and shrink until the bitmaps and the aligned granules fit.
+	size_t granules = ((end - start) * 8) / ((BITMAP_GRANULE_SIZE * 8) + 2);
+
+	for(; granules > 0; granules--)
+	{
+		size_t words = (granules + WORD_BITS - 1) / WORD_BITS;
+		uintptr_t base = align_up(start + (2 * words * sizeof(bitmap_word_t)), BITMAP_GRANULE_SIZE);
+
+		if((base + (granules * BITMAP_GRANULE_SIZE)) <= end)
+		{
+			break;
+		}
+	}
+
+	if(granules == 0)
+	{
+		return;
+	}
+
+	bitmap_heap_t heap;
+	heap.granules = granules;
+	heap.words = (granules + WORD_BITS - 1) / WORD_BITS;
+	heap.used = (bitmap_word_t*)start;
+	heap.last = heap.used + heap.words;
+	heap.base = align_up((uintptr_t)(heap.last + heap.words), BITMAP_GRANULE_SIZE);
+
+	memset(heap.used, 0, 2 * heap.words * sizeof(bitmap_word_t));
+
+	// Bits past the last granule are permanently allocated
+	if(granules % WORD_BITS)
+	{
+		heap.used[heap.words - 1] = ~bit_range(0, granules % WORD_BITS);
+	}
+
+	malloc_lock();
+	heaps_[heap_cnt_++] = heap;
+	malloc_unlock();
+}
+
+void* malloc(size_t size)
+{
+	void* ptr = NULL;
+
+	// Larger sizes would wrap around to a granule count of 0 when they are rounded up
+	if((size > 0) && (size <= (SIZE_MAX - (BITMAP_GRANULE_SIZE - 1))))
+	{
+		size_t count = (size + BITMAP_GRANULE_SIZE - 1) / BITMAP_GRANULE_SIZE;
+
+		malloc_lock();
+
+		for(size_t i = 0; i < heap_cnt_; i++)
+		{
+			bitmap_heap_t* heap = &heaps_[i];
+			size_t granule = find_free_run(heap, count);
+
+			if(granule != NO_RUN)
+			{
+				set_bits(heap->used, granule, count, true);
+				set_bits(heap->last, granule + count - 1, 1, true);
+				ptr = (void*)(heap->base + (granule * BITMAP_GRANULE_SIZE));
+				break;
+			}
+		}
+
+		malloc_unlock();
+	}
+
+	return ptr;
+}
+
+void free(void* ptr)
+{
+	if(ptr)
+	{
+		malloc_lock();
+
+		bitmap_heap_t* heap = find_heap(ptr);
+		assert(heap && "Pointer was not allocated by malloc()");
+
+		if(heap)
+		{
+			size_t granule = allocation_granule(heap, ptr);
+			size_t last = find_next_set(heap->last, granule);
+
+			set_bits(heap->used, granule, last - granule + 1, false);
+			set_bits(heap->last, last, 1, false);
+		}
+
+		malloc_unlock();
+	}
+}
+
+size_t malloc_usable_size(void* ptr)
+{
+	size_t size = 0;
+
+	if(ptr)
+	{
+		malloc_lock();
+
+		bitmap_heap_t* heap = find_heap(ptr);
+
+		if(heap)
+		{
+			size_t granule = allocation_granule(heap, ptr);
+			size = (find_next_set(heap->last, granule) - granule + 1) * BITMAP_GRANULE_SIZE;
+		}
+
+		malloc_unlock();
+	}
+
+	return size;
+}
@@ -3,8 +3,188 @@
  * License: MIT. See LICENSE file for details.
  */
 
+/**
+ * NOTE: Adapter for the Embedded Virtual Machine framework's os::Heap.
+ *
+ * malloc() and free() map to os::Heap::alloc() and os::Heap::free(). The extended APIs are
+ * forwarded to these os::Heap members when the heap provides them, which is detected at
+ * compile time:
+ *	- `void* allocAligned(size_t align, size_t size)`, for malloc_aligned(). The memory must be
+ *	  released by os::Heap::free().
+ *	- `void free(void* ptr, size_t size)`, for free_sized() and free_aligned_sized()
+ *	- `void* realloc(void* ptr, size_t size)`, for realloc()
+ *	- `size_t usableSize(void* ptr)`, for malloc_usable_size()
+ *
+ * Heaps without these members fall back to alloc() and free():
+ *	- malloc_aligned() returns NULL for alignments stricter than alignof(max_align_t)
+ *	- realloc() moves allocations with usableSize(), and keeps them in place when they shrink
+ *
+ * realloc() and malloc_usable_size() replace the C library's versions, so they need a heap
+ *	which can provide them. Heaps without realloc() or usableSize() fail to compile, unless
+ *	FRAMEWORK_RTOS_REALLOC is set to 0, which leaves realloc() undefined. Likewise, heaps
+ *	without usableSize() need FRAMEWORK_RTOS_USABLE_SIZE set to 0.
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <heap.hpp>
 #include <malloc.h>
+#include <malloc_profiler.h>
+#include <type_traits>
+#include <utility>
+
+#pragma mark - Definitions -
+
+/// Define realloc(), which needs os::Heap::realloc() or os::Heap::usableSize()
+#ifndef FRAMEWORK_RTOS_REALLOC
+#define FRAMEWORK_RTOS_REALLOC 1
+#endif
+
+/// Define malloc_usable_size(), which needs os::Heap::usableSize()
+#ifndef FRAMEWORK_RTOS_USABLE_SIZE
+#define FRAMEWORK_RTOS_USABLE_SIZE 1
+#endif
+
+#pragma mark - Private Functions -
+
+namespace
+{
+/// Alignment which os::Heap::alloc() is assumed to provide
+constexpr std::size_t natural_alignment = alignof(std::max_align_t);
+
+template<typename Heap, typename = void>
+struct has_alloc_aligned : std::false_type
+{
+};
+
+template<typename Heap>
+struct has_alloc_aligned<
+	Heap, std::void_t<decltype(Heap::allocAligned(std::size_t{}, std::size_t{}))>>
+	: std::true_type
+{
+};
+
+template<typename Heap, typename = void>
+struct has_free_sized : std::false_type
+{
+};
+
+template<typename Heap>
+struct has_free_sized<
+	Heap, std::void_t<decltype(Heap::free(std::declval<void*>(), std::size_t{}))>>
+	: std::true_type
+{
+};
+
+template<typename Heap, typename = void>
+struct has_realloc : std::false_type
+{
+};
+
+template<typename Heap>
+struct has_realloc<
+	Heap, std::void_t<decltype(Heap::realloc(std::declval<void*>(), std::size_t{}))>>
+	: std::true_type
+{
+};
+
+template<typename Heap, typename = void>
+struct has_usable_size : std::false_type
+{
+};
+
+template<typename Heap>
+struct has_usable_size<Heap,
+					   std::void_t<decltype(Heap::usableSize(std::declval<void*>()))>>
+	: std::true_type
+{
+};
+
+template<typename Heap>
+void* heap_alloc_aligned(std::size_t align, std::size_t size)
+{
+	if constexpr(has_alloc_aligned<Heap>::value)
+	{
+		return Heap::allocAligned(align, size);
+	}
+	else
+	{
+		// Memory from aligned_malloc() can't be released with free(), so it is not a fallback
+		return (align <= natural_alignment) ? Heap::alloc(size) : nullptr;
+	}
+}
+
+template<typename Heap>
+void heap_free_sized(void* ptr, std::size_t size)
+{
+	if constexpr(has_free_sized<Heap>::value)
+	{
+		Heap::free(ptr, size);
+	}
+	else
+	{
+		(void)size;
+		Heap::free(ptr);
+	}
+}
+
+template<typename Heap>
+std::size_t heap_usable_size(void* ptr)
+{
+	static_assert(has_usable_size<Heap>::value,
+				  "malloc_usable_size() needs os::Heap::usableSize(). "
+				  "Set FRAMEWORK_RTOS_USABLE_SIZE to 0 to leave it undefined.");
+
+	return ptr ? Heap::usableSize(ptr) : 0;
+}
+
+template<typename Heap>
+void* heap_realloc(void* ptr, std::size_t size)
+{
+	static_assert(has_realloc<Heap>::value || has_usable_size<Heap>::value,
+				  "realloc() needs os::Heap::realloc() or os::Heap::usableSize(). "
+				  "Set FRAMEWORK_RTOS_REALLOC to 0 to leave it undefined.");
+
+	if constexpr(has_realloc<Heap>::value)
+	{
+		return Heap::realloc(ptr, size);
+	}
+	else
+	{
+		if(!ptr)
+		{
+			return Heap::alloc(size);
+		}
+
+		if(size == 0)
+		{
+			Heap::free(ptr);
+			return nullptr;
+		}
+
+		std::size_t old_size = Heap::usableSize(ptr);
+
+		if(size <= old_size)
+		{
+			return ptr;
+		}
+
+		void* new_ptr = Heap::alloc(size);
+
+		if(new_ptr)
+		{
+			std::memcpy(new_ptr, ptr, old_size);
+			Heap::free(ptr);
+		}
+
+		return new_ptr;
+	}
+}
+} // namespace
+
+#pragma mark - APIs -
 
 void malloc_addblock(void* addr, size_t size)
 {
@@ -25,3 +205,49 @@ void free(void* ptr)
 {
 	os::Heap::free(ptr);
 }
+
+void* malloc_aligned(size_t align, size_t size)
+{
+	// We want it to be a power of two since align_up operates on powers of two
+	assert((align & (align - 1)) == 0);
+
+	return heap_alloc_aligned<os::Heap>(align, size);
+}
+
+// os::Heap has no profiler, so the caller is not used
+void* malloc_for_caller(size_t size, [[maybe_unused]] void* caller)
+{
+	return os::Heap::alloc(size);
+}
+
+void* malloc_aligned_for_caller(size_t align, size_t size, [[maybe_unused]] void* caller)
+{
+	return malloc_aligned(align, size);
+}
+
+void free_sized(void* ptr, size_t size)
+{
+	heap_free_sized<os::Heap>(ptr, size);
+}
+
+void free_aligned_sized(void* ptr, size_t align, size_t size)
+{
+	assert(((reinterpret_cast<uintptr_t>(ptr)) & (align - 1)) == 0);
+	(void)align;
+
+	heap_free_sized<os::Heap>(ptr, size);
+}
+
+#if FRAMEWORK_RTOS_REALLOC
+void* realloc(void* ptr, size_t size)
+{
+	return heap_realloc<os::Heap>(ptr, size);
+}
+#endif
+
+#if FRAMEWORK_RTOS_USABLE_SIZE
+size_t malloc_usable_size(void* ptr)
+{
+	return heap_usable_size<os::Heap>(ptr);
+}
+#endif
@@ -3,13 +3,54 @@
  * License: MIT. See LICENSE file for details.
  */
 
+#include "malloc_instrumentation_internal.h"
+#include "malloc_profiler_internal.h"
 #include <linkedlist/ll.h>
+#include <assert.h>
 #include <malloc.h>
+#include <malloc_heap.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
-/// By default, the freelist is declared as static so that it cannot be accessed
-/// outside of the library. Users who wish to override this default declaration
-/// can define `FREELIST_DECL_SPECIFIERS` to use an alternative.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/// Number of thread-owned heap segments which can exist at once. When set to 0 (the default),
+/// heap_segment_create() always fails. Otherwise, free() hands memory from a segment back to
+/// its owner through a lock-free queue instead of taking the malloc lock. Requires C11 atomics.
+#ifndef FREELIST_MAX_SEGMENTS
+#define FREELIST_MAX_SEGMENTS 0
+#endif
+
+/// When set to 1, free_from_isr() pushes blocks onto a lock-free queue which is drained by the
+/// next malloc() or free(). When set to 0 (the default), free_from_isr() is the same as free().
+/// Requires C11 atomics.
+#ifndef FREELIST_ISR_FREE
+#define FREELIST_ISR_FREE 0
+#endif
+
+/// Remote free queues are used by thread-owned segments and by free_from_isr()
+#define FREELIST_REMOTE_FREES ((FREELIST_MAX_SEGMENTS > 0) || FREELIST_ISR_FREE)
+
+/// Number of size classes which can be reserved with malloc_isr_reserve(). When set to 0
+/// (the default), malloc_from_isr() always fails. Requires C11 atomics.
+#ifndef FREELIST_ISR_POOL_CLASSES
+#define FREELIST_ISR_POOL_CLASSES 0
+#endif
+
+#if FREELIST_REMOTE_FREES || (FREELIST_ISR_POOL_CLASSES > 0)
+#include <stdatomic.h>
+#endif
+
+/// By default, the default heap (which holds the free list used by malloc()) is declared
+/// as static so that it cannot be accessed outside of the library. Users who wish to override
+/// this default declaration can define `FREELIST_DECL_SPECIFIERS` to use an alternative.
 /// One option is to make it an empty definition to make it publicly visible,
 /// which may be useful for capturing state or performing metadata analysis.
 ///
@@ -18,6 +59,77 @@
 #define FREELIST_DECL_SPECIFIERS static
 #endif
 
+/// Maximum number of memory regions whose tags are tracked by the freelist.
+/// Your application can define this macro to increase the number of regions.
+/// Blocks added after the table is full are treated as MALLOC_REGION_DEFAULT memory.
+#ifndef FREELIST_MAX_REGIONS
+#define FREELIST_MAX_REGIONS 8
+#endif
+
+/// Minimum alignment of the memory returned by malloc(). Must be a power of two which is at
+/// least sizeof(void*). Hosted builds should use the alignment of max_align_t.
+#ifndef FREELIST_ALIGNMENT
+#define FREELIST_ALIGNMENT sizeof(void*)
+#endif
+
+_Static_assert(FREELIST_ALIGNMENT >= MALLOC_NATIVE_ALIGNMENT,
+			   "malloc() must provide the alignment in MALLOC_NATIVE_ALIGNMENT");
+
+/// When set to 1, allocated blocks only carry a size word in front of the payload.
+/// The free list links are stored in the payload of free blocks, which is unused while
+/// the block is free. This reduces the per-allocation overhead from three words to one
+/// (rounded up to FREELIST_ALIGNMENT).
+#ifndef FREELIST_COMPACT_HEADER
+#define FREELIST_COMPACT_HEADER 0
+#endif
+
+/// Number of recently freed blocks which are held back from the free list.
+/// When set to 0 (the default), free() coalesces the free list on every call.
+/// Otherwise, freed blocks are kept in a small buffer that malloc() checks first, and the
+/// buffer is merged into the free list in one pass when it fills up.
+#ifndef FREELIST_DEFERRED_FREE_SLOTS
+#define FREELIST_DEFERRED_FREE_SLOTS 0
+#endif
+
+/// Deferred free flush policy. When set to 1 (the default), a malloc() call which is not
+/// satisfied by the deferred free buffer merges the buffer into the free list before
+/// searching it. When set to 0, the buffer is only merged when it is full, or when the
+/// free list cannot satisfy a request on its own.
+#ifndef FREELIST_DEFERRED_FLUSH_ON_MISS
+#define FREELIST_DEFERRED_FLUSH_ON_MISS 1
+#endif
+
+/// Capacity of the dense free block index. When set to 0 (the default), malloc() walks the
+/// free list to find a block. Otherwise, the sizes and addresses of the free blocks are
+/// mirrored in parallel arrays which are scanned with SIMD compares (AVX2, SSE2, or NEON),
+/// so only the chosen block's memory is touched. If there are more free blocks than entries,
+/// the free list is walked until the number of free blocks drops to half the capacity.
+#ifndef FREELIST_SIZE_INDEX_ENTRIES
+#define FREELIST_SIZE_INDEX_ENTRIES 0
+#endif
+
+/// When set to 1, allocation APIs set errno to ENOMEM when a request can't be satisfied, as
+/// POSIX requires. The LD_PRELOAD build enables this.
+#ifndef FREELIST_SET_ERRNO
+#define FREELIST_SET_ERRNO 0
+#endif
+
+#if FREELIST_SET_ERRNO
+#include <errno.h>
+#endif
+
+/// Heap growth callback which is registered before malloc_set_morecore() is called.
+/// Hosted builds can define this (e.g., to malloc_morecore_mmap) so that the heap is
+/// created on the first call to malloc(), without any explicit initialization.
+#ifndef FREELIST_DEFAULT_MORECORE
+#define FREELIST_DEFAULT_MORECORE NULL
+#endif
+
+/// Granularity for FREELIST_DEFAULT_MORECORE requests
+#ifndef FREELIST_DEFAULT_MORECORE_GRANULARITY
+#define FREELIST_DEFAULT_MORECORE_GRANULARITY 0
+#endif
+
 #pragma mark - Definitions -
 
 /**
@@ -28,17 +140,35 @@
 #define align_up(num, align) (((num) + ((align)-1)) & ~((align)-1))
 #endif
 
+/// Round a value down to a multiple of a power of two
+#ifndef align_down
+#define align_down(num, align) ((num) & ~((align)-1))
+#endif
+
 /*
  * This is the container for our free-list.
  * Note the usage of the linked list here: the library uses offsetof
  * and container_of to manage the list and get back to the parent struct.
  */
+#if FREELIST_COMPACT_HEADER
+typedef struct
+{
+	size_t size;
+	union
+	{
+		// Only valid while the block is on the free list
+		ll_t node;
+		_Alignas(FREELIST_ALIGNMENT) char block;
+	};
+} alloc_node_t;
+#else
 typedef struct
 {
 	ll_t node;
 	size_t size;
-	char* block;
+	_Alignas(FREELIST_ALIGNMENT) char* block;
 } alloc_node_t;
+#endif
 
 /**
  * We vend a memory address to the user.  This lets us translate back and forth
@@ -46,12 +176,38 @@ typedef struct
  */
 #define ALLOC_HEADER_SZ offsetof(alloc_node_t, block)
 
+/**
+ * Block sizes are always a multiple of FREELIST_ALIGNMENT, so the low bits of the size
+ * are used to store flags for allocated blocks. Free blocks never have flags set.
+ */
+#define BLOCK_FLAGS_MASK ((size_t)FREELIST_ALIGNMENT - 1)
+
+/// The allocation was recorded by the sampling profiler
+#define BLOCK_FLAG_SAMPLED ((size_t)0x1)
+
+/**
+ * Smallest payload a block can have. In compact mode, a free block stores its list
+ * links in the payload, so the payload must be able to hold them.
+ */
+#define MIN_BLOCK_SZ align_up(sizeof(alloc_node_t) - ALLOC_HEADER_SZ, FREELIST_ALIGNMENT)
+
 // We are enforcing a minimum allocation size of 32B.
 #define MIN_ALLOC_SZ ALLOC_HEADER_SZ + 32
 
+/// Largest request which can be rounded up and given a block header without overflowing
+#define MAX_ALLOC_SZ (SIZE_MAX - FREELIST_ALIGNMENT - ALLOC_HEADER_SZ)
+
+/// Address range and tag for a block of memory added with malloc_addblock_ex()
+typedef struct
+{
+	uintptr_t start;
+	uintptr_t end;
+	unsigned tag;
+} heap_region_t;
+
 #pragma mark - Prototypes -
 
-static void defrag_free_list(void);
+static void defrag_free_list(heap_t* heap);
 
 /**
  * @brief Lock malloc (for thread safety.)
@@ -79,139 +235,1966 @@ void malloc_unlock();
 
 #pragma mark - Declarations -
 
-// This macro simply declares and initializes our linked list
-FREELIST_DECL_SPECIFIERS LIST_INIT(free_list);
+/**
+ * State of a heap instance. The default instance backs malloc() and free(), and others are
+ * created with heap_init().
+ */
+struct heap
+{
+	/// Free blocks, sorted by address
+	ll_t free_list;
+
+	/// Lock callbacks which serialize access to this heap
+	heap_lock_t lock;
 
-#pragma mark - Private Functions -
+	/// Memory regions which have been added to the heap
+	heap_region_t regions[FREELIST_MAX_REGIONS];
+
+	/// Current number of tracked heap regions
+	size_t region_cnt;
+
+	/// Region tags that malloc() searches before falling back to any region
+	unsigned region_preference[FREELIST_MAX_REGIONS];
+
+	/// Number of entries in region_preference
+	size_t region_preference_cnt;
+
+	/// Hook which is called to request more memory when malloc() fails. NULL when disabled.
+	malloc_morecore_t morecore;
+
+	/// Memory requested from morecore is rounded up to a multiple of this value
+	size_t morecore_granularity;
+
+	/// Sum of the sizes of the blocks on the free list
+	size_t free_bytes;
+
+	/// Lowest value of free_bytes after an allocation. SIZE_MAX until the first allocation.
+	size_t min_free_bytes;
+
+	/// Number of successful allocations and frees
+	size_t alloc_cnt;
+	size_t free_cnt;
 
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	/// Sizes of the free blocks in address order, saturated to 32 bits for wider SIMD compares
+	uint32_t size_index_sizes[FREELIST_SIZE_INDEX_ENTRIES] __attribute__((aligned(32)));
+
+	/// Free blocks in address order, parallel to size_index_sizes
+	alloc_node_t* size_index_blocks[FREELIST_SIZE_INDEX_ENTRIES];
+
+	/// Number of entries in the size index
+	size_t size_index_cnt;
+
+	/// Number of blocks on the free list
+	size_t free_block_cnt;
+
+	/// False if the free list outgrew the index, which then needs to be rebuilt
+	bool size_index_valid;
+#endif
+
+#if FREELIST_DEFERRED_FREE_SLOTS > 0
+	/// Recently freed blocks which have not been merged into the free list yet
+	alloc_node_t* deferred_frees[FREELIST_DEFERRED_FREE_SLOTS];
+
+	/// Number of entries in deferred_frees
+	size_t deferred_free_cnt;
+#endif
+
+#if FREELIST_REMOTE_FREES
+	/// Blocks freed by other threads or by interrupt handlers, linked through their list nodes.
+	/// Pushed without the lock, and merged into the free list by the next malloc() or free().
+	_Atomic(alloc_node_t*) remote_frees;
+#endif
+};
+
+#if FREELIST_MAX_SEGMENTS > 0
+/// A heap carved from the default heap by heap_segment_create()
+typedef struct
+{
+	/// The segment's heap, or NULL if the slot is unused. Stored after the address range,
+	/// so that free() can look up segments without the lock.
+	_Atomic(heap_t*) heap;
+	/// Address range of the memory which was allocated for the segment
+	uintptr_t start;
+	uintptr_t end;
+} heap_segment_t;
+#endif
+
+#if FREELIST_ISR_POOL_CLASSES > 0
 /**
- * When we free, we can take our node and check to see if any memory blocks
- * can be combined into larger blocks.  This will help us fight against
- * memory fragmentation in a simple way.
+ * Blocks reserved for malloc_from_isr(), which are allocated from the default heap.
+ *
+ * The pool is a bounded ring: thread context pushes at `tail` with the malloc lock held,
+ * and interrupt handlers pop at `head` with a compare-and-swap. The indices only increase,
+ * so a stale `head` can never be mistaken for a current one (the ABA problem of a linked
+ * lock-free stack).
  */
-void defrag_free_list(void)
+typedef struct
 {
-	alloc_node_t* block = NULL;
-	alloc_node_t* last_block = NULL;
-	alloc_node_t* temp = NULL;
+	/// Usable size of each block
+	size_t size;
+	/// Number of blocks which the pool holds when it is full
+	size_t capacity;
+	/// Ring of reserved blocks
+	_Atomic(void*)* slots;
+	/// Index of the next block to hand out
+	_Atomic(size_t) head;
+	/// Index of the next slot to fill
+	_Atomic(size_t) tail;
+} isr_pool_t;
+#endif
+
+static void default_heap_lock(void* context)
+{
+	(void)context;
+	malloc_lock();
+}
+
+static void default_heap_unlock(void* context)
+{
+	(void)context;
+	malloc_unlock();
+}
+
+/// The heap used by malloc() and free(), which is locked with malloc_lock()
+FREELIST_DECL_SPECIFIERS heap_t default_heap = {
+	.free_list = ll_head_INIT(default_heap.free_list),
+	.lock = {default_heap_lock, default_heap_unlock, NULL},
+	.morecore = FREELIST_DEFAULT_MORECORE,
+	.morecore_granularity = FREELIST_DEFAULT_MORECORE_GRANULARITY,
+	.min_free_bytes = SIZE_MAX,
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	.size_index_valid = true,
+#endif
+};
+
+#if FREELIST_MAX_SEGMENTS > 0
+/// Registered thread-owned segments. Modified with the default heap's lock held.
+static heap_segment_t heap_segments[FREELIST_MAX_SEGMENTS];
+#endif
+
+#if FREELIST_ISR_POOL_CLASSES > 0
+/// Reserved ISR pools, sorted by size. Modified with the default heap's lock held.
+static isr_pool_t isr_pools[FREELIST_ISR_POOL_CLASSES];
+static size_t isr_pool_cnt;
+
+/// Set by malloc_from_isr() when a pool drops below its low-water mark
+static atomic_bool isr_pools_low;
+#endif
 
-	list_for_each_entry_safe(block, temp, &free_list, node)
+/// Hooks registered with malloc_set_wait_hooks(). Only the default heap waits for memory.
+static malloc_wait_hook_t malloc_wait_hook;
+static malloc_release_hook_t malloc_release_hook;
+static malloc_tick_hook_t malloc_tick_hook;
+
+/// Number of malloc_timed() calls waiting for memory. Modified with the default heap's lock held.
+static size_t malloc_waiters;
+
+#pragma mark - Private Functions -
+
+static inline void lock_heap(heap_t* heap)
+{
+	if(heap->lock.lock)
 	{
-		if(last_block)
-		{
-			if((((uintptr_t)&last_block->block) + last_block->size) == (uintptr_t)block)
-			{
-				last_block->size += ALLOC_HEADER_SZ + block->size;
-				list_del(&block->node);
-				continue;
-			}
-		}
-		last_block = block;
+		heap->lock.lock(heap->lock.context);
 	}
 }
 
-#pragma mark - APIs -
+static inline void unlock_heap(heap_t* heap)
+{
+	if(heap->lock.unlock)
+	{
+		heap->lock.unlock(heap->lock.context);
+	}
+}
 
-__attribute__((weak)) void malloc_init(void)
+/**
+ * Record a latency sample. The instrumentation and profiler state is protected by
+ * malloc_lock(), so only the default heap is instrumented.
+ */
+static inline void heap_record(const heap_t* heap, malloc_op_t op, malloc_timestamp_t start)
 {
-	// Unused here, override to specify your own init function
-	// Which includes malloc_addblock calls
+	if(heap == &default_heap)
+	{
+		malloc_instrumentation_record(op, start);
+	}
 }
 
-__attribute__((weak)) void malloc_lock()
+/// Address of the first byte past the end of a block
+static inline uintptr_t block_end(const alloc_node_t* block)
 {
-	// Intentional no-op
+	return (uintptr_t)&block->block + block->size;
 }
 
-__attribute__((weak)) void malloc_unlock()
+/**
+ * First payload address in a free block which satisfies `align`.
+ * If the payload needs to move, the memory skipped in front must be able to stay on the free list.
+ */
+static uintptr_t aligned_payload(const alloc_node_t* block, size_t align)
 {
-	// Intentional no-op
+	uintptr_t payload = (uintptr_t)&block->block;
+
+	if((payload & (align - 1)) == 0)
+	{
+		return payload;
+	}
+
+	return align_up(payload + MIN_ALLOC_SZ, align);
 }
 
-void* malloc(size_t size)
+/// Look up the tag of the region which contains `block`
+static unsigned block_region_tag(heap_t* heap, const alloc_node_t* block)
 {
-	void* ptr = NULL;
-	alloc_node_t* found_block = NULL;
+	for(size_t i = 0; i < heap->region_cnt; i++)
+	{
+		if(((uintptr_t)block >= heap->regions[i].start) &&
+		   ((uintptr_t)block < heap->regions[i].end))
+		{
+			return heap->regions[i].tag;
+		}
+	}
+
+	// Untracked memory belongs to the default region
+	return MALLOC_REGION_DEFAULT;
+}
+
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+static inline uint32_t size_index_saturate(size_t size)
+{
+	return (size > UINT32_MAX) ? UINT32_MAX : (uint32_t)size;
+}
+
+/// Position of the first index entry at or after `block`'s address
+static size_t size_index_position(heap_t* heap, const alloc_node_t* block)
+{
+	size_t low = 0;
+	size_t high = heap->size_index_cnt;
 
-	if(size > 0)
+	while(low < high)
 	{
-		// Align the pointer
-		size = align_up(size, sizeof(void*));
+		size_t mid = low + ((high - low) / 2);
 
-		malloc_lock();
+		if(heap->size_index_blocks[mid] < block)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
 
-		// try to find a big enough block to alloc
-		list_for_each_entry(found_block, &free_list, node)
+	return low;
+}
+
+/**
+ * Find the first index entry at or after `start` whose size is at least `size`.
+ * Returns the number of entries if there is none.
+ */
+static size_t size_index_scan(heap_t* heap, size_t size, size_t start)
+{
+	// Sizes are non-zero, so ">= target" is the same as "> target - 1"
+	uint32_t target = size_index_saturate(size);
+	size_t i = start;
+
+#if defined(__AVX2__)
+	// There is no unsigned compare, so flip the sign bits and use a signed one
+	const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+	const __m256i limit = _mm256_xor_si256(_mm256_set1_epi32((int)(target - 1)), bias);
+
+	for(; (i + 8) <= heap->size_index_cnt; i += 8)
+	{
+		__m256i sizes = _mm256_loadu_si256((const __m256i*)(const void*)&heap->size_index_sizes[i]);
+		__m256i found = _mm256_cmpgt_epi32(_mm256_xor_si256(sizes, bias), limit);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(found));
+
+		if(mask)
 		{
-			if(found_block->size >= size)
-			{
-				ptr = &found_block->block;
-				break;
-			}
+			return i + (size_t)__builtin_ctz((unsigned)mask);
 		}
+	}
+#elif defined(__SSE2__)
+	// There is no unsigned compare, so flip the sign bits and use a signed one
+	const __m128i bias = _mm_set1_epi32(INT32_MIN);
+	const __m128i limit = _mm_xor_si128(_mm_set1_epi32((int)(target - 1)), bias);
 
-		// we found something
-		if(ptr)
+	for(; (i + 4) <= heap->size_index_cnt; i += 4)
+	{
+		__m128i sizes = _mm_loadu_si128((const __m128i*)(const void*)&heap->size_index_sizes[i]);
+		__m128i found = _mm_cmpgt_epi32(_mm_xor_si128(sizes, bias), limit);
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(found));
+
+		if(mask)
 		{
-			// Can we split the block?
-			if((found_block->size - size) >= MIN_ALLOC_SZ)
-			{
-				alloc_node_t* new_block = (alloc_node_t*)((uintptr_t)(&found_block->block) + size);
-				new_block->size = found_block->size - size - ALLOC_HEADER_SZ;
-				found_block->size = size;
-				list_insert(&new_block->node, &found_block->node, found_block->node.next);
-			}
+			return i + (size_t)__builtin_ctz((unsigned)mask);
+		}
+	}
+#elif defined(__ARM_NEON)
+	const uint32x4_t limit = vdupq_n_u32(target);
+
+	for(; (i + 4) <= heap->size_index_cnt; i += 4)
+	{
+		uint32x4_t found = vcgeq_u32(vld1q_u32(&heap->size_index_sizes[i]), limit);
+		// Narrow each lane to 16 bits so the result fits in a scalar register
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(found)), 0);
 
-			list_del(&found_block->node);
+		if(mask)
+		{
+			return i + ((size_t)__builtin_ctzll(mask) / 16);
 		}
+	}
+#endif
 
-		malloc_unlock();
+	for(; i < heap->size_index_cnt; i++)
+	{
+		if(heap->size_index_sizes[i] >= target)
+		{
+			break;
+		}
+	}
 
-	} // else NULL
+	return i;
+}
 
-	return ptr;
+/// Rebuild the index from the free list if it was invalidated and the list fits again
+static bool size_index_ready(heap_t* heap)
+{
+	if(!heap->size_index_valid && (heap->free_block_cnt <= (FREELIST_SIZE_INDEX_ENTRIES / 2)))
+	{
+		alloc_node_t* block = NULL;
+
+		heap->size_index_cnt = 0;
+
+		list_for_each_entry(block, &heap->free_list, node)
+		{
+			heap->size_index_sizes[heap->size_index_cnt] = size_index_saturate(block->size);
+			heap->size_index_blocks[heap->size_index_cnt] = block;
+			heap->size_index_cnt++;
+		}
+
+		heap->size_index_valid = true;
+	}
+
+	return heap->size_index_valid;
 }
+#endif
 
-void free(void* ptr)
+/// Insert a block into the free list between `prev` and `next`, which must keep it address-sorted
+static void free_list_insert(heap_t* heap, alloc_node_t* block, ll_t* prev, ll_t* next)
 {
-	// Don't free a NULL pointer..
-	if(ptr)
+	list_insert(&block->node, prev, next);
+	heap->free_bytes += block->size;
+
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	heap->free_block_cnt++;
+
+	if(heap->size_index_valid && (heap->size_index_cnt == FREELIST_SIZE_INDEX_ENTRIES))
 	{
-		// we take the pointer and use container_of to get the corresponding alloc block
-		alloc_node_t* current_block = container_of(ptr, alloc_node_t, block);
-		alloc_node_t* free_block = NULL;
+		heap->size_index_valid = false;
+	}
+
+	if(heap->size_index_valid)
+	{
+		size_t pos = size_index_position(heap, block);
+
+		memmove(&heap->size_index_sizes[pos + 1], &heap->size_index_sizes[pos],
+				(heap->size_index_cnt - pos) * sizeof(heap->size_index_sizes[0]));
+		memmove(&heap->size_index_blocks[pos + 1], &heap->size_index_blocks[pos],
+				(heap->size_index_cnt - pos) * sizeof(heap->size_index_blocks[0]));
+		heap->size_index_sizes[pos] = size_index_saturate(block->size);
+		heap->size_index_blocks[pos] = block;
+		heap->size_index_cnt++;
+	}
+#endif
+}
+
+/// Remove a block from the free list
+static void free_list_del(heap_t* heap, alloc_node_t* block)
+{
+	list_del(&block->node);
+	heap->free_bytes -= block->size;
+
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	heap->free_block_cnt--;
+
+	if(heap->size_index_valid)
+	{
+		size_t pos = size_index_position(heap, block);
+		assert((pos < heap->size_index_cnt) && (heap->size_index_blocks[pos] == block));
+
+		memmove(&heap->size_index_sizes[pos], &heap->size_index_sizes[pos + 1],
+				(heap->size_index_cnt - pos - 1) * sizeof(heap->size_index_sizes[0]));
+		memmove(&heap->size_index_blocks[pos], &heap->size_index_blocks[pos + 1],
+				(heap->size_index_cnt - pos - 1) * sizeof(heap->size_index_blocks[0]));
+		heap->size_index_cnt--;
+	}
+#endif
+}
+
+/// Change the size of a block which is on the free list
+static void free_list_resize(heap_t* heap, alloc_node_t* block, size_t size)
+{
+	heap->free_bytes = heap->free_bytes - block->size + size;
+	block->size = size;
+
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	if(heap->size_index_valid)
+	{
+		size_t pos = size_index_position(heap, block);
+		assert((pos < heap->size_index_cnt) && (heap->size_index_blocks[pos] == block));
+
+		heap->size_index_sizes[pos] = size_index_saturate(size);
+	}
+#endif
+}
+
+/// Check whether a free block can hold `size` bytes with the requested alignment and tag
+static inline bool block_fits(heap_t* heap, const alloc_node_t* block, size_t size,
+							  size_t align, bool match_tag, unsigned tag)
+{
+	return (block->size >= size) && ((aligned_payload(block, align) + size) <= block_end(block)) &&
+		   (!match_tag || (block_region_tag(heap, block) == tag));
+}
 
-		malloc_lock();
+/**
+ * Find the first free block which can hold `size` bytes with the requested alignment.
+ * If `match_tag` is true, only blocks in regions tagged with `tag` are considered.
+ */
+static alloc_node_t* find_free_block(heap_t* heap, size_t size, size_t align, bool match_tag,
+									 unsigned tag)
+{
+	alloc_node_t* block = NULL;
 
-		// Let's put it back in the proper spot
-		list_for_each_entry(free_block, &free_list, node)
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	if(size_index_ready(heap))
+	{
+		for(size_t i = size_index_scan(heap, size, 0); i < heap->size_index_cnt;
+			i = size_index_scan(heap, size, i + 1))
 		{
-			if(free_block > current_block)
+			if(block_fits(heap, heap->size_index_blocks[i], size, align, match_tag, tag))
 			{
-				list_insert(&current_block->node, free_block->node.prev, &free_block->node);
-				goto blockadded;
+				return heap->size_index_blocks[i];
 			}
 		}
-		list_add_tail(&current_block->node, &free_list);
 
-	blockadded:
-		// Let's see if we can combine any memory
-		defrag_free_list();
+		return NULL;
+	}
+#endif
 
-		malloc_unlock();
+	list_for_each_entry(block, &heap->free_list, node)
+	{
+		if(block_fits(heap, block, size, align, match_tag, tag))
+		{
+			return block;
+		}
 	}
+
+	return NULL;
 }
 
-void malloc_addblock(void* addr, size_t size)
+/// Insert a block into the free list, keeping the list sorted by address
+static void insert_free_block(heap_t* heap, alloc_node_t* current_block)
 {
-	// let's align the start address of our block to the next pointer aligned number
-	alloc_node_t* new_memory_block = (void*)align_up((uintptr_t)addr, sizeof(void*));
+	alloc_node_t* free_block = NULL;
 
-	// calculate actual size - remove our alignment and our header space from the availability
-	new_memory_block->size = (uintptr_t)addr + size - (uintptr_t)new_memory_block - ALLOC_HEADER_SZ;
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	// The index finds the insertion point without walking the list
+	if(size_index_ready(heap))
+	{
+		size_t pos = size_index_position(heap, current_block);
+		ll_t* next =
+			(pos < heap->size_index_cnt) ? &heap->size_index_blocks[pos]->node : &heap->free_list;
 
-	// and now our giant block of memory is added to the list!
-	malloc_lock();
-	list_add(&new_memory_block->node, &free_list);
-	malloc_unlock();
+		free_list_insert(heap, current_block, next->prev, next);
+		return;
+	}
+#endif
+
+	// Let's put it back in the proper spot
+	list_for_each_entry(free_block, &heap->free_list, node)
+	{
+		if(free_block > current_block)
+		{
+			free_list_insert(heap, current_block, free_block->node.prev, &free_block->node);
+			return;
+		}
+	}
+	free_list_insert(heap, current_block, heap->free_list.prev, &heap->free_list);
+}
+
+/**
+ * Address of the first byte covered by a free block.
+ * A block at the start of a region also owns the alignment padding in front of it.
+ */
+static uintptr_t free_block_start(heap_t* heap, const alloc_node_t* block)
+{
+	for(size_t i = 0; i < heap->region_cnt; i++)
+	{
+		if((uintptr_t)block == align_up(heap->regions[i].start, FREELIST_ALIGNMENT))
+		{
+			return heap->regions[i].start;
+		}
+	}
+
+	return (uintptr_t)block;
+}
+
+/**
+ * Address of the first byte past the memory covered by a free block.
+ * A block at the end of a region also owns the unaligned bytes behind it.
+ */
+static uintptr_t free_block_end(heap_t* heap, const alloc_node_t* block)
+{
+	uintptr_t end = block_end(block);
+
+	for(size_t i = 0; i < heap->region_cnt; i++)
+	{
+		if((heap->regions[i].end >= end) && ((heap->regions[i].end - end) < FREELIST_ALIGNMENT))
+		{
+			return heap->regions[i].end;
+		}
+	}
+
+	return end;
+}
+
+/// Drop an entry from the region table
+static void remove_region(heap_t* heap, size_t index)
+{
+	for(size_t i = index + 1; i < heap->region_cnt; i++)
+	{
+		heap->regions[i - 1] = heap->regions[i];
+	}
+
+	heap->region_cnt--;
+}
+
+/// Update the region table after [start, end) has been removed from the heap
+static void release_region_range(heap_t* heap, uintptr_t start, uintptr_t end)
+{
+	for(size_t i = 0; i < heap->region_cnt; i++)
+	{
+		heap_region_t* region = &heap->regions[i];
+
+		if((end <= region->start) || (start >= region->end))
+		{
+			continue;
+		}
+
+		if((start <= region->start) && (end >= region->end))
+		{
+			remove_region(heap, i);
+			i--;
+		}
+		else if(start <= region->start)
+		{
+			region->start = end;
+		}
+		else if(end >= region->end)
+		{
+			region->end = start;
+		}
+		else if(heap->region_cnt < FREELIST_MAX_REGIONS)
+		{
+			// Split the region around the hole.
+			// If the table is full, the region keeps covering the hole, which is harmless
+			// unless the hole is added back with a different tag.
+			heap->regions[heap->region_cnt].start = end;
+			heap->regions[heap->region_cnt].end = region->end;
+			heap->regions[heap->region_cnt].tag = region->tag;
+			heap->region_cnt++;
+			region->end = start;
+		}
+	}
+}
+
+/**
+ * Add a block of memory to the heap. The caller must hold the malloc lock.
+ *
+ * If the memory directly follows a region with the same tag, that region is extended
+ * and the new memory is merged with the free block at the end of the region.
+ */
+static void add_block(heap_t* heap, void* addr, size_t size, unsigned tag)
+{
+	bool extended = false;
+
+	// let's align the start address of our block to the next aligned number
+	alloc_node_t* new_memory_block = (void*)align_up((uintptr_t)addr, FREELIST_ALIGNMENT);
+
+	// calculate actual size - remove our alignment and our header space from the availability
+	new_memory_block->size = align_down(
+		(uintptr_t)addr + size - (uintptr_t)new_memory_block - ALLOC_HEADER_SZ, FREELIST_ALIGNMENT);
+
+	for(size_t i = 0; i < heap->region_cnt; i++)
+	{
+		if((heap->regions[i].end == (uintptr_t)addr) && (heap->regions[i].tag == tag))
+		{
+			heap->regions[i].end = (uintptr_t)addr + size;
+			extended = true;
+			break;
+		}
+	}
+
+	if(!extended)
+	{
+		assert(((heap->region_cnt < FREELIST_MAX_REGIONS) || (tag == MALLOC_REGION_DEFAULT)) &&
+			   "Too many heap regions!");
+
+		if(heap->region_cnt < FREELIST_MAX_REGIONS)
+		{
+			heap->regions[heap->region_cnt].start = (uintptr_t)addr;
+			heap->regions[heap->region_cnt].end = (uintptr_t)addr + size;
+			heap->regions[heap->region_cnt].tag = tag;
+			heap->region_cnt++;
+		}
+	}
+
+	// and now our giant block of memory is added to the list!
+	insert_free_block(heap, new_memory_block);
+
+	if(extended)
+	{
+		defrag_free_list(heap);
+	}
+}
+
+#if FREELIST_MAX_SEGMENTS > 0
+/// Find the segment which contains `ptr`. Safe to call without holding any lock.
+static heap_t* segment_of(const void* ptr)
+{
+	for(size_t i = 0; i < FREELIST_MAX_SEGMENTS; i++)
+	{
+		heap_t* heap = atomic_load_explicit(&heap_segments[i].heap, memory_order_acquire);
+
+		if(heap && ((uintptr_t)ptr >= heap_segments[i].start) &&
+		   ((uintptr_t)ptr < heap_segments[i].end))
+		{
+			return heap;
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+#if FREELIST_REMOTE_FREES
+/// Push a block onto a heap's remote free queue. Safe to call from any thread without the lock.
+static void push_remote_free(heap_t* heap, alloc_node_t* block)
+{
+	alloc_node_t* head = atomic_load_explicit(&heap->remote_frees, memory_order_relaxed);
+
+	do
+	{
+		block->node.next = head ? &head->node : NULL;
+	} while(!atomic_compare_exchange_weak_explicit(&heap->remote_frees, &head, block,
+												   memory_order_release, memory_order_relaxed));
+}
+#endif
+
+/**
+ * Merge blocks freed by other threads or interrupt handlers into the free list, followed by
+ * a single defragmentation pass. The caller must hold the heap's lock.
+ */
+static void drain_remote_frees(heap_t* heap)
+{
+#if FREELIST_REMOTE_FREES
+	// Avoid the atomic write when the queue is empty, which is the common case
+	if(!atomic_load_explicit(&heap->remote_frees, memory_order_relaxed))
+	{
+		return;
+	}
+
+	alloc_node_t* block = atomic_exchange_explicit(&heap->remote_frees, NULL, memory_order_acquire);
+
+	while(block)
+	{
+		alloc_node_t* next = block->node.next ? container_of(block->node.next, alloc_node_t, node)
+											  : NULL;
+
+		// The profiler could not be updated when the block was queued
+		if(block->size & BLOCK_FLAG_SAMPLED)
+		{
+			malloc_profiler_release(&block->block);
+		}
+
+		block->size &= ~BLOCK_FLAGS_MASK;
+		insert_free_block(heap, block);
+		heap->free_cnt++;
+		block = next;
+	}
+
+	defrag_free_list(heap);
+#else
+	(void)heap;
+#endif
+}
+
+/**
+ * Merge the deferred free buffer into the free list. The caller must hold the malloc lock.
+ * The buffer is sorted by address so that it is merged into the list in a single pass,
+ * followed by a single defragmentation pass.
+ *
+ * @returns true if any blocks were merged.
+ */
+static bool flush_deferred_frees(heap_t* heap)
+{
+#if FREELIST_DEFERRED_FREE_SLOTS > 0
+	if(heap->deferred_free_cnt == 0)
+	{
+		return false;
+	}
+
+	for(size_t i = 1; i < heap->deferred_free_cnt; i++)
+	{
+		alloc_node_t* block = heap->deferred_frees[i];
+		size_t j = i;
+
+		for(; (j > 0) && (heap->deferred_frees[j - 1] > block); j--)
+		{
+			heap->deferred_frees[j] = heap->deferred_frees[j - 1];
+		}
+
+		heap->deferred_frees[j] = block;
+	}
+
+	ll_t* next = heap->free_list.next;
+
+	for(size_t i = 0; i < heap->deferred_free_cnt; i++)
+	{
+		while((next != &heap->free_list) &&
+			  (container_of(next, alloc_node_t, node) < heap->deferred_frees[i]))
+		{
+			next = next->next;
+		}
+
+		free_list_insert(heap, heap->deferred_frees[i], next->prev, next);
+	}
+
+	heap->deferred_free_cnt = 0;
+	defrag_free_list(heap);
+
+	return true;
+#else
+	(void)heap;
+	return false;
+#endif
+}
+
+/**
+ * Find a free block, merging the deferred free buffer into the free list if needed.
+ * The buffer is merged before moving on, so that a less preferred region is not used
+ * while the memory is only held back in the buffer.
+ */
+static alloc_node_t* find_free_block_or_flush(heap_t* heap, size_t size, size_t align,
+											  bool match_tag, unsigned tag)
+{
+	alloc_node_t* block = find_free_block(heap, size, align, match_tag, tag);
+
+	if(!block && flush_deferred_frees(heap))
+	{
+		block = find_free_block(heap, size, align, match_tag, tag);
+	}
+
+	return block;
+}
+
+/**
+ * Search the free list for a block, in the order documented for do_malloc(heap).
+ */
+static alloc_node_t* search_free_list(heap_t* heap, size_t size, size_t align, bool use_tag,
+									  unsigned tag)
+{
+	alloc_node_t* found_block = NULL;
+
+	if(use_tag)
+	{
+		found_block = find_free_block_or_flush(heap, size, align, true, tag);
+	}
+
+	for(size_t i = 0; (i < heap->region_preference_cnt) && !found_block; i++)
+	{
+		found_block = find_free_block_or_flush(heap, size, align, true, heap->region_preference[i]);
+	}
+
+	if(!found_block)
+	{
+		found_block = find_free_block_or_flush(heap, size, align, false, 0);
+	}
+
+	return found_block;
+}
+
+/**
+ * Take a recently freed block which is a close fit for the request: it must be large enough,
+ * and small enough that it would not be split. The most recently freed block is preferred.
+ * The caller must hold the malloc lock.
+ */
+static alloc_node_t* take_deferred_free(heap_t* heap, size_t size, size_t align, bool use_tag,
+										unsigned tag)
+{
+#if FREELIST_DEFERRED_FREE_SLOTS > 0
+	// Only the first choice of region is accepted, so that the search order is preserved
+	bool match_tag = use_tag || (heap->region_preference_cnt > 0);
+	unsigned match = use_tag ? tag : heap->region_preference[0];
+
+	for(size_t i = heap->deferred_free_cnt; i > 0; i--)
+	{
+		alloc_node_t* block = heap->deferred_frees[i - 1];
+
+		if((block->size >= size) && ((block->size - size) < MIN_ALLOC_SZ) &&
+		   (((uintptr_t)&block->block & (align - 1)) == 0) &&
+		   (!match_tag || (block_region_tag(heap, block) == match)))
+		{
+			heap->deferred_frees[i - 1] = heap->deferred_frees[--heap->deferred_free_cnt];
+			return block;
+		}
+	}
+#else
+	(void)heap;
+	(void)size;
+	(void)align;
+	(void)use_tag;
+	(void)tag;
+#endif
+
+	return NULL;
+}
+
+/**
+ * Hold a freed block in the deferred free buffer. The caller must hold the malloc lock.
+ *
+ * @returns false if deferred frees are disabled, in which case the caller must put the block
+ *	back on the free list.
+ */
+static bool defer_free(heap_t* heap, alloc_node_t* block)
+{
+#if FREELIST_DEFERRED_FREE_SLOTS > 0
+	// The newest block is kept in the buffer, since it is the most likely to be reused
+	if(heap->deferred_free_cnt == FREELIST_DEFERRED_FREE_SLOTS)
+	{
+		flush_deferred_frees(heap);
+	}
+
+	heap->deferred_frees[heap->deferred_free_cnt++] = block;
+
+	return true;
+#else
+	(void)heap;
+	(void)block;
+	return false;
+#endif
+}
+
+/**
+ * Ask the morecore hook for enough memory to satisfy a `size` byte allocation with the
+ * requested alignment. The caller must hold the malloc lock.
+ *
+ * @returns true if memory was added to the heap.
+ */
+static bool grow_heap(heap_t* heap, size_t size, size_t align)
+{
+	// Leave room for the block header, for aligning the start of the new memory, and for the
+	// memory which is split off in front of an aligned payload
+	size_t overhead = ALLOC_HEADER_SZ + FREELIST_ALIGNMENT +
+					  ((align > FREELIST_ALIGNMENT) ? (align + MIN_ALLOC_SZ) : 0);
+
+	if(!heap->morecore || (size > (SIZE_MAX - overhead)))
+	{
+		return false;
+	}
+
+	size_t request = size + overhead;
+
+	if(heap->morecore_granularity)
+	{
+		if(request > (SIZE_MAX - (heap->morecore_granularity - 1)))
+		{
+			return false;
+		}
+
+		request = align_up(request, heap->morecore_granularity);
+	}
+
+	void* addr = heap->morecore(request);
+
+	if(addr)
+	{
+		add_block(heap, addr, request, MALLOC_REGION_DEFAULT);
+	}
+
+	return addr != NULL;
+}
+
+/**
+ * Remove `size` bytes with the requested alignment from a free block.
+ * Unused memory in front of and behind the allocation stays on the free list.
+ *
+ * @returns The allocated block, which is no longer on the free list.
+ */
+static alloc_node_t* carve_free_block(heap_t* heap, alloc_node_t* found_block, size_t size,
+									  size_t align)
+{
+	uintptr_t payload = aligned_payload(found_block, align);
+
+	// Split off the memory in front of an aligned payload
+	if(payload != (uintptr_t)&found_block->block)
+	{
+		alloc_node_t* aligned_block = (alloc_node_t*)(payload - ALLOC_HEADER_SZ);
+		aligned_block->size = block_end(found_block) - payload;
+		free_list_resize(heap, found_block,
+						 (uintptr_t)aligned_block - (uintptr_t)&found_block->block);
+		free_list_insert(heap, aligned_block, &found_block->node, found_block->node.next);
+		found_block = aligned_block;
+	}
+
+	// Can we split the block?
+	if((found_block->size - size) >= MIN_ALLOC_SZ)
+	{
+		alloc_node_t* new_block = (alloc_node_t*)((uintptr_t)(&found_block->block) + size);
+		new_block->size = found_block->size - size - ALLOC_HEADER_SZ;
+		free_list_resize(heap, found_block, size);
+		free_list_insert(heap, new_block, &found_block->node, found_block->node.next);
+	}
+
+	free_list_del(heap, found_block);
+
+	return found_block;
+}
+
+/// Round a requested size up to the size of the block which holds it
+static inline size_t block_alloc_size(size_t size)
+{
+	// Align the size so that the next block stays aligned
+	size = align_up(size, FREELIST_ALIGNMENT);
+
+	return (size < MIN_BLOCK_SZ) ? MIN_BLOCK_SZ : size;
+}
+
+/**
+ * Take a block of `size` bytes aligned to `align` out of the heap. `size` must be rounded with
+ * block_alloc_size(). The caller must hold the heap's lock.
+ */
+static alloc_node_t* alloc_block(heap_t* heap, size_t size, size_t align, bool use_tag,
+								 unsigned tag)
+{
+	// Recently freed blocks are reused as-is, without touching the free list
+	alloc_node_t* found_block = take_deferred_free(heap, size, align, use_tag, tag);
+
+	if(!found_block)
+	{
+		if(FREELIST_DEFERRED_FLUSH_ON_MISS)
+		{
+			flush_deferred_frees(heap);
+		}
+
+		// try to find a big enough block to alloc
+		found_block = search_free_list(heap, size, align, use_tag, tag);
+
+		if(!found_block &&
+		   grow_heap(heap, size, align))
+		{
+			found_block = find_free_block(heap, size, align, false, 0);
+		}
+
+		if(found_block)
+		{
+			found_block = carve_free_block(heap, found_block, size, align);
+		}
+	}
+
+	if(found_block)
+	{
+		heap->alloc_cnt++;
+
+		if(heap->free_bytes < heap->min_free_bytes)
+		{
+			heap->min_free_bytes = heap->free_bytes;
+		}
+	}
+
+	return found_block;
+}
+
+#if FREELIST_ISR_POOL_CLASSES > 0
+/// Pop a block from an ISR pool. Safe to call from interrupt context without the lock.
+static void* isr_pool_pop(isr_pool_t* pool)
+{
+	void* ptr = NULL;
+	size_t tail = 0;
+	size_t head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+
+	do
+	{
+		tail = atomic_load_explicit(&pool->tail, memory_order_acquire);
+
+		if(head == tail)
+		{
+			return NULL;
+		}
+
+		ptr = atomic_load_explicit(&pool->slots[head % pool->capacity], memory_order_relaxed);
+		// The release pairs with the refill, so the slot is read before it can be reused
+	} while(!atomic_compare_exchange_weak_explicit(&pool->head, &head, head + 1,
+												   memory_order_release, memory_order_relaxed));
+
+	// Refill once fewer than half of the blocks remain. Comparing twice the remaining count
+	// also works for a pool which holds a single block.
+	size_t remaining = tail - (head + 1);
+
+	if((remaining * 2) < pool->capacity)
+	{
+		atomic_store_explicit(&isr_pools_low, true, memory_order_relaxed);
+	}
+
+	return ptr;
+}
+
+/// Fill an ISR pool from the heap. The caller must hold the default heap's lock.
+static bool isr_pool_fill(isr_pool_t* pool)
+{
+	size_t tail = atomic_load_explicit(&pool->tail, memory_order_relaxed);
+
+	while((tail - atomic_load_explicit(&pool->head, memory_order_acquire)) < pool->capacity)
+	{
+		alloc_node_t* block = alloc_block(&default_heap, pool->size, FREELIST_ALIGNMENT, false, 0);
+
+		if(!block)
+		{
+			return false;
+		}
+
+		atomic_store_explicit(&pool->slots[tail % pool->capacity], &block->block,
+							  memory_order_relaxed);
+		tail++;
+		atomic_store_explicit(&pool->tail, tail, memory_order_release);
+	}
+
+	return true;
+}
+#endif
+
+/**
+ * Refill the ISR pools if malloc_from_isr() has drained any of them below the low-water mark.
+ * The caller must hold the heap's lock.
+ */
+static void refill_isr_pools(heap_t* heap)
+{
+#if FREELIST_ISR_POOL_CLASSES > 0
+	if((heap == &default_heap) &&
+	   atomic_exchange_explicit(&isr_pools_low, false, memory_order_relaxed))
+	{
+		for(size_t i = 0; i < isr_pool_cnt; i++)
+		{
+			(void)isr_pool_fill(&isr_pools[i]);
+		}
+	}
+#else
+	(void)heap;
+#endif
+}
+
+/**
+ * Allocate `size` bytes aligned to `align`.
+ * If `use_tag` is true, the region tagged with `tag` is tried first.
+ * The search continues through the region preference order, and then any region.
+ * `caller` is the return address of the public API, which is used by the profiler.
+ * If `lock` is false, the caller is responsible for serializing access to the heap.
+ */
+static void* do_malloc(heap_t* heap, size_t size, size_t align, bool use_tag, unsigned tag,
+					   void* caller, bool lock)
+{
+	void* ptr = NULL;
+	alloc_node_t* found_block = NULL;
+
+	// Larger requests would wrap around when they are rounded up to a block size
+	if((size > 0) && (size <= MAX_ALLOC_SZ))
+	{
+		malloc_timestamp_t op_start = malloc_instrumentation_timestamp();
+
+		size = block_alloc_size(size);
+
+		if(lock)
+		{
+			malloc_timestamp_t lock_start = malloc_instrumentation_timestamp();
+			lock_heap(heap);
+			heap_record(heap, MALLOC_OP_LOCK_WAIT, lock_start);
+		}
+
+		// Memory freed by other threads is merged in one batch
+		drain_remote_frees(heap);
+
+		found_block = alloc_block(heap, size, align, use_tag, tag);
+
+		// we found something
+		if(found_block)
+		{
+			ptr = &found_block->block;
+
+			if((heap == &default_heap) && malloc_profiler_should_sample(size) &&
+			   malloc_profiler_record(ptr, size, caller))
+			{
+				found_block->size |= BLOCK_FLAG_SAMPLED;
+			}
+		}
+
+		heap_record(heap, MALLOC_OP_MALLOC, op_start);
+
+		refill_isr_pools(heap);
+
+		if(lock)
+		{
+			unlock_heap(heap);
+		}
+
+	} // else NULL
+
+#if FREELIST_SET_ERRNO
+	if(!ptr && (size > 0))
+	{
+		errno = ENOMEM;
+	}
+#endif
+
+	return ptr;
+}
+
+/**
+ * Release an allocation. `size` is the size which was requested for it, or 0 if it is unknown.
+ * If `lock` is false, the caller is responsible for serializing access to the heap.
+ */
+static void do_free(heap_t* heap, void* ptr, size_t size, bool lock)
+{
+	// Don't free a NULL pointer..
+	if(ptr)
+	{
+		malloc_timestamp_t op_start = malloc_instrumentation_timestamp();
+
+		// we take the pointer and use container_of to get the corresponding alloc block
+		alloc_node_t* current_block = container_of(ptr, alloc_node_t, block);
+
+		// A mismatched size means the caller is releasing the wrong allocation
+		assert(size <= (current_block->size & ~BLOCK_FLAGS_MASK));
+		(void)size;
+
+#if FREELIST_MAX_SEGMENTS > 0
+		// Memory from a thread-owned segment is handed back to its owner without a lock
+		heap_t* segment = (heap == &default_heap) ? segment_of(ptr) : NULL;
+
+		if(segment)
+		{
+			push_remote_free(segment, current_block);
+			return;
+		}
+#endif
+
+		if(lock)
+		{
+			malloc_timestamp_t lock_start = malloc_instrumentation_timestamp();
+			lock_heap(heap);
+			heap_record(heap, MALLOC_OP_LOCK_WAIT, lock_start);
+		}
+
+		drain_remote_frees(heap);
+
+		if(current_block->size & BLOCK_FLAG_SAMPLED)
+		{
+			malloc_profiler_release(ptr);
+		}
+
+		current_block->size &= ~BLOCK_FLAGS_MASK;
+		heap->free_cnt++;
+
+		if(!defer_free(heap, current_block))
+		{
+			insert_free_block(heap, current_block);
+
+			// Let's see if we can combine any memory
+			defrag_free_list(heap);
+		}
+
+		heap_record(heap, MALLOC_OP_FREE, op_start);
+
+		refill_isr_pools(heap);
+
+		bool signal = (heap == &default_heap) && (malloc_waiters > 0);
+
+		if(lock)
+		{
+			unlock_heap(heap);
+		}
+
+		if(signal && malloc_release_hook)
+		{
+			malloc_release_hook();
+		}
+	}
+}
+
+/**
+ * When we free, we can take our node and check to see if any memory blocks
+ * can be combined into larger blocks.  This will help us fight against
+ * memory fragmentation in a simple way.
+ */
+void defrag_free_list(heap_t* heap)
+{
+	alloc_node_t* block = NULL;
+	alloc_node_t* last_block = NULL;
+	alloc_node_t* temp = NULL;
+
+	list_for_each_entry_safe(block, temp, &heap->free_list, node)
+	{
+		if(last_block)
+		{
+			// Adjacent regions with different tags must stay separate
+			if(((((uintptr_t)&last_block->block) + last_block->size) == (uintptr_t)block) &&
+			   (block_region_tag(heap, last_block) == block_region_tag(heap, block)))
+			{
+				free_list_resize(heap, last_block,
+								 last_block->size + ALLOC_HEADER_SZ + block->size);
+				free_list_del(heap, block);
+				continue;
+			}
+		}
+		last_block = block;
+	}
+}
+
+#pragma mark - APIs -
+
+__attribute__((weak)) void malloc_init(void)
+{
+	// Unused here, override to specify your own init function
+	// Which includes malloc_addblock calls
+}
+
+__attribute__((weak)) void malloc_lock()
+{
+	// Intentional no-op
+}
+
+__attribute__((weak)) void malloc_unlock()
+{
+	// Intentional no-op
+}
+
+void* malloc(size_t size)
+{
+	return do_malloc(&default_heap, size, FREELIST_ALIGNMENT, false, 0,
+					 __builtin_return_address(0), true);
+}
+
+void* malloc_region(unsigned tag, size_t size)
+{
+	return do_malloc(&default_heap, size, FREELIST_ALIGNMENT, true, tag,
+					 __builtin_return_address(0), true);
+}
+
+void* malloc_aligned(size_t align, size_t size)
+{
+	return malloc_aligned_for_caller(align, size, __builtin_return_address(0));
+}
+
+void* malloc_aligned_unlocked(size_t align, size_t size)
+{
+	return malloc_aligned_unlocked_for_caller(align, size, __builtin_return_address(0));
+}
+
+void* malloc_for_caller(size_t size, void* caller)
+{
+	return do_malloc(&default_heap, size, FREELIST_ALIGNMENT, false, 0, caller, true);
+}
+
+void* malloc_aligned_for_caller(size_t align, size_t size, void* caller)
+{
+	// We want it to be a power of two since align_up operates on powers of two
+	assert((align & (align - 1)) == 0);
+
+	if(align < FREELIST_ALIGNMENT)
+	{
+		align = FREELIST_ALIGNMENT;
+	}
+
+	return do_malloc(&default_heap, size, align, false, 0, caller, true);
+}
+
+void* malloc_aligned_unlocked_for_caller(size_t align, size_t size, void* caller)
+{
+	assert((align & (align - 1)) == 0);
+
+	if(align < FREELIST_ALIGNMENT)
+	{
+		align = FREELIST_ALIGNMENT;
+	}
+
+	return do_malloc(&default_heap, size, align, false, 0, caller, false);
+}
+
+size_t malloc_usable_size(void* ptr)
+{
+	return ptr ? (container_of(ptr, alloc_node_t, block)->size & ~BLOCK_FLAGS_MASK) : 0;
+}
+
+void free(void* ptr)
+{
+	do_free(&default_heap, ptr, 0, true);
+}
+
+void free_from_isr(void* ptr)
+{
+#if FREELIST_ISR_FREE
+	if(ptr)
+	{
+		alloc_node_t* block = container_of(ptr, alloc_node_t, block);
+#if FREELIST_MAX_SEGMENTS > 0
+		heap_t* segment = segment_of(ptr);
+		push_remote_free(segment ? segment : &default_heap, block);
+#else
+		push_remote_free(&default_heap, block);
+#endif
+	}
+#else
+	do_free(&default_heap, ptr, 0, true);
+#endif
+}
+
+void malloc_drain(void)
+{
+	lock_heap(&default_heap);
+	drain_remote_frees(&default_heap);
+	refill_isr_pools(&default_heap);
+	bool signal = malloc_waiters > 0;
+	unlock_heap(&default_heap);
+
+	if(signal && malloc_release_hook)
+	{
+		malloc_release_hook();
+	}
+}
+
+void* malloc_try(size_t size)
+{
+	// The freelist never waits for memory, so this only differs from malloc() by name
+	return do_malloc(&default_heap, size, FREELIST_ALIGNMENT, false, 0,
+					 __builtin_return_address(0), true);
+}
+
+void* malloc_timed(size_t size, uint32_t timeout_ticks)
+{
+	void* caller = __builtin_return_address(0);
+	void* ptr = do_malloc(&default_heap, size, FREELIST_ALIGNMENT, false, 0, caller, true);
+
+	if(ptr || (size == 0) || (timeout_ticks == 0) || !malloc_wait_hook)
+	{
+		return ptr;
+	}
+
+	uint32_t start = malloc_tick_hook ? malloc_tick_hook() : 0;
+	uint32_t remaining = timeout_ticks;
+	bool waited = false;
+
+	lock_heap(&default_heap);
+	malloc_waiters++;
+	unlock_heap(&default_heap);
+
+	// Retry after registering as a waiter, so that a release in between is not missed
+	while(!(ptr = do_malloc(&default_heap, size, FREELIST_ALIGNMENT, false, 0, caller, true)))
+	{
+		if(timeout_ticks != MALLOC_WAIT_FOREVER)
+		{
+			// Unsigned subtraction handles the tick counter wrapping around. Without a tick
+			// source, the time spent waiting is unknown, so a finite timeout only waits once.
+			uint32_t elapsed = malloc_tick_hook ? (malloc_tick_hook() - start)
+												: (waited ? timeout_ticks : 0);
+
+			if(elapsed >= timeout_ticks)
+			{
+				break;
+			}
+
+			remaining = timeout_ticks - elapsed;
+		}
+
+		waited = true;
+
+		if(!malloc_wait_hook(remaining))
+		{
+			break;
+		}
+	}
+
+	lock_heap(&default_heap);
+	bool signal = (--malloc_waiters > 0);
+	unlock_heap(&default_heap);
+
+	// A release wakes one waiter. Pass it on, since the others may fit in what is left.
+	if(signal && malloc_release_hook)
+	{
+		malloc_release_hook();
+	}
+
+	return ptr;
+}
+
+void malloc_set_wait_hooks(malloc_wait_hook_t wait, malloc_release_hook_t release,
+						   malloc_tick_hook_t ticks)
+{
+	malloc_wait_hook = wait;
+	malloc_release_hook = release;
+	malloc_tick_hook = ticks;
+}
+
+bool malloc_isr_reserve(size_t size_class, size_t count)
+{
+#if FREELIST_ISR_POOL_CLASSES > 0
+	if((size_class == 0) || (count == 0) || (size_class > MAX_ALLOC_SZ))
+	{
+		return false;
+	}
+
+	size_class = block_alloc_size(size_class);
+
+	_Atomic(void*)* slots = NULL;
+	_Atomic(void*)* old_slots = NULL;
+	bool success = false;
+
+	lock_heap(&default_heap);
+
+	size_t index = 0;
+
+	while((index < isr_pool_cnt) && (isr_pools[index].size < size_class))
+	{
+		index++;
+	}
+
+	bool exists = (index < isr_pool_cnt) && (isr_pools[index].size == size_class);
+	size_t capacity = count + (exists ? isr_pools[index].capacity : 0);
+
+	if((exists || (isr_pool_cnt < FREELIST_ISR_POOL_CLASSES)) && (capacity >= count) &&
+	   (capacity <= (MAX_ALLOC_SZ / sizeof(*slots))))
+	{
+		size_t slots_size = block_alloc_size(capacity * sizeof(*slots));
+		alloc_node_t* block = alloc_block(&default_heap, slots_size, FREELIST_ALIGNMENT, false, 0);
+		slots = block ? (_Atomic(void*)*)&block->block : NULL;
+	}
+
+	if(slots)
+	{
+		isr_pool_t* pool = &isr_pools[index];
+		size_t head = 0;
+		size_t tail = 0;
+
+		if(exists)
+		{
+			// Move the reserved blocks into the larger ring
+			old_slots = pool->slots;
+			head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+			tail = atomic_load_explicit(&pool->tail, memory_order_relaxed);
+
+			for(size_t i = head; i < tail; i++)
+			{
+				atomic_init(&slots[i - head],
+							atomic_load_explicit(&old_slots[i % pool->capacity],
+												 memory_order_relaxed));
+			}
+		}
+		else
+		{
+			memmove(&isr_pools[index + 1], &isr_pools[index],
+					(isr_pool_cnt - index) * sizeof(isr_pool_t));
+			isr_pool_cnt++;
+		}
+
+		pool->size = size_class;
+		pool->capacity = capacity;
+		pool->slots = slots;
+		atomic_init(&pool->head, 0);
+		atomic_init(&pool->tail, tail - head);
+
+		success = isr_pool_fill(pool);
+	}
+
+	unlock_heap(&default_heap);
+
+	// Released without the lock held, since free() may call malloc_release_hook
+	do_free(&default_heap, (void*)old_slots, 0, true);
+
+	return success;
+#else
+	(void)size_class;
+	(void)count;
+	return false;
+#endif
+}
+
+void* malloc_from_isr(size_t size)
+{
+#if FREELIST_ISR_POOL_CLASSES > 0
+	// Use the smallest class which fits and still has blocks
+	for(size_t i = 0; (size > 0) && (i < isr_pool_cnt); i++)
+	{
+		if(isr_pools[i].size >= size)
+		{
+			void* ptr = isr_pool_pop(&isr_pools[i]);
+
+			if(ptr)
+			{
+				return ptr;
+			}
+		}
+	}
+#else
+	(void)size;
+#endif
+
+	return NULL;
+}
+
+void free_sized(void* ptr, size_t size)
+{
+	do_free(&default_heap, ptr, size, true);
+}
+
+void free_aligned_sized(void* ptr, size_t align, size_t size)
+{
+	assert(((uintptr_t)ptr & (align - 1)) == 0);
+	(void)align;
+
+	do_free(&default_heap, ptr, size, true);
+}
+
+void free_aligned_sized_unlocked(void* ptr, size_t align, size_t size)
+{
+	assert(((uintptr_t)ptr & (align - 1)) == 0);
+	(void)align;
+
+	do_free(&default_heap, ptr, size, false);
+}
+
+void malloc_get_stats(malloc_stats_t* stats)
+{
+	assert(stats);
+
+	heap_t* heap = &default_heap;
+	alloc_node_t* block = NULL;
+	size_t free_bytes = 0;
+
+	memset(stats, 0, sizeof(*stats));
+
+	lock_heap(heap);
+
+	list_for_each_entry(block, &heap->free_list, node)
+	{
+		if(block->size > stats->largest_free_block)
+		{
+			stats->largest_free_block = block->size;
+		}
+
+		if(!stats->free_blocks || (block->size < stats->smallest_free_block))
+		{
+			stats->smallest_free_block = block->size;
+		}
+
+		stats->free_blocks++;
+		free_bytes += block->size;
+	}
+
+	// The running total must match the free list
+	assert(free_bytes == heap->free_bytes);
+	(void)free_bytes;
+
+	stats->free_bytes = heap->free_bytes;
+	stats->min_free_bytes =
+		(heap->min_free_bytes < heap->free_bytes) ? heap->min_free_bytes : heap->free_bytes;
+	stats->allocations = heap->alloc_cnt;
+	stats->frees = heap->free_cnt;
+
+	unlock_heap(heap);
+}
+
+size_t malloc_free_bytes(void)
+{
+	heap_t* heap = &default_heap;
+
+	lock_heap(heap);
+	size_t free_bytes = heap->free_bytes;
+	unlock_heap(heap);
+
+	return free_bytes;
+}
+
+size_t malloc_min_free_bytes(void)
+{
+	heap_t* heap = &default_heap;
+
+	lock_heap(heap);
+	size_t min_free_bytes =
+		(heap->min_free_bytes < heap->free_bytes) ? heap->min_free_bytes : heap->free_bytes;
+	unlock_heap(heap);
+
+	return min_free_bytes;
+}
+
+void malloc_addblock(void* addr, size_t size)
+{
+	malloc_addblock_ex(addr, size, MALLOC_REGION_DEFAULT);
+}
+
+void malloc_addblock_ex(void* addr, size_t size, unsigned tag)
+{
+	heap_t* heap = &default_heap;
+
+	lock_heap(heap);
+	add_block(heap, addr, size, tag);
+	unlock_heap(heap);
+}
+
+void malloc_set_morecore(malloc_morecore_t morecore, size_t granularity)
+{
+	heap_t* heap = &default_heap;
+
+	// We want it to be a power of two since align_up operates on powers of two
+	assert((granularity & (granularity - 1)) == 0);
+
+	lock_heap(heap);
+	heap->morecore = morecore;
+	heap->morecore_granularity = granularity;
+	unlock_heap(heap);
+}
+
+void malloc_region_preference(const unsigned* tags, size_t count)
+{
+	heap_t* heap = &default_heap;
+
+	assert((count <= FREELIST_MAX_REGIONS) && (tags || (count == 0)));
+
+	lock_heap(heap);
+
+	heap->region_preference_cnt = 0;
+
+	for(size_t i = 0; (i < count) && (i < FREELIST_MAX_REGIONS); i++)
+	{
+		heap->region_preference[i] = tags[i];
+		heap->region_preference_cnt++;
+	}
+
+	unlock_heap(heap);
+}
+
+bool malloc_removeblock(void* addr, size_t size)
+{
+	heap_t* heap = &default_heap;
+	bool removed = false;
+	uintptr_t start = (uintptr_t)addr;
+	uintptr_t end = start + size;
+	alloc_node_t* block = NULL;
+
+	assert(addr && (size > 0));
+
+	lock_heap(heap);
+
+	// Deferred blocks must be on the free list to be removed
+	flush_deferred_frees(heap);
+	drain_remote_frees(heap);
+
+	list_for_each_entry(block, &heap->free_list, node)
+	{
+		uintptr_t front_start = free_block_start(heap, block);
+		uintptr_t back_end = free_block_end(heap, block);
+
+		if((start < front_start) || (end > back_end))
+		{
+			continue;
+		}
+
+		// Memory in front of and behind the range must be able to hold a free block
+		uintptr_t back_start = align_up(end, FREELIST_ALIGNMENT);
+		bool keep_front = (start != front_start);
+		bool keep_back = (back_end != end);
+
+		if((keep_front && (start < ((uintptr_t)block + MIN_ALLOC_SZ))) ||
+		   (keep_back && ((back_end < back_start) || ((back_end - back_start) < MIN_ALLOC_SZ))))
+		{
+			break;
+		}
+
+		if(keep_back)
+		{
+			alloc_node_t* back_block = (alloc_node_t*)back_start;
+			back_block->size = align_down(back_end - back_start - ALLOC_HEADER_SZ, FREELIST_ALIGNMENT);
+			free_list_insert(heap, back_block, &block->node, block->node.next);
+		}
+
+		if(keep_front)
+		{
+			free_list_resize(heap, block,
+							 align_down(start - (uintptr_t)&block->block, FREELIST_ALIGNMENT));
+		}
+		else
+		{
+			free_list_del(heap, block);
+		}
+
+		release_region_range(heap, start, end);
+		removed = true;
+		break;
+	}
+
+	unlock_heap(heap);
+
+	return removed;
+}
+
+size_t malloc_trim(size_t pad, malloc_trim_callback_t release)
+{
+	struct
+	{
+		uintptr_t start;
+		uintptr_t end;
+		unsigned tag;
+	} released[FREELIST_MAX_REGIONS];
+	heap_t* heap = &default_heap;
+	size_t released_cnt = 0;
+	size_t released_bytes = 0;
+	alloc_node_t* block = NULL;
+	alloc_node_t* temp = NULL;
+
+	assert(release);
+
+	pad = align_up(pad, FREELIST_ALIGNMENT);
+
+	lock_heap(heap);
+
+	// Deferred blocks must be merged so that the end of each region is found
+	flush_deferred_frees(heap);
+	drain_remote_frees(heap);
+
+	list_for_each_entry_safe(block, temp, &heap->free_list, node)
+	{
+		for(size_t i = 0; i < heap->region_cnt; i++)
+		{
+			heap_region_t* region = &heap->regions[i];
+
+			// Only a free block at the very end of a region can be trimmed
+			if(free_block_end(heap, block) != region->end)
+			{
+				continue;
+			}
+
+			uintptr_t cut = (uintptr_t)&block->block + pad;
+
+			if((pad == 0) && (free_block_start(heap, block) == region->start))
+			{
+				// The whole region is free
+				cut = region->start;
+			}
+			else if(pad < (MIN_ALLOC_SZ - ALLOC_HEADER_SZ))
+			{
+				cut = (uintptr_t)&block->block + (MIN_ALLOC_SZ - ALLOC_HEADER_SZ);
+			}
+
+			if((cut >= region->end) || ((region->end - cut) < MIN_ALLOC_SZ))
+			{
+				break;
+			}
+
+			released[released_cnt].start = cut;
+			released[released_cnt].end = region->end;
+			released[released_cnt].tag = region->tag;
+			released_cnt++;
+
+			if(cut == region->start)
+			{
+				free_list_del(heap, block);
+				remove_region(heap, i);
+			}
+			else
+			{
+				free_list_resize(heap, block, cut - (uintptr_t)&block->block);
+				region->end = cut;
+			}
+
+			break;
+		}
+	}
+
+	unlock_heap(heap);
+
+	// The callback is invoked without the lock held so it may call malloc() and free()
+	for(size_t i = 0; i < released_cnt; i++)
+	{
+		release((void*)released[i].start, released[i].end - released[i].start, released[i].tag);
+		released_bytes += released[i].end - released[i].start;
+	}
+
+	return released_bytes;
+}
+
+#pragma mark - Heap Instances -
+
+heap_t* heap_init(void* addr, size_t size, const heap_lock_t* lock)
+{
+	uintptr_t start = align_up((uintptr_t)addr, _Alignof(heap_t));
+	uintptr_t end = (uintptr_t)addr + size;
+
+	assert(addr);
+
+	// The memory behind the heap structure must be able to hold a free block
+	if(!addr || (end < start) ||
+	   ((end - start) < (sizeof(heap_t) + FREELIST_ALIGNMENT + MIN_ALLOC_SZ)))
+	{
+		return NULL;
+	}
+
+	heap_t* heap = (heap_t*)start;
+	memset(heap, 0, sizeof(*heap));
+	heap->free_list.next = &heap->free_list;
+	heap->free_list.prev = &heap->free_list;
+	heap->min_free_bytes = SIZE_MAX;
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	heap->size_index_valid = true;
+#endif
+#if FREELIST_REMOTE_FREES
+	atomic_init(&heap->remote_frees, NULL);
+#endif
+
+	if(lock)
+	{
+		heap->lock = *lock;
+	}
+
+	add_block(heap, (void*)(start + sizeof(heap_t)), end - start - sizeof(heap_t),
+			  MALLOC_REGION_DEFAULT);
+
+	return heap;
+}
+
+heap_t* heap_default(void)
+{
+	return &default_heap;
+}
+
+void heap_addblock(heap_t* heap, void* addr, size_t size)
+{
+	assert(heap);
+
+	lock_heap(heap);
+	add_block(heap, addr, size, MALLOC_REGION_DEFAULT);
+	unlock_heap(heap);
+}
+
+void* heap_alloc(heap_t* heap, size_t size)
+{
+	assert(heap);
+
+	return do_malloc(heap, size, FREELIST_ALIGNMENT, false, 0, __builtin_return_address(0), true);
+}
+
+void* heap_aligned_alloc(heap_t* heap, size_t align, size_t size)
+{
+	// We want it to be a power of two since align_up operates on powers of two
+	assert(heap && ((align & (align - 1)) == 0));
+
+	if(align < FREELIST_ALIGNMENT)
+	{
+		align = FREELIST_ALIGNMENT;
+	}
+
+	return do_malloc(heap, size, align, false, 0, __builtin_return_address(0), true);
+}
+
+void heap_free(heap_t* heap, void* ptr)
+{
+	assert(heap);
+
+	do_free(heap, ptr, 0, true);
+}
+
+void heap_free_remote(heap_t* heap, void* ptr)
+{
+	assert(heap);
+
+#if FREELIST_REMOTE_FREES
+	if(ptr)
+	{
+		push_remote_free(heap, container_of(ptr, alloc_node_t, block));
+	}
+#else
+	do_free(heap, ptr, 0, true);
+#endif
+}
+
+heap_t* heap_segment_create(size_t size)
+{
+	heap_t* segment = NULL;
+
+#if FREELIST_MAX_SEGMENTS > 0
+	void* memory = malloc(size);
+
+	if(memory)
+	{
+		segment = heap_init(memory, size, NULL);
+	}
+
+	if(segment)
+	{
+		bool registered = false;
+
+		lock_heap(&default_heap);
+
+		for(size_t i = 0; (i < FREELIST_MAX_SEGMENTS) && !registered; i++)
+		{
+			if(!atomic_load_explicit(&heap_segments[i].heap, memory_order_relaxed))
+			{
+				heap_segments[i].start = (uintptr_t)memory;
+				heap_segments[i].end = (uintptr_t)memory + size;
+				atomic_store_explicit(&heap_segments[i].heap, segment, memory_order_release);
+				registered = true;
+			}
+		}
+
+		unlock_heap(&default_heap);
+
+		if(!registered)
+		{
+			segment = NULL;
+		}
+	}
+
+	if(!segment)
+	{
+		free(memory);
+	}
+#else
+	(void)size;
+#endif
+
+	return segment;
+}
+
+void heap_segment_destroy(heap_t* segment)
+{
+#if FREELIST_MAX_SEGMENTS > 0
+	void* memory = NULL;
+
+	lock_heap(&default_heap);
+
+	for(size_t i = 0; segment && (i < FREELIST_MAX_SEGMENTS); i++)
+	{
+		if(atomic_load_explicit(&heap_segments[i].heap, memory_order_relaxed) == segment)
+		{
+			atomic_store_explicit(&heap_segments[i].heap, NULL, memory_order_relaxed);
+			memory = (void*)heap_segments[i].start;
+			break;
+		}
+	}
+
+	unlock_heap(&default_heap);
+
+	assert((memory || !segment) && "Not a heap segment!");
+
+	// The segment is no longer registered, so its memory goes back to the default heap
+	free(memory);
+#else
+	(void)segment;
+#endif
 }
@@ -5,7 +5,10 @@
 
 #include <assert.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 #include <freertos/task.h>
+#include <malloc.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -25,6 +28,12 @@
 #define FREERTOS_HEAP_REGION_CNT 2
 #endif
 
+/// Event bit which free() sets to wake malloc_timed() calls
+#define MEMORY_RELEASED_BIT ((EventBits_t)0x1)
+
+/// Event bit which malloc_init() sets once the heap is ready
+#define HEAP_INITIALIZED_BIT ((EventBits_t)0x2)
+
 #pragma mark - Declarations -
 
 /// Maximum number of heap regions that can be specified
@@ -44,9 +53,20 @@ static HeapRegion_t heap_regions[FREERTOS_HEAP_REGION_CNT + 1];
 
 /**
  * Flag that is used in malloc() to cause competing threads to wait until
- * initialization is completed before allocating memory.
+ * initialization is completed before allocating memory. It is stored with release
+ * ordering, so a thread which loads it with acquire ordering also sees the heap regions.
  */
-static volatile bool initialized_ = false;
+static atomic_bool initialized_ = false;
+
+/// Event group which tasks wait on for initialization, and for memory to be released
+static StaticEventGroup_t heap_events_storage_;
+static EventGroupHandle_t heap_events_ = NULL;
+
+/// Set once the event group is created. Stored with release ordering after the handle.
+static atomic_bool heap_events_created_ = false;
+
+/// Number of malloc_timed() calls waiting for memory. Modified in a critical section.
+static volatile UBaseType_t waiters_ = 0;
 
 #pragma mark - Private Functions -
 
@@ -60,6 +80,52 @@ static int cmp_heap(const void* region_a, const void* region_b)
 				: ((heapregion_a->pucStartAddress != heapregion_b->pucStartAddress)));
 }
 
+/**
+ * Get the heap event group. The group is created by the first caller, since tasks may start
+ * waiting for memory before malloc_init() is called.
+ *
+ * The group is created in a critical section, so a task never has to wait for another task
+ * to finish creating it. Static creation does not block, so it is safe to do there.
+ */
+static EventGroupHandle_t heap_events(void)
+{
+	if(!atomic_load_explicit(&heap_events_created_, memory_order_acquire))
+	{
+		taskENTER_CRITICAL();
+
+		if(!atomic_load_explicit(&heap_events_created_, memory_order_relaxed))
+		{
+			heap_events_ = xEventGroupCreateStatic(&heap_events_storage_);
+			atomic_store_explicit(&heap_events_created_, true, memory_order_release);
+		}
+
+		taskEXIT_CRITICAL();
+	}
+
+	return heap_events_;
+}
+
+/**
+ * Block until malloc_init() has defined the heap regions, for up to `ticks`.
+ *
+ * @returns true if the heap is initialized.
+ */
+static bool wait_for_init(TickType_t ticks)
+{
+	if(atomic_load_explicit(&initialized_, memory_order_acquire))
+	{
+		return true;
+	}
+
+	if(ticks > 0)
+	{
+		// The bit is never cleared, so tasks which start waiting after it is set don't block
+		(void)xEventGroupWaitBits(heap_events(), HEAP_INITIALIZED_BIT, pdFALSE, pdFALSE, ticks);
+	}
+
+	return atomic_load_explicit(&initialized_, memory_order_acquire);
+}
+
 /**
  * malloc_addblock must be called before memory allocation calls are made.
  * In this FreeRTOS implementation, malloc() calls will block until memory
@@ -88,9 +154,10 @@ void malloc_addblock(void* addr, size_t size)
 
 __attribute__((weak)) void malloc_init()
 {
-	assert((heap_region_cnt > 0) && !initialized_);
+	bool initialized = atomic_load_explicit(&initialized_, memory_order_relaxed);
+	assert((heap_region_cnt > 0) && !initialized);
 
-	if(heap_region_cnt > 0 && !initialized_)
+	if(heap_region_cnt > 0 && !initialized)
 	{
 		// Sort the heap regions so addresses are in the correct order
 		qsort(heap_regions, heap_region_cnt, sizeof(HeapRegion_t), cmp_heap);
@@ -98,8 +165,13 @@ __attribute__((weak)) void malloc_init()
 		// Pass the array into vPortDefineHeapRegions() to enable malloc()
 		vPortDefineHeapRegions(heap_regions);
 
+		// The group exists before the heap is marked initialized, since free() and
+		// malloc_timed() may use it as soon as the heap is
+		EventGroupHandle_t events = heap_events();
+
 		// Signal to any waiting threads that we are done initializing
-		initialized_ = true;
+		atomic_store_explicit(&initialized_, true, memory_order_release);
+		(void)xEventGroupSetBits(events, HEAP_INITIALIZED_BIT);
 	}
 }
 
@@ -107,10 +179,10 @@ void* malloc(size_t size)
 {
 	void* ptr = NULL;
 
-	while(!initialized_)
+	// Thread blocks until application malloc has been correctly initialized. The wait can
+	// end early if it is aborted, so keep waiting until the heap is ready.
+	while(!wait_for_init(portMAX_DELAY))
 	{
-		// Thread blocks until application malloc has been correctly initialized
-		vTaskDelay(1);
 	}
 
 	if(size > 0)
@@ -124,12 +196,87 @@ void* malloc(size_t size)
 
 void free(void* ptr)
 {
-	/// free should NEVER be called before malloc is init'd
-	assert(initialized_);
-
 	if(ptr)
 	{
+		/// free should NEVER be called with memory before malloc is init'd. free(NULL) is fine.
+		assert(atomic_load_explicit(&initialized_, memory_order_acquire));
+
 		// We simply wrap the FreeRTOS call into a standard form
 		vPortFree(ptr);
+
+		if(waiters_ > 0)
+		{
+			(void)xEventGroupSetBits(heap_events(), MEMORY_RELEASED_BIT);
+		}
+	}
+}
+
+void* malloc_try(size_t size)
+{
+	return (wait_for_init(0) && (size > 0)) ? pvPortMalloc(size) : NULL;
+}
+
+void* malloc_timed(size_t size, uint32_t timeout_ticks)
+{
+	void* ptr = NULL;
+	bool forever = (timeout_ticks == MALLOC_WAIT_FOREVER);
+	// Timeouts which don't fit in a tick count wait forever
+	TickType_t timeout = (forever || (timeout_ticks >= (uint32_t)portMAX_DELAY))
+							 ? portMAX_DELAY
+							 : (TickType_t)timeout_ticks;
+	TickType_t start = xTaskGetTickCount();
+
+	// Initialization counts against the timeout
+	if(!wait_for_init(timeout) || (size == 0))
+	{
+		return NULL;
+	}
+
+	ptr = pvPortMalloc(size);
+
+	if(ptr || (timeout == 0))
+	{
+		return ptr;
 	}
+
+	EventGroupHandle_t events = heap_events();
+
+	taskENTER_CRITICAL();
+	waiters_++;
+	taskEXIT_CRITICAL();
+
+	for(;;)
+	{
+		// Clear the bit before retrying, so that a release after the retry ends the wait
+		(void)xEventGroupClearBits(events, MEMORY_RELEASED_BIT);
+
+		ptr = pvPortMalloc(size);
+
+		if(ptr)
+		{
+			break;
+		}
+
+		TickType_t wait = portMAX_DELAY;
+
+		if(timeout != portMAX_DELAY)
+		{
+			TickType_t elapsed = (TickType_t)(xTaskGetTickCount() - start);
+
+			if(elapsed >= timeout)
+			{
+				break;
+			}
+
+			wait = timeout - elapsed;
+		}
+
+		(void)xEventGroupWaitBits(events, MEMORY_RELEASED_BIT, pdFALSE, pdFALSE, wait);
+	}
+
+	taskENTER_CRITICAL();
+	waiters_--;
+	taskEXIT_CRITICAL();
+
+	return ptr;
 }
@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * NOTE: This file provides the FreeRTOS heap (pvPortMalloc() and friends) using the libmemory
+ * freelist implementation. Do not link any of the FreeRTOS heap_x.c files with it.
+ *
+ * FreeRTOS kernel objects and application malloc() calls share the same heap.
+ * Memory is added with malloc_addblock(), or with vPortDefineHeapRegions() for code
+ * written for heap_5. Regions do not need to be sorted.
+ */
+
+#pragma mark - Definitions -
+
+/**
+ * By default, the heap is locked by suspending the scheduler, like the FreeRTOS heap
+ * implementations. Define this macro to 1 to use a critical section instead, which also
+ * masks interrupts. Heap operations are short, but their duration depends on the heap.
+ */
+#ifndef FREERTOS_PROVIDER_USE_CRITICAL_SECTION
+#define FREERTOS_PROVIDER_USE_CRITICAL_SECTION 0
+#endif
+
+#if(configUSE_MALLOC_FAILED_HOOK == 1)
+extern void vApplicationMallocFailedHook(void);
+#endif
+
+#pragma mark - Locking -
+
+void malloc_lock()
+{
+#if FREERTOS_PROVIDER_USE_CRITICAL_SECTION
+	taskENTER_CRITICAL();
+#else
+	vTaskSuspendAll();
+#endif
+}
+
+void malloc_unlock()
+{
+#if FREERTOS_PROVIDER_USE_CRITICAL_SECTION
+	taskEXIT_CRITICAL();
+#else
+	(void)xTaskResumeAll();
+#endif
+}
+
+#pragma mark - FreeRTOS Heap APIs -
+
+void* pvPortMalloc(size_t xWantedSize)
+{
+	void* ptr = malloc(xWantedSize);
+
+	traceMALLOC(ptr, xWantedSize);
+
+#if(configUSE_MALLOC_FAILED_HOOK == 1)
+	if(!ptr)
+	{
+		vApplicationMallocFailedHook();
+	}
+#endif
+
+	return ptr;
+}
+
+void vPortFree(void* pv)
+{
+	if(pv)
+	{
+		traceFREE(pv, malloc_usable_size(pv));
+		free(pv);
+	}
+}
+
+void vPortDefineHeapRegions(const HeapRegion_t* const pxHeapRegions)
+{
+	for(const HeapRegion_t* region = pxHeapRegions; region->xSizeInBytes > 0; region++)
+	{
+		malloc_addblock(region->pucStartAddress, region->xSizeInBytes);
+	}
+}
+
+void vPortInitialiseBlocks(void)
+{
+	// The freelist does not need to be initialized
+}
+
+size_t xPortGetFreeHeapSize(void)
+{
+	return malloc_free_bytes();
+}
+
+size_t xPortGetMinimumEverFreeHeapSize(void)
+{
+	return malloc_min_free_bytes();
+}
+
+void vPortGetHeapStats(HeapStats_t* pxHeapStats)
+{
+	malloc_stats_t stats;
+
+	malloc_get_stats(&stats);
+
+	pxHeapStats->xAvailableHeapSpaceInBytes = stats.free_bytes;
+	pxHeapStats->xSizeOfLargestFreeBlockInBytes = stats.largest_free_block;
+	pxHeapStats->xSizeOfSmallestFreeBlockInBytes = stats.smallest_free_block;
+	pxHeapStats->xNumberOfFreeBlocks = stats.free_blocks;
+	pxHeapStats->xMinimumEverFreeBytesRemaining = stats.min_free_bytes;
+	pxHeapStats->xNumberOfSuccessfulAllocations = stats.allocations;
+	pxHeapStats->xNumberOfSuccessfulFrees = stats.frees;
+}
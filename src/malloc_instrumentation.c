@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include "malloc_instrumentation_internal.h"
+#include <assert.h>
+#include <string.h>
+
+#pragma mark - Prototypes -
+
+// Provided by the malloc implementation
+void malloc_lock();
+void malloc_unlock();
+
+#pragma mark - Declarations -
+
+_Atomic(malloc_cycle_counter_t) malloc_cycle_counter_ = NULL;
+
+static malloc_histogram_t histograms_[MALLOC_OP_COUNT];
+
+#pragma mark - Private Functions -
+
+static void histogram_clear(malloc_histogram_t* histogram)
+{
+	memset(histogram, 0, sizeof(*histogram));
+	histogram->min = UINT32_MAX;
+}
+
+/// Bucket 0 holds zero-cycle samples, bucket N holds samples in [2^(N-1), 2^N)
+static unsigned histogram_bucket(uint32_t cycles)
+{
+	return cycles ? (unsigned)(32 - __builtin_clz(cycles)) : 0;
+}
+
+void malloc_instrumentation_add_sample(malloc_op_t op, uint32_t cycles)
+{
+	malloc_histogram_t* histogram = &histograms_[op];
+
+	if(histogram->count == 0)
+	{
+		histogram_clear(histogram);
+	}
+
+	histogram->count++;
+	histogram->total += cycles;
+	histogram->buckets[histogram_bucket(cycles)]++;
+
+	if(cycles < histogram->min)
+	{
+		histogram->min = cycles;
+	}
+
+	if(cycles > histogram->max)
+	{
+		histogram->max = cycles;
+	}
+}
+
+#pragma mark - APIs -
+
+void malloc_instrumentation_enable(malloc_cycle_counter_t counter)
+{
+	malloc_lock();
+	atomic_store_explicit(&malloc_cycle_counter_, counter, memory_order_relaxed);
+	malloc_unlock();
+}
+
+void malloc_histogram_read(malloc_op_t op, malloc_histogram_t* histogram, bool reset)
+{
+	assert(histogram && (op < MALLOC_OP_COUNT));
+
+	malloc_lock();
+
+	if(histograms_[op].count)
+	{
+		*histogram = histograms_[op];
+	}
+	else
+	{
+		histogram_clear(histogram);
+		histogram->min = 0;
+	}
+
+	if(reset)
+	{
+		histograms_[op].count = 0;
+	}
+
+	malloc_unlock();
+}
+
+void malloc_histogram_reset(void)
+{
+	malloc_lock();
+
+	for(unsigned i = 0; i < MALLOC_OP_COUNT; i++)
+	{
+		histograms_[i].count = 0;
+	}
+
+	malloc_unlock();
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef MALLOC_INSTRUMENTATION_INTERNAL_H_
+#define MALLOC_INSTRUMENTATION_INTERNAL_H_
+
+#include <malloc_instrumentation.h>
+#include <stdatomic.h>
+
+/**
+ * The registered cycle counter. NULL when instrumentation is disabled.
+ *
+ * Timestamps are taken before the malloc lock is held, so the counter is atomic.
+ */
+extern _Atomic(malloc_cycle_counter_t) malloc_cycle_counter_;
+
+/**
+ * Add a sample to the histogram for `op`.
+ *
+ * The caller must hold the malloc lock.
+ */
+void malloc_instrumentation_add_sample(malloc_op_t op, uint32_t cycles);
+
+/// A cycle counter reading, and the counter which it was read from
+typedef struct
+{
+	/// NULL if instrumentation was disabled when the timestamp was taken
+	malloc_cycle_counter_t counter;
+	uint32_t cycles;
+} malloc_timestamp_t;
+
+/// Read the cycle counter. The timestamp has no counter if instrumentation is disabled.
+static inline malloc_timestamp_t malloc_instrumentation_timestamp(void)
+{
+	malloc_timestamp_t timestamp = {
+		atomic_load_explicit(&malloc_cycle_counter_, memory_order_relaxed), 0};
+
+	if(timestamp.counter)
+	{
+		timestamp.cycles = timestamp.counter();
+	}
+
+	return timestamp;
+}
+
+/**
+ * Record the time elapsed since `start` for `op`.
+ *
+ * Nothing is recorded unless `start` was read from the counter which is registered now, so an
+ * operation which was already running when instrumentation was enabled is not measured from 0.
+ *
+ * The caller must hold the malloc lock.
+ */
+static inline void malloc_instrumentation_record(malloc_op_t op, malloc_timestamp_t start)
+{
+	malloc_cycle_counter_t counter =
+		atomic_load_explicit(&malloc_cycle_counter_, memory_order_relaxed);
+
+	if(counter && (counter == start.counter))
+	{
+		// Unsigned subtraction handles counter wraparound
+		malloc_instrumentation_add_sample(op, counter() - start.cycles);
+	}
+}
+
+#endif // MALLOC_INSTRUMENTATION_INTERNAL_H_
@@ -0,0 +1,19 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+// MAP_ANONYMOUS is not exposed in strict C11 mode
+#define _DEFAULT_SOURCE
+
+#include <malloc.h>
+#include <sys/mman.h>
+
+#pragma mark - APIs -
+
+void* malloc_morecore_mmap(size_t size)
+{
+	void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return (addr == MAP_FAILED) ? NULL : addr;
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: Replaceable operator new and operator delete for the freelist implementation.
+ *
+ * Link this file in place of the toolchain's definitions, which call malloc() and free()
+ * without the size and alignment information that the compiler provides.
+ *	- Plain operator new returns memory aligned to __STDCPP_DEFAULT_NEW_ALIGNMENT__, which
+ *	  any type without an extended alignment may need. It calls malloc() when the heap
+ *	  already provides that alignment (MALLOC_NATIVE_ALIGNMENT), and malloc_aligned()
+ *	  otherwise.
+ *	- Over-aligned types use malloc_aligned(), so they are allocated by the freelist
+ *	  directly, instead of over-allocating through aligned_malloc().
+ *	- Sized and aligned deallocations use free_sized() and free_aligned_sized(), which check
+ *	  the size and alignment in debug builds.
+ *
+ * Each operator new passes its return address to the heap, so that the heap profiler
+ * attributes the allocation to the new-expression, not to this file.
+ *
+ * When an allocation fails, the installed std::new_handler is called and the allocation
+ * is retried, as the standard requires. If there is no handler, the throwing forms throw
+ * std::bad_alloc. When exceptions are disabled, they call std::abort() instead.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <malloc.h>
+#include <malloc_profiler.h>
+#include <new>
+
+#pragma mark - Private Functions -
+
+namespace
+{
+/// Alignment used for operator new without an explicit alignment
+constexpr std::size_t default_alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+/// Alignments which malloc() already provides do not need malloc_aligned()
+void* heap_allocate(std::size_t size, std::size_t align, void* caller)
+{
+	return (align <= MALLOC_NATIVE_ALIGNMENT) ? malloc_for_caller(size, caller)
+											  : malloc_aligned_for_caller(align, size, caller);
+}
+
+/**
+ * Allocate memory, calling the new_handler until the allocation succeeds.
+ * Returns nullptr if there is no new_handler.
+ */
+void* allocate(std::size_t size, std::size_t align, void* caller)
+{
+	// Each call to operator new must return a distinct pointer, even for zero bytes
+	if(size == 0)
+	{
+		size = 1;
+	}
+
+	void* ptr = heap_allocate(size, align, caller);
+
+	while(!ptr)
+	{
+		std::new_handler handler = std::get_new_handler();
+
+		if(!handler)
+		{
+			break;
+		}
+
+		handler();
+		ptr = heap_allocate(size, align, caller);
+	}
+
+	return ptr;
+}
+
+void* allocate_or_throw(std::size_t size, std::size_t align, void* caller)
+{
+	void* ptr = allocate(size, align, caller);
+
+	if(!ptr)
+	{
+#if defined(__cpp_exceptions)
+		throw std::bad_alloc();
+#else
+		std::abort();
+#endif
+	}
+
+	return ptr;
+}
+
+void* allocate_nothrow(std::size_t size, std::size_t align, void* caller) noexcept
+{
+#if defined(__cpp_exceptions)
+	// The new_handler may throw
+	try
+	{
+		return allocate(size, align, caller);
+	}
+	catch(...)
+	{
+		return nullptr;
+	}
+#else
+	return allocate(size, align, caller);
+#endif
+}
+
+/// Sizes of zero were allocated as one byte
+constexpr std::size_t allocated_size(std::size_t size)
+{
+	return size ? size : 1;
+}
+} // namespace
+
+#pragma mark - Allocation -
+
+void* operator new(std::size_t size)
+{
+	return allocate_or_throw(size, default_alignment, __builtin_return_address(0));
+}
+
+void* operator new[](std::size_t size)
+{
+	return allocate_or_throw(size, default_alignment, __builtin_return_address(0));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate_nothrow(size, default_alignment, __builtin_return_address(0));
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate_nothrow(size, default_alignment, __builtin_return_address(0));
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+	return allocate_or_throw(size, static_cast<std::size_t>(align),
+							 __builtin_return_address(0));
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+	return allocate_or_throw(size, static_cast<std::size_t>(align),
+							 __builtin_return_address(0));
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	return allocate_nothrow(size, static_cast<std::size_t>(align),
+							__builtin_return_address(0));
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	return allocate_nothrow(size, static_cast<std::size_t>(align),
+							__builtin_return_address(0));
+}
+
+#pragma mark - Deallocation -
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t size) noexcept
+{
+	free_sized(ptr, allocated_size(size));
+}
+
+void operator delete[](void* ptr, std::size_t size) noexcept
+{
+	free_sized(ptr, allocated_size(size));
+}
+
+void operator delete(void* ptr, std::align_val_t align) noexcept
+{
+	free_aligned_sized(ptr, static_cast<std::size_t>(align), 0);
+}
+
+void operator delete[](void* ptr, std::align_val_t align) noexcept
+{
+	free_aligned_sized(ptr, static_cast<std::size_t>(align), 0);
+}
+
+void operator delete(void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	free_aligned_sized(ptr, static_cast<std::size_t>(align), 0);
+}
+
+void operator delete[](void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	free_aligned_sized(ptr, static_cast<std::size_t>(align), 0);
+}
+
+void operator delete(void* ptr, std::size_t size, std::align_val_t align) noexcept
+{
+	free_aligned_sized(ptr, static_cast<std::size_t>(align), allocated_size(size));
+}
+
+void operator delete[](void* ptr, std::size_t size, std::align_val_t align) noexcept
+{
+	free_aligned_sized(ptr, static_cast<std::size_t>(align), allocated_size(size));
+}
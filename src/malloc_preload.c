@@ -0,0 +1,182 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This file is used to build libmemory_preload.so, which replaces the host's malloc
+ * family with the freelist implementation, e.g.:
+ *
+ *	LD_PRELOAD=buildresults/src/libmemory_preload.so ls -l
+ *
+ * The freelist is compiled with FREELIST_DEFAULT_MORECORE set to malloc_morecore_mmap,
+ * so the heap is mapped on the first call to malloc().
+ */
+
+// Needed for pthread_atfork() and sysconf() in strict C11 mode
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <malloc.h>
+#include <malloc_profiler.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#pragma mark - Definitions -
+
+#define IS_POWER_2(x) (!((x) & ((x)-1)))
+
+#pragma mark - Declarations -
+
+static pthread_mutex_t malloc_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+#pragma mark - Locking -
+
+void malloc_lock()
+{
+	pthread_mutex_lock(&malloc_mutex_);
+}
+
+void malloc_unlock()
+{
+	pthread_mutex_unlock(&malloc_mutex_);
+}
+
+/// Keep the heap consistent in the child if another thread holds the lock during fork()
+__attribute__((constructor)) static void malloc_preload_init(void)
+{
+	pthread_atfork(malloc_lock, malloc_unlock, malloc_unlock);
+}
+
+#pragma mark - Private Functions -
+
+/*
+ * The wrappers below pass their own return address through to the heap, so that the
+ * profiler attributes the allocation to the wrapper's caller.
+ */
+
+static void* realloc_for_caller(void* ptr, size_t size, void* caller)
+{
+	if(!ptr)
+	{
+		return malloc_for_caller(size, caller);
+	}
+
+	if(size == 0)
+	{
+		free(ptr);
+		return NULL;
+	}
+
+	size_t usable = malloc_usable_size(ptr);
+
+	// The current block is already large enough
+	if(size <= usable)
+	{
+		return ptr;
+	}
+
+	void* new_ptr = malloc_for_caller(size, caller);
+
+	if(new_ptr)
+	{
+		memcpy(new_ptr, ptr, usable);
+		free(ptr);
+	}
+
+	return new_ptr;
+}
+
+static void* memalign_for_caller(size_t align, size_t size, void* caller)
+{
+	if(!IS_POWER_2(align))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return malloc_aligned_for_caller(align, size, caller);
+}
+
+#pragma mark - APIs -
+
+void* calloc(size_t num, size_t size)
+{
+	void* ptr = NULL;
+	size_t total = num * size;
+
+	// Check for multiplication overflow
+	if((size == 0) || ((total / size) == num))
+	{
+		ptr = malloc_for_caller(total, __builtin_return_address(0));
+
+		if(ptr)
+		{
+			memset(ptr, 0, total);
+		}
+	}
+	else
+	{
+		errno = ENOMEM;
+	}
+
+	return ptr;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	return realloc_for_caller(ptr, size, __builtin_return_address(0));
+}
+
+void* reallocarray(void* ptr, size_t num, size_t size)
+{
+	size_t total = num * size;
+
+	// Check for multiplication overflow
+	if((size != 0) && ((total / size) != num))
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return realloc_for_caller(ptr, total, __builtin_return_address(0));
+}
+
+void* memalign(size_t align, size_t size)
+{
+	return memalign_for_caller(align, size, __builtin_return_address(0));
+}
+
+void* aligned_alloc(size_t align, size_t size)
+{
+	return memalign_for_caller(align, size, __builtin_return_address(0));
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+	if(!IS_POWER_2(alignment) || ((alignment % sizeof(void*)) != 0))
+	{
+		return EINVAL;
+	}
+
+	*memptr = malloc_aligned_for_caller(alignment, size, __builtin_return_address(0));
+
+	// A zero-size request is allowed to return NULL
+	return ((*memptr != NULL) || (size == 0)) ? 0 : ENOMEM;
+}
+
+void* valloc(size_t size)
+{
+	return malloc_aligned_for_caller((size_t)sysconf(_SC_PAGESIZE), size,
+									 __builtin_return_address(0));
+}
+
+void* pvalloc(size_t size)
+{
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+	return malloc_aligned_for_caller(page_size, (size + page_size - 1) & ~(page_size - 1),
+									 __builtin_return_address(0));
+}
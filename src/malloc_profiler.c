@@ -0,0 +1,233 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include "malloc_profiler_internal.h"
+#include <assert.h>
+#include <string.h>
+
+/// Maximum number of call sites which can be tracked.
+/// Your application can define this macro to track more call sites.
+#ifndef MALLOC_PROFILER_MAX_CALLSITES
+#define MALLOC_PROFILER_MAX_CALLSITES 64
+#endif
+
+/// Maximum number of sampled allocations which can be live at once.
+/// Your application can define this macro to track more samples.
+#ifndef MALLOC_PROFILER_MAX_LIVE_SAMPLES
+#define MALLOC_PROFILER_MAX_LIVE_SAMPLES 256
+#endif
+
+#pragma mark - Definitions -
+
+/// A sampled allocation which has not been freed yet
+typedef struct
+{
+	void* ptr;
+	size_t size;
+	size_t callsite;
+} live_sample_t;
+
+/// ln(2) in 16.16 fixed point
+#define LN2_FIXED 45426u
+
+#pragma mark - Prototypes -
+
+// Provided by the malloc implementation
+void malloc_lock();
+void malloc_unlock();
+
+#pragma mark - Declarations -
+
+intptr_t malloc_profiler_countdown_ = INTPTR_MAX;
+
+static size_t sample_interval_ = 0;
+static malloc_unwinder_t unwinder_ = NULL;
+static size_t dropped_samples_ = 0;
+
+/// xorshift32 state used to generate sampling distances
+static uint32_t rng_state_ = 2463534242u;
+
+static malloc_callsite_t callsites_[MALLOC_PROFILER_MAX_CALLSITES];
+static live_sample_t live_samples_[MALLOC_PROFILER_MAX_LIVE_SAMPLES];
+
+#pragma mark - Private Functions -
+
+static uint32_t next_random(void)
+{
+	rng_state_ ^= rng_state_ << 13;
+	rng_state_ ^= rng_state_ >> 17;
+	rng_state_ ^= rng_state_ << 5;
+
+	return rng_state_;
+}
+
+/**
+ * Draw the distance to the next sample from an exponential distribution with a mean of
+ * sample_interval_ bytes. This is computed as -ln(U) * interval, with U uniform in (0, 1].
+ * log2 is approximated in fixed point (linear interpolation of the mantissa) to avoid
+ * pulling in floating point support.
+ */
+static intptr_t next_sample_distance(void)
+{
+	uint32_t r = next_random() | 1;
+	unsigned msb = 31 - (unsigned)__builtin_clz(r);
+
+	// log2(r) in 16.16 fixed point
+	uint32_t fraction = (msb >= 16) ? ((r >> (msb - 16)) & 0xFFFF) : ((r << (16 - msb)) & 0xFFFF);
+	uint32_t log2_r = (msb << 16) | fraction;
+
+	// -log2(U) = 32 - log2(r), converted to the natural log
+	uint64_t neg_log2_u = ((uint64_t)32 << 16) - log2_r;
+	uint64_t neg_ln_u = (neg_log2_u * LN2_FIXED) >> 16;
+	uint64_t distance = (((uint64_t)sample_interval_ * neg_ln_u) >> 16) + 1;
+
+	return (distance > (uint64_t)INTPTR_MAX) ? INTPTR_MAX : (intptr_t)distance;
+}
+
+/// Find or create the table entry for a call stack. Returns false if the table is full.
+static bool find_callsite(void* const* frames, size_t frame_cnt, size_t* index)
+{
+	for(size_t i = 0; i < MALLOC_PROFILER_MAX_CALLSITES; i++)
+	{
+		malloc_callsite_t* site = &callsites_[i];
+
+		if(site->frame_cnt == 0)
+		{
+			memcpy(site->frames, frames, frame_cnt * sizeof(void*));
+			site->frame_cnt = frame_cnt;
+			*index = i;
+			return true;
+		}
+
+		if((site->frame_cnt == frame_cnt) &&
+		   (memcmp(site->frames, frames, frame_cnt * sizeof(void*)) == 0))
+		{
+			*index = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static live_sample_t* find_live_sample(const void* ptr)
+{
+	for(size_t i = 0; i < MALLOC_PROFILER_MAX_LIVE_SAMPLES; i++)
+	{
+		if(live_samples_[i].ptr == ptr)
+		{
+			return &live_samples_[i];
+		}
+	}
+
+	return NULL;
+}
+
+#pragma mark - Internal APIs -
+
+bool malloc_profiler_record(void* ptr, size_t size, void* caller)
+{
+	void* frames[MALLOC_PROFILER_MAX_FRAMES];
+	size_t frame_cnt = 0;
+	size_t callsite = 0;
+
+	if(sample_interval_ == 0)
+	{
+		// Disabled - keep the countdown from expiring again
+		malloc_profiler_countdown_ = INTPTR_MAX;
+		return false;
+	}
+
+	malloc_profiler_countdown_ = next_sample_distance();
+
+	if(unwinder_)
+	{
+		frame_cnt = unwinder_(frames, MALLOC_PROFILER_MAX_FRAMES);
+		assert(frame_cnt <= MALLOC_PROFILER_MAX_FRAMES);
+	}
+
+	if(frame_cnt == 0)
+	{
+		frames[0] = caller;
+		frame_cnt = 1;
+	}
+
+	live_sample_t* sample = find_live_sample(NULL);
+
+	if(!sample || !find_callsite(frames, frame_cnt, &callsite))
+	{
+		dropped_samples_++;
+		return false;
+	}
+
+	sample->ptr = ptr;
+	sample->size = size;
+	sample->callsite = callsite;
+
+	callsites_[callsite].live_bytes += size;
+	callsites_[callsite].live_samples++;
+	callsites_[callsite].total_samples++;
+
+	return true;
+}
+
+void malloc_profiler_release(void* ptr)
+{
+	live_sample_t* sample = find_live_sample(ptr);
+
+	// The sample may have been discarded by malloc_profiler_enable()
+	if(sample)
+	{
+		callsites_[sample->callsite].live_bytes -= sample->size;
+		callsites_[sample->callsite].live_samples--;
+		sample->ptr = NULL;
+	}
+}
+
+#pragma mark - APIs -
+
+void malloc_profiler_enable(size_t sample_interval, malloc_unwinder_t unwinder)
+{
+	malloc_lock();
+
+	memset(callsites_, 0, sizeof(callsites_));
+	memset(live_samples_, 0, sizeof(live_samples_));
+	dropped_samples_ = 0;
+
+	sample_interval_ = sample_interval;
+	unwinder_ = unwinder;
+	malloc_profiler_countdown_ = sample_interval ? next_sample_distance() : INTPTR_MAX;
+
+	malloc_unlock();
+}
+
+void malloc_profiler_dump(malloc_profiler_dump_callback_t callback, void* context)
+{
+	assert(callback);
+
+	for(size_t i = 0; i < MALLOC_PROFILER_MAX_CALLSITES; i++)
+	{
+		malloc_callsite_t site;
+
+		// Copy the entry so that the callback can run without the lock held
+		malloc_lock();
+		site = callsites_[i];
+		malloc_unlock();
+
+		if(site.frame_cnt)
+		{
+			callback(&site, context);
+		}
+	}
+}
+
+size_t malloc_profiler_dropped_samples(void)
+{
+	malloc_lock();
+	size_t dropped = dropped_samples_;
+	malloc_unlock();
+
+	return dropped;
+}
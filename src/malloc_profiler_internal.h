@@ -0,0 +1,41 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef MALLOC_PROFILER_INTERNAL_H_
+#define MALLOC_PROFILER_INTERNAL_H_
+
+#include <malloc_profiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Bytes left to allocate before the next sample is taken
+extern intptr_t malloc_profiler_countdown_;
+
+/**
+ * Record a sampled allocation. The caller must hold the malloc lock.
+ *
+ * @returns true if the sample was stored, in which case malloc_profiler_release()
+ *	must be called when `ptr` is freed.
+ */
+bool malloc_profiler_record(void* ptr, size_t size, void* caller);
+
+/**
+ * Remove a sampled allocation from the live data. The caller must hold the malloc lock.
+ */
+void malloc_profiler_release(void* ptr);
+
+/**
+ * Count an allocation against the sampling interval.
+ * This is the only work done for allocations which are not sampled.
+ * The caller must hold the malloc lock.
+ */
+static inline bool malloc_profiler_should_sample(size_t size)
+{
+	malloc_profiler_countdown_ -= (intptr_t)size;
+
+	return malloc_profiler_countdown_ < 0;
+}
+
+#endif // MALLOC_PROFILER_INTERNAL_H_
@@ -5,20 +5,331 @@
 
 #include <assert.h>
 #include <malloc.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <threadx/tx_api.h>
 
+#pragma mark - Definitions -
+
+/**
+ * Your application can define this macro to increase the number of byte pools.
+ * Each call to malloc_addblock() creates a byte pool.
+ */
+#ifndef THREADX_BYTE_POOL_CNT
+#define THREADX_BYTE_POOL_CNT 2
+#endif
+
+/// Byte pool selection policy: use the first pool, in the order they were added, with space
+#define THREADX_POOL_FIRST_FIT 0
+
+/// Byte pool selection policy: search the pools from the first one for requests up to
+/// THREADX_POOL_ROUTE_THRESHOLD bytes, and from the last one for larger requests. Small and
+/// large allocations then tend to be kept in different pools, which limits fragmentation.
+#define THREADX_POOL_SIZE_ROUTED 1
+
+#ifndef THREADX_POOL_POLICY
+#define THREADX_POOL_POLICY THREADX_POOL_FIRST_FIT
+#endif
+
+#ifndef THREADX_POOL_ROUTE_THRESHOLD
+#define THREADX_POOL_ROUTE_THRESHOLD 256
+#endif
+
+/**
+ * Block pool size classes, as an initializer list in ascending order, e.g. `{32, 64, 128, 256}`.
+ *
+ * When defined, a ThreadX block pool is created for each class, and requests which fit in a
+ * class are allocated from its block pool in constant time. Larger requests, and requests made
+ * while the fitting pools are empty, are allocated from the byte pool.
+ *
+ * THREADX_BLOCK_POOL_COUNTS must also be defined, with the number of blocks in each class, e.g.
+ * `{32, 32, 16, 16}`. The block pools are carved out of the first block of memory which is
+ * passed to malloc_addblock().
+ */
+#ifdef THREADX_BLOCK_POOL_SIZES
+#ifndef THREADX_BLOCK_POOL_COUNTS
+#error THREADX_BLOCK_POOL_COUNTS must be defined along with THREADX_BLOCK_POOL_SIZES
+#endif
+
+/// Requested size of each block pool class
+static const ULONG block_pool_sizes_[] = THREADX_BLOCK_POOL_SIZES;
+
+/// Number of blocks in each class
+static const ULONG block_pool_counts_[] = THREADX_BLOCK_POOL_COUNTS;
+
+/// Number of block pool size classes
+#define BLOCK_POOL_CNT (sizeof(block_pool_sizes_) / sizeof(block_pool_sizes_[0]))
+
+_Static_assert(sizeof(block_pool_sizes_) == sizeof(block_pool_counts_),
+			   "Each block pool size needs a count");
+#endif
+
+/**
+ * Blocking requests wait for memory to be released to any pool for up to this many ticks, and
+ * then search all of the pools again. A release normally wakes them sooner, see free().
+ */
+#ifndef THREADX_RELEASE_RETRY_TICKS
+#define THREADX_RELEASE_RETRY_TICKS 10
+#endif
+
+/// Event flag which malloc_addblock() sets once the first byte pool is ready
+#define INIT_EVENT_FLAG ((ULONG)0x1)
+
+/// Event flag which free() sets when memory is released while a request is waiting
+#define RELEASE_EVENT_FLAG ((ULONG)0x2)
+
 #pragma mark - Declarations -
 
-/// ThreadX internal memory pool stucture
-static TX_BYTE_POOL malloc_pool_;
+/// ThreadX internal memory pool stuctures, one per malloc_addblock() call
+static TX_BYTE_POOL malloc_pools_[THREADX_BYTE_POOL_CNT];
+
+/// Address range of each byte pool
+static uintptr_t byte_pool_start_[THREADX_BYTE_POOL_CNT];
+static uintptr_t byte_pool_end_[THREADX_BYTE_POOL_CNT];
+
+/// Current number of byte pools. Stored with release ordering once a pool is set up.
+static _Atomic uint8_t byte_pool_cnt_ = 0;
+
+#ifdef THREADX_BLOCK_POOL_SIZES
+/// ThreadX block pools, one per size class
+static TX_BLOCK_POOL block_pools_[BLOCK_POOL_CNT];
+
+/// Address range of the memory used by each block pool, which free() uses to find the pool
+static uintptr_t block_pool_start_[BLOCK_POOL_CNT];
+static uintptr_t block_pool_end_[BLOCK_POOL_CNT];
+#endif
 
 /**
  * Flag that is used in malloc() to cause competing threads to wait until
- * initialization is completed before allocating memory.
+ * initialization is completed before allocating memory. It is stored with release
+ * ordering, so a thread which loads it with acquire ordering also sees the byte pool.
+ */
+static atomic_bool initialized_ = false;
+
+/// Event flags group which threads block on until initialization is completed, or until
+/// memory is released
+static TX_EVENT_FLAGS_GROUP heap_events_;
+
+/// Set once the event flags group is created. Stored with release ordering.
+static atomic_bool heap_events_created_ = false;
+
+/// Number of requests which are waiting for memory to be released
+static atomic_uint release_waiters_ = 0;
+
+#pragma mark - Private Functions -
+
+#ifdef THREADX_BLOCK_POOL_SIZES
+/**
+ * Carve the block pools out of the byte pool. ThreadX stores a pointer in front of each
+ * block, and rounds block sizes up to a multiple of a pointer.
+ */
+static void create_block_pools(void)
+{
+	for(size_t i = 0; i < BLOCK_POOL_CNT; i++)
+	{
+		assert(((i == 0) || (block_pool_sizes_[i - 1] < block_pool_sizes_[i])) &&
+			   "Block pool sizes must be in ascending order");
+
+		ULONG block_size = (block_pool_sizes_[i] + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+		ULONG pool_size = (block_size + sizeof(void*)) * block_pool_counts_[i];
+		void* memory = NULL;
+
+		unsigned return_code =
+			tx_byte_allocate(&malloc_pools_[0], &memory, pool_size, TX_NO_WAIT);
+		assert(return_code == TX_SUCCESS && "Not enough memory for the block pools");
+
+		if(return_code == TX_SUCCESS)
+		{
+			return_code = tx_block_pool_create(&block_pools_[i], "Heap Block Pool", block_size,
+											   memory, pool_size);
+			assert(return_code == TX_SUCCESS);
+
+			block_pool_start_[i] = (uintptr_t)memory;
+			block_pool_end_[i] = (uintptr_t)memory + pool_size;
+		}
+	}
+}
+#endif
+
+/**
+ * Get the heap event flags group. The group is created by the first caller, since threads may
+ * start waiting for memory before malloc_addblock() is called.
+ *
+ * Interrupts are disabled while the group is created, so a thread never has to wait for
+ * another thread to finish creating it. Creating the group does not block.
+ */
+static TX_EVENT_FLAGS_GROUP* heap_events(void)
+{
+	if(!atomic_load_explicit(&heap_events_created_, memory_order_acquire))
+	{
+		UINT posture = tx_interrupt_control(TX_INT_DISABLE);
+
+		if(!atomic_load_explicit(&heap_events_created_, memory_order_relaxed))
+		{
+			unsigned return_code = tx_event_flags_create(&heap_events_, "Heap Events");
+			assert(return_code == TX_SUCCESS);
+			(void)return_code;
+
+			atomic_store_explicit(&heap_events_created_, true, memory_order_release);
+		}
+
+		(void)tx_interrupt_control(posture);
+	}
+
+	return &heap_events_;
+}
+
+/**
+ * Block until malloc_addblock() has created the first byte pool, for up to `wait_option` ticks.
+ *
+ * @returns true if the heap is initialized.
+ */
+static bool wait_for_init(ULONG wait_option)
+{
+	if(atomic_load_explicit(&initialized_, memory_order_acquire))
+	{
+		return true;
+	}
+
+	if(wait_option != TX_NO_WAIT)
+	{
+		ULONG actual_flags = 0;
+
+		// The flag is never cleared, so threads which start waiting after it is set don't block
+		(void)tx_event_flags_get(heap_events(), INIT_EVENT_FLAG, TX_OR, &actual_flags,
+								 wait_option);
+	}
+
+	return atomic_load_explicit(&initialized_, memory_order_acquire);
+}
+
+/// Check whether a pointer is in the memory managed by one of the byte pools
+static inline bool in_byte_pool(const void* ptr)
+{
+	size_t cnt = atomic_load_explicit(&byte_pool_cnt_, memory_order_acquire);
+
+	for(size_t i = 0; i < cnt; i++)
+	{
+		if(((uintptr_t)ptr >= byte_pool_start_[i]) && ((uintptr_t)ptr < byte_pool_end_[i]))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// Allocate memory from the byte pools without waiting, following THREADX_POOL_POLICY
+static void* byte_pool_allocate(size_t size)
+{
+	void* ptr = NULL;
+	size_t cnt = atomic_load_explicit(&byte_pool_cnt_, memory_order_acquire);
+	bool from_last =
+		(THREADX_POOL_POLICY == THREADX_POOL_SIZE_ROUTED) && (size > THREADX_POOL_ROUTE_THRESHOLD);
+
+	for(size_t n = 0; (n < cnt) && !ptr; n++)
+	{
+		size_t i = from_last ? (cnt - 1 - n) : n;
+
+		// Skip pools which cannot have enough space, without taking their mutex
+		if(malloc_pools_[i].tx_byte_pool_available >= size)
+		{
+			(void)tx_byte_allocate(&malloc_pools_[i], &ptr, size, TX_NO_WAIT);
+		}
+	}
+
+	return ptr;
+}
+
+/// Allocate from the block pools or the byte pools without waiting
+static void* try_allocate(size_t size)
+{
+	void* ptr = NULL;
+
+#ifdef THREADX_BLOCK_POOL_SIZES
+	// Small requests are served by the smallest block pool with a free block
+	for(size_t i = 0; (i < BLOCK_POOL_CNT) && !ptr; i++)
+	{
+		if((size <= block_pool_sizes_[i]) && block_pool_end_[i])
+		{
+			(void)tx_block_allocate(&block_pools_[i], &ptr, TX_NO_WAIT);
+		}
+	}
+#endif
+
+	return ptr ? ptr : byte_pool_allocate(size);
+}
+
+/**
+ * Wait for up to `wait_option` ticks until memory which satisfies the request is released to
+ * any of the pools.
+ *
+ * Waiting in tx_byte_allocate() would only see memory which is released to a single pool.
+ * Instead, free() sets RELEASE_EVENT_FLAG while requests are waiting, and every pool is searched
+ * again. The flag is cleared before each search, so a release which happens during the search
+ * ends the next wait. Another waiter can clear the flag first, so the waits are also bounded by
+ * THREADX_RELEASE_RETRY_TICKS.
  */
-static volatile bool initialized_ = false;
+static void* wait_allocate(size_t size, ULONG wait_option)
+{
+	TX_EVENT_FLAGS_GROUP* events = heap_events();
+	ULONG start = tx_time_get();
+	void* ptr = NULL;
+
+	// Sequentially consistent, so either the search below sees a concurrent release, or that
+	// free() sees the waiter and sets the flag
+	atomic_fetch_add(&release_waiters_, 1);
+
+	for(;;)
+	{
+		(void)tx_event_flags_set(events, ~RELEASE_EVENT_FLAG, TX_AND);
+
+		ptr = try_allocate(size);
+
+		ULONG wait = THREADX_RELEASE_RETRY_TICKS;
+
+		if(!ptr && (wait_option != TX_WAIT_FOREVER))
+		{
+			ULONG elapsed = tx_time_get() - start;
+			wait = (elapsed < wait_option) ? (wait_option - elapsed) : TX_NO_WAIT;
+			wait = (wait < THREADX_RELEASE_RETRY_TICKS) ? wait : THREADX_RELEASE_RETRY_TICKS;
+		}
+
+		if(ptr || (wait == TX_NO_WAIT))
+		{
+			break;
+		}
+
+		ULONG actual_flags = 0;
+		(void)tx_event_flags_get(events, RELEASE_EVENT_FLAG, TX_OR, &actual_flags, wait);
+	}
+
+	atomic_fetch_sub(&release_waiters_, 1);
+
+	return ptr;
+}
+
+/// Allocate from the block pools or the byte pools. The heap must be initialized.
+static void* do_malloc(size_t size, ULONG wait_option)
+{
+	void* ptr = NULL;
+
+	if(size > 0)
+	{
+		ptr = try_allocate(size);
+
+		if(!ptr && (wait_option != TX_NO_WAIT))
+		{
+			ptr = wait_allocate(size, wait_option);
+
+			// I add the string to provide a more helpful error output.  It's value is always true.
+			assert((ptr || (wait_option != TX_WAIT_FOREVER)) && "malloc failed");
+		}
+	} // else NULL if there was an error
+
+	return ptr;
+}
 
 #pragma mark - APIs -
 
@@ -36,53 +347,120 @@ __attribute__((weak)) void malloc_init(void)
 void malloc_addblock(void* addr, size_t size)
 {
 	assert(addr && (size > 0));
+	assert((byte_pool_cnt_ < THREADX_BYTE_POOL_CNT) && "Too many heap regions!");
+
+	uint8_t cnt = byte_pool_cnt_;
+
+	if(cnt >= THREADX_BYTE_POOL_CNT)
+	{
+		return;
+	}
 
 	/*
 	 * tx_byte_pool_create is ThreadX's API to create a byte pool using a memory block.
 	 * We are essentially just wrapping ThreadX APIs into a simpler form
 	 */
-	unsigned return_code = tx_byte_pool_create(&malloc_pool_, "Heap Memory Pool", addr, size);
+	unsigned return_code = tx_byte_pool_create(&malloc_pools_[cnt], "Heap Memory Pool", addr, size);
 	assert(return_code == TX_SUCCESS);
+	(void)return_code;
 
-	// Signal to any threads waiting on do_malloc that we are done
-	initialized_ = true;
+	byte_pool_start_[cnt] = (uintptr_t)addr;
+	byte_pool_end_[cnt] = (uintptr_t)addr + size;
+
+	// The pool is only used by malloc() once it is fully set up
+	atomic_store_explicit(&byte_pool_cnt_, (uint8_t)(cnt + 1), memory_order_release);
+
+	if(cnt == 0)
+	{
+#ifdef THREADX_BLOCK_POOL_SIZES
+		create_block_pools();
+#endif
+
+		// Signal to any threads waiting on do_malloc that we are done
+		atomic_store_explicit(&initialized_, true, memory_order_release);
+
+		unsigned set_code = tx_event_flags_set(heap_events(), INIT_EVENT_FLAG, TX_OR);
+		assert(set_code == TX_SUCCESS);
+		(void)set_code;
+	}
 }
 
 void* malloc(size_t size)
 {
-	void* ptr = NULL;
-
 	/**
 	 * In the ThreadX implementaiton, we make sure the ThreadX pool has been
 	 * created before we try to allocate memory, or there will be an error.
-	 * We sleep our threads until memory has been added.
+	 * Threads block on an event flag until memory has been added. The wait can end early if
+	 * it is aborted, so keep waiting until the pool is ready.
 	 */
-	while(!initialized_)
+	while(!wait_for_init(TX_WAIT_FOREVER))
 	{
-		tx_thread_sleep(1);
 	}
 
-	if(size > 0)
+	return do_malloc(size, TX_WAIT_FOREVER);
+}
+
+void* malloc_try(size_t size)
+{
+	return wait_for_init(TX_NO_WAIT) ? do_malloc(size, TX_NO_WAIT) : NULL;
+}
+
+void* malloc_timed(size_t size, uint32_t timeout_ticks)
+{
+	ULONG wait_option = (timeout_ticks == MALLOC_WAIT_FOREVER) ? TX_WAIT_FOREVER : timeout_ticks;
+	ULONG start = tx_time_get();
+
+	if(!wait_for_init(wait_option))
 	{
-		// We simply wrap the threadX call into a standard form
-		unsigned return_code = tx_byte_allocate(&malloc_pool_, &ptr, size, TX_WAIT_FOREVER);
+		return NULL;
+	}
 
-		// I add the string to provide a more helpful error output.  It's value is always true.
-		assert(return_code == TX_SUCCESS && "malloc failed");
-	} // else NULL if there was an error
+	// Initialization counts against the timeout
+	if((wait_option != TX_WAIT_FOREVER) && (wait_option != TX_NO_WAIT))
+	{
+		ULONG elapsed = tx_time_get() - start;
+		wait_option = (elapsed < wait_option) ? (wait_option - elapsed) : TX_NO_WAIT;
+	}
 
-	return ptr;
+	return do_malloc(size, wait_option);
 }
 
 void free(void* ptr)
 {
-	/// free should NEVER be called before malloc is init'd
-	assert(initialized_);
-
 	if(ptr)
 	{
-		// We simply wrap the threadX call into a standard form
-		unsigned return_code = tx_byte_release(ptr);
+		/// free should NEVER be called with memory before malloc is init'd. free(NULL) is fine.
+		assert(atomic_load_explicit(&initialized_, memory_order_acquire));
+
+		unsigned return_code = TX_SUCCESS;
+		bool released = false;
+
+#ifdef THREADX_BLOCK_POOL_SIZES
+		// Blocks are returned to the pool whose memory contains them
+		for(size_t i = 0; (i < BLOCK_POOL_CNT) && !released; i++)
+		{
+			if(((uintptr_t)ptr >= block_pool_start_[i]) && ((uintptr_t)ptr < block_pool_end_[i]))
+			{
+				return_code = tx_block_release(ptr);
+				released = true;
+			}
+		}
+#endif
+
+		if(!released)
+		{
+			// ThreadX finds the owning byte pool through the block header
+			assert(in_byte_pool(ptr) && "free() called with a pointer which was not allocated");
+			return_code = tx_byte_release(ptr);
+		}
+
 		assert(return_code == TX_SUCCESS);
+		(void)return_code;
+
+		// Wake the requests which are waiting for memory, whichever pool it was released to
+		if(atomic_load(&release_waiters_) > 0)
+		{
+			(void)tx_event_flags_set(heap_events(), RELEASE_EVENT_FLAG, TX_OR);
+		}
 	}
 }
@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This program runs the same allocation workloads against whichever implementation it is
+ * linked with, so the freelist and the RTOS backends (on the host stand-in kernels in
+ * test/support) can be compared on the build machine.
+ *
+ * BENCHMARK_BACKEND names the implementation in the output.
+ */
+
+// Needed for clock_gettime() in strict C11 mode
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <support/memory.h>
+#include <time.h>
+
+#pragma mark - Definitions -
+
+#ifndef BENCHMARK_BACKEND
+#define BENCHMARK_BACKEND "libmemory"
+#endif
+
+#define FIXED_ITERATIONS 1000000
+#define FIXED_SIZE 64
+
+/// The mixed workload replaces a random live allocation with one of a random size
+#define MIXED_ITERATIONS 1000000
+#define MIXED_SLOTS 256
+#define MIXED_MAX_SIZE 1024
+
+#define THREAD_CNT 4
+#define THREAD_ITERATIONS 250000
+#define THREAD_SLOTS 64
+#define THREAD_MAX_SIZE 512
+
+#pragma mark - Declarations -
+
+/// Serializes the freelist. The RTOS backends lock internally, and don't call these.
+static pthread_mutex_t malloc_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+#pragma mark - Private Functions -
+
+void malloc_lock(void)
+{
+	pthread_mutex_lock(&malloc_mutex_);
+}
+
+void malloc_unlock(void)
+{
+	pthread_mutex_unlock(&malloc_mutex_);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+}
+
+/// xorshift32, so each run uses the same sequence of requests
+static inline uint32_t next_random(uint32_t* state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static void report(const char* workload, uint64_t ops, uint64_t elapsed_ns)
+{
+	printf("%s %-8s %10" PRIu64 " ops %8.1f ns/op\n", BENCHMARK_BACKEND, workload, ops,
+		   (double)elapsed_ns / (double)ops);
+}
+
+/// Allocate and immediately release the same size, which is the best case for every allocator
+static void fixed_workload(void)
+{
+	uint64_t start = now_ns();
+
+	for(size_t i = 0; i < FIXED_ITERATIONS; i++)
+	{
+		void* ptr = malloc(FIXED_SIZE);
+		*(volatile uint8_t*)ptr = (uint8_t)i;
+		free(ptr);
+	}
+
+	report("fixed", 2 * FIXED_ITERATIONS, now_ns() - start);
+}
+
+/// Replace random slots with random sizes, which fragments the heap
+static uint64_t mixed_run(uint32_t seed, size_t iterations, void** slots, size_t slot_cnt,
+						  size_t max_size)
+{
+	uint32_t state = seed;
+	uint64_t ops = 0;
+
+	for(size_t i = 0; i < iterations; i++)
+	{
+		size_t slot = next_random(&state) % slot_cnt;
+
+		if(slots[slot])
+		{
+			free(slots[slot]);
+			ops++;
+		}
+
+		slots[slot] = malloc(1 + (next_random(&state) % max_size));
+		ops++;
+	}
+
+	for(size_t i = 0; i < slot_cnt; i++)
+	{
+		free(slots[i]);
+		slots[i] = NULL;
+	}
+
+	return ops + slot_cnt;
+}
+
+static void mixed_workload(void)
+{
+	static void* slots[MIXED_SLOTS];
+
+	uint64_t start = now_ns();
+	uint64_t ops = mixed_run(0x12345678, MIXED_ITERATIONS, slots, MIXED_SLOTS, MIXED_MAX_SIZE);
+
+	report("mixed", ops, now_ns() - start);
+}
+
+static void* thread_workload(void* arg)
+{
+	void* slots[THREAD_SLOTS] = {NULL};
+	uint64_t* ops = arg;
+
+	*ops = mixed_run((uint32_t)(uintptr_t)ops, THREAD_ITERATIONS, slots, THREAD_SLOTS,
+					 THREAD_MAX_SIZE);
+
+	return NULL;
+}
+
+/// The mixed workload on several threads at once, which measures lock contention
+static void threaded_workload(void)
+{
+	pthread_t threads[THREAD_CNT];
+	uint64_t thread_ops[THREAD_CNT];
+	uint64_t ops = 0;
+
+	uint64_t start = now_ns();
+
+	for(size_t i = 0; i < THREAD_CNT; i++)
+	{
+		pthread_create(&threads[i], NULL, thread_workload, &thread_ops[i]);
+	}
+
+	for(size_t i = 0; i < THREAD_CNT; i++)
+	{
+		pthread_join(threads[i], NULL);
+		ops += thread_ops[i];
+	}
+
+	report("threaded", ops, now_ns() - start);
+}
+
+#pragma mark - Main -
+
+int main(void)
+{
+	allocate_memory();
+
+	// The FreeRTOS backend defines the heap regions which were added
+	malloc_init();
+
+	fixed_workload();
+	mixed_workload();
+	threaded_workload();
+
+	return 0;
+}
@@ -32,5 +32,40 @@ int main(void)
 
 	overall_result |= aligned_malloc_tests();
 
+	overall_result |= arena_tests();
+
+	overall_result |= malloc_instrumentation_tests();
+
+	overall_result |= malloc_region_tests();
+
+	overall_result |= malloc_removeblock_tests();
+
+	overall_result |= malloc_morecore_tests();
+
+	overall_result |= malloc_profiler_tests();
+
+	overall_result |= malloc_deferred_free_tests();
+
+	overall_result |= malloc_size_index_tests();
+
+	overall_result |= malloc_heap_tests();
+
+	overall_result |= malloc_heap_policy_tests();
+
+	overall_result |= malloc_new_delete_tests();
+
+	overall_result |= malloc_memory_resource_tests();
+
+	overall_result |= malloc_remote_free_tests();
+
+	overall_result |= malloc_isr_free_tests();
+
+	overall_result |= malloc_stats_tests();
+
+	overall_result |= malloc_timed_tests();
+
+	// Reserved pools are kept for the rest of the run, so this runs last
+	overall_result |= malloc_isr_pool_tests();
+
 	return overall_result;
 }
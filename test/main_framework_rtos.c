@@ -0,0 +1,36 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This test program is linked against the framework RTOS adapter and the os::Heap
+ * stand-in in support/framework_heap. Each build provides a different set of os::Heap members.
+ */
+
+#include <malloc.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+int main(void)
+{
+	int overall_result = 0;
+
+	// Generate JUnit results
+	cmocka_set_message_output(CM_OUTPUT_XML);
+
+	allocate_memory();
+	malloc_init();
+
+	overall_result |= malloc_framework_rtos_tests();
+
+	return overall_result;
+}
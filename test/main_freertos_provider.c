@@ -0,0 +1,34 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This test program is linked against the freelist FreeRTOS heap provider, and the
+ * FreeRTOS kernel stand-in in support/, without its heap.
+ */
+
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+int main(void)
+{
+	int overall_result = 0;
+
+	// Generate JUnit results
+	cmocka_set_message_output(CM_OUTPUT_XML);
+
+	allocate_memory();
+
+	overall_result |= malloc_freertos_provider_tests();
+
+	return overall_result;
+}
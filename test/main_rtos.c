@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This test program is linked against an RTOS backend and the matching host stand-in
+ * kernel in support/. The ThreadX builds define MALLOC_TEST_THREADX, and also run the
+ * ThreadX-specific tests.
+ */
+
+#include <malloc.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define INIT_TIMEOUT_TICKS 5
+
+int main(void)
+{
+	int overall_result = 0;
+
+	// Generate JUnit results
+	cmocka_set_message_output(CM_OUTPUT_XML);
+
+	/*
+	 * Until the heap is initialized, malloc() blocks, and so would cmocka. Requests which
+	 * can't wait fail instead, which is checked before any tests are run.
+	 */
+	if(malloc_try(16) || malloc_timed(16, INIT_TIMEOUT_TICKS))
+	{
+		overall_result = 1;
+	}
+
+	allocate_memory();
+
+	// The FreeRTOS backend defines the heap regions which were added
+	malloc_init();
+
+	overall_result |= malloc_rtos_tests();
+	overall_result |= aligned_malloc_tests();
+
+#ifdef MALLOC_TEST_THREADX
+	// Tests of the ThreadX pool handling, which can change the heap layout
+	overall_result |= malloc_threadx_tests();
+#endif
+
+	return overall_result;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <arena.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define CHUNK_SIZE 256
+
+static void arena_alloc_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	assert_null(arena_create(0));
+
+	arena_t* arena = arena_create(CHUNK_SIZE);
+	assert_non_null(arena);
+	assert_int_equal(arena_used(arena), 0);
+	assert_null(arena_alloc(arena, 0, 0));
+
+	// Allocations are packed together, with no header in between
+	char* first = arena_alloc(arena, 16, 0);
+	char* second = arena_alloc(arena, 16, 0);
+	assert_non_null(first);
+	assert_ptr_equal(second, first + 16);
+	assert_int_equal(arena_used(arena), 32);
+
+	// The minimum alignment is sizeof(void*)
+	char* odd = arena_alloc(arena, 1, 1);
+	char* after_odd = arena_alloc(arena, 1, 1);
+	assert_ptr_equal(after_odd, odd + sizeof(void*));
+
+	for(size_t align = 8; align <= 128; align *= 2)
+	{
+		void* ptr = arena_alloc(arena, 3, align);
+		assert_non_null(ptr);
+		assert_false(((uintptr_t)ptr) & (align - 1));
+	}
+
+	// Reset rewinds to the start of the first chunk
+	arena_reset(arena);
+	assert_int_equal(arena_used(arena), 0);
+	assert_ptr_equal(arena_alloc(arena, 16, 0), first);
+
+	arena_destroy(arena);
+	arena_destroy(NULL);
+}
+
+static void arena_overflow_test(void** __attribute__((unused)) state)
+{
+	malloc_stats_t before;
+	malloc_stats_t after;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// Sizes which wrap around with the headers are rejected without allocating
+	malloc_get_stats(&before);
+	assert_null(arena_create(SIZE_MAX));
+	assert_null(arena_create(SIZE_MAX - 8));
+	assert_null(arena_create(SIZE_MAX - sizeof(void*) - 16));
+
+	arena_t* arena = arena_create(CHUNK_SIZE);
+	assert_non_null(arena);
+
+	// Requests which wrap around, even before a chunk header is added, do not add chunks
+	assert_null(arena_alloc(arena, SIZE_MAX, 8));
+	assert_null(arena_alloc(arena, SIZE_MAX - 8, 16));
+	assert_null(arena_alloc(arena, SIZE_MAX - 64, 8));
+	assert_null(arena_alloc(arena, 16, ((size_t)1) << ((sizeof(size_t) * 8) - 1)));
+	assert_int_equal(arena_used(arena), 0);
+
+	// Only the arena itself was allocated
+	malloc_get_stats(&after);
+	assert_int_equal(after.allocations - after.frees, (before.allocations - before.frees) + 1);
+
+	assert_non_null(arena_alloc(arena, 16, 0));
+	arena_destroy(arena);
+}
+
+static void arena_chunk_test(void** __attribute__((unused)) state)
+{
+	char* first_round[8];
+
+	arena_t* arena = arena_create(CHUNK_SIZE);
+	assert_non_null(arena);
+
+	// Full chunks are chained to new ones
+	for(size_t i = 0; i < 8; i++)
+	{
+		first_round[i] = arena_alloc(arena, CHUNK_SIZE / 2, 0);
+		assert_non_null(first_round[i]);
+		memset(first_round[i], (int)i, CHUNK_SIZE / 2);
+	}
+
+	assert_int_equal(arena_used(arena), 4 * CHUNK_SIZE);
+
+	for(size_t i = 0; i < 8; i++)
+	{
+		assert_int_equal(first_round[i][0], (char)i);
+		assert_int_equal(first_round[i][(CHUNK_SIZE / 2) - 1], (char)i);
+	}
+
+	// Requests larger than a chunk get a chunk of their own
+	char* large = arena_alloc(arena, 4 * CHUNK_SIZE, 64);
+	assert_non_null(large);
+	assert_false(((uintptr_t)large) & 63);
+
+	// After a reset, the chained chunks are reused in the same order
+	arena_reset(arena);
+
+	for(size_t i = 0; i < 8; i++)
+	{
+		assert_ptr_equal(arena_alloc(arena, CHUNK_SIZE / 2, 0), first_round[i]);
+	}
+
+	// Requests which can't be satisfied by the heap fail cleanly
+	assert_null(arena_alloc(arena, 2 * block_size(), 0));
+
+	arena_destroy(arena);
+
+	// All of the chunks were returned to the heap
+	void* ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+}
+
+static void arena_buffer_test(void** __attribute__((unused)) state)
+{
+	static uint8_t buffer[512] __attribute__((aligned(16)));
+
+	assert_null(arena_create_from_buffer(buffer, 4));
+
+	arena_t* arena = arena_create_from_buffer(buffer, sizeof(buffer));
+	assert_non_null(arena);
+
+	char* ptr = arena_alloc(arena, 64, 0);
+	assert_true(((uintptr_t)ptr > (uintptr_t)buffer) &&
+				(((uintptr_t)ptr + 64) <= ((uintptr_t)buffer + sizeof(buffer))));
+
+	// Buffer arenas don't grow
+	assert_null(arena_alloc(arena, sizeof(buffer), 0));
+
+	size_t count = 1;
+
+	while(arena_alloc(arena, 64, 0))
+	{
+		count++;
+	}
+
+	assert_true(count >= 6);
+	assert_true(arena_used(arena) <= sizeof(buffer));
+
+	arena_reset(arena);
+	assert_ptr_equal(arena_alloc(arena, 64, 0), ptr);
+
+	arena_destroy(arena);
+}
+
+int arena_tests(void)
+{
+	const struct CMUnitTest arena_test_suite[] = {cmocka_unit_test(arena_alloc_test),
+												  cmocka_unit_test(arena_overflow_test),
+												  cmocka_unit_test(arena_chunk_test),
+												  cmocka_unit_test(arena_buffer_test)};
+
+	return cmocka_run_group_tests(arena_test_suite, NULL, NULL);
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+// Matches the default in malloc_bitmap.c
+#define GRANULE_SIZE 16
+
+#define ALLOCATION_TEST_COUNT 768
+#define SECOND_HEAP_SIZE 4096
+
+static void* pointer_array[ALLOCATION_TEST_COUNT];
+static uint8_t second_heap[SECOND_HEAP_SIZE];
+
+static bool in_block(const void* ptr)
+{
+	return ((uintptr_t)ptr >= block_start_addr()) && ((uintptr_t)ptr < block_end_addr());
+}
+
+static void malloc_bitmap_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	assert_null(malloc(0));
+	assert_null(malloc(2 * block_size()));
+
+	void* ptr = malloc(1);
+	assert_non_null(ptr);
+	assert_true(in_block(ptr));
+	assert_false((uintptr_t)ptr & (GRANULE_SIZE - 1));
+	assert_int_equal(malloc_usable_size(ptr), GRANULE_SIZE);
+	free(ptr);
+
+	ptr = malloc(GRANULE_SIZE + 1);
+	assert_int_equal(malloc_usable_size(ptr), 2 * GRANULE_SIZE);
+	free(ptr);
+
+	assert_int_equal(malloc_usable_size(NULL), 0);
+
+	for(size_t i = 0; i < ALLOCATION_TEST_COUNT; i++)
+	{
+		pointer_array[i] = malloc(1024);
+		assert_non_null(pointer_array[i]);
+		assert_true(in_block(pointer_array[i]));
+	}
+
+	for(size_t i = 0; i < ALLOCATION_TEST_COUNT; i++)
+	{
+		free(pointer_array[i]);
+	}
+
+	// All of the memory was returned
+	ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+}
+
+static void malloc_bitmap_run_test(void** __attribute__((unused)) state)
+{
+	// Fill most of the first bitmap word with single granules
+	for(size_t i = 0; i < 30; i++)
+	{
+		pointer_array[i] = malloc(GRANULE_SIZE);
+		assert_non_null(pointer_array[i]);
+
+		if(i > 0)
+		{
+			assert_int_equal((uintptr_t)pointer_array[i] - (uintptr_t)pointer_array[i - 1],
+							 GRANULE_SIZE);
+		}
+	}
+
+	// A run can cross a bitmap word boundary
+	void* spanning = malloc(3 * GRANULE_SIZE);
+	assert_int_equal((uintptr_t)spanning, (uintptr_t)pointer_array[29] + GRANULE_SIZE);
+	assert_int_equal(malloc_usable_size(spanning), 3 * GRANULE_SIZE);
+
+	// Single-granule holes are too small for a two-granule request
+	for(size_t i = 0; i < 30; i += 2)
+	{
+		free(pointer_array[i]);
+	}
+
+	void* pair = malloc(2 * GRANULE_SIZE);
+	assert_true((uintptr_t)pair > (uintptr_t)spanning);
+	free(pair);
+
+	// Freeing a neighbor makes room
+	free(pointer_array[1]);
+	pair = malloc(2 * GRANULE_SIZE);
+	assert_ptr_equal(pair, pointer_array[0]);
+	free(pair);
+
+	for(size_t i = 3; i < 30; i += 2)
+	{
+		free(pointer_array[i]);
+	}
+
+	free(spanning);
+
+	// Fully allocated bitmap words are skipped to find a hole
+	for(size_t i = 0; i < 64; i++)
+	{
+		pointer_array[i] = malloc(4096);
+		assert_non_null(pointer_array[i]);
+	}
+
+	free(pointer_array[50]);
+	void* hole = malloc(4096);
+	assert_ptr_equal(hole, pointer_array[50]);
+
+	for(size_t i = 0; i < 64; i++)
+	{
+		free(pointer_array[i]);
+	}
+}
+
+static void malloc_bitmap_heaps_test(void** __attribute__((unused)) state)
+{
+	size_t filler_cnt = 0;
+
+	// Fill the test block completely: every remaining run is smaller than the next request
+	for(size_t size = block_size(); size >= GRANULE_SIZE; size /= 2)
+	{
+		void* ptr = malloc(size);
+
+		if(ptr)
+		{
+			pointer_array[filler_cnt++] = ptr;
+		}
+	}
+
+	assert_null(malloc(1));
+
+	// Additional blocks are used once the first one is full
+	malloc_addblock(second_heap, sizeof(second_heap));
+
+	void* ptr = malloc(64);
+	assert_non_null(ptr);
+	assert_true(((uintptr_t)ptr >= (uintptr_t)second_heap) &&
+				((uintptr_t)ptr < ((uintptr_t)second_heap + sizeof(second_heap))));
+
+	// The bitmaps are stored at the start of the block
+	assert_null(malloc(SECOND_HEAP_SIZE));
+
+	free(ptr);
+
+	for(size_t i = 0; i < filler_cnt; i++)
+	{
+		free(pointer_array[i]);
+	}
+
+	// The first block is preferred again
+	ptr = malloc(64);
+	assert_true(in_block(ptr));
+	free(ptr);
+}
+
+static void malloc_bitmap_overflow_test(void** __attribute__((unused)) state)
+{
+	// Sizes which would wrap around when rounded up to granules are rejected
+	for(size_t delta = 0; delta < (2 * GRANULE_SIZE); delta++)
+	{
+		volatile size_t size = SIZE_MAX - delta;
+		assert_null(malloc(size));
+	}
+
+	// No bits were set by the rejected requests
+	void* ptr = malloc(block_size() / 2);
+	assert_true(in_block(ptr));
+	free(ptr);
+}
+
+int malloc_bitmap_tests(void)
+{
+	const struct CMUnitTest malloc_bitmap_test_suite[] = {
+		cmocka_unit_test(malloc_bitmap_test), cmocka_unit_test(malloc_bitmap_run_test),
+		cmocka_unit_test(malloc_bitmap_heaps_test), cmocka_unit_test(malloc_bitmap_overflow_test)};
+
+	return cmocka_run_group_tests(malloc_bitmap_test_suite, NULL, NULL);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+// Matches the default in malloc_freelist.c. The deferred free test build overrides this.
+#ifndef FREELIST_DEFERRED_FREE_SLOTS
+#define FREELIST_DEFERRED_FREE_SLOTS 0
+#endif
+
+#define BLOCK_COUNT (FREELIST_DEFERRED_FREE_SLOTS + 4)
+
+static void malloc_deferred_free_test(void** __attribute__((unused)) state)
+{
+#if FREELIST_DEFERRED_FREE_SLOTS >= 2
+	void* blocks[BLOCK_COUNT];
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	for(int i = 0; i < BLOCK_COUNT; i++)
+	{
+		blocks[i] = malloc(64);
+		assert_non_null(blocks[i]);
+	}
+
+	// Adjacent blocks are not coalesced, so the most recently freed block is reused
+	free(blocks[0]);
+	free(blocks[1]);
+	void* ptr = malloc(64);
+	assert_ptr_equal(ptr, blocks[1]);
+
+	// A close fit is reused without splitting the block
+	void* smaller = malloc(40);
+	assert_ptr_equal(smaller, blocks[0]);
+	assert_int_equal(malloc_usable_size(smaller), 64);
+
+	free(smaller);
+	free(ptr);
+
+	// Filling the buffer merges it back into the free list
+	for(int i = 2; i < BLOCK_COUNT; i++)
+	{
+		free(blocks[i]);
+	}
+
+	// A request which misses the buffer still sees all of the freed memory
+	ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+
+	ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+#else
+	skip();
+#endif
+}
+
+int malloc_deferred_free_tests(void)
+{
+	const struct CMUnitTest malloc_deferred_free_test_suite[] = {
+		cmocka_unit_test(malloc_deferred_free_test)};
+
+	return cmocka_run_group_tests(malloc_deferred_free_test_suite, NULL, NULL);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <heap.hpp>
+#include <malloc.h>
+#include <malloc_profiler.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+using os::Heap;
+
+static bool aligned(const void* ptr, size_t alignment)
+{
+	return (((uintptr_t)ptr) & (alignment - 1)) == 0;
+}
+
+static void malloc_framework_rtos_alloc_test([[maybe_unused]] void** state)
+{
+	// malloc() and free() map to the baseline members
+	Heap::Calls before = Heap::calls;
+	void* ptr = malloc(32);
+	assert_non_null(ptr);
+	assert_int_equal(Heap::calls.alloc, before.alloc + 1);
+	free(ptr);
+	assert_int_equal(Heap::calls.free, before.free + 1);
+
+	// The allocation wrappers' entry point also maps to alloc()
+	before = Heap::calls;
+	ptr = malloc_for_caller(32, nullptr);
+	assert_non_null(ptr);
+	assert_int_equal(Heap::calls.alloc, before.alloc + 1);
+	free(ptr);
+
+	// Alignments which alloc() provides are served with or without allocAligned()
+	before = Heap::calls;
+	ptr = malloc_aligned(alignof(std::max_align_t), 32);
+	assert_true(aligned(ptr, alignof(std::max_align_t)));
+
+	if(MOCK_HEAP_MEMBERS >= MOCK_HEAP_FULL)
+	{
+		assert_int_equal(Heap::calls.alloc_aligned, before.alloc_aligned + 1);
+	}
+	else
+	{
+		assert_int_equal(Heap::calls.alloc, before.alloc + 1);
+	}
+
+	free_aligned_sized(ptr, alignof(std::max_align_t), 32);
+
+	// Stricter alignments need allocAligned()
+	ptr = malloc_aligned(256, 32);
+
+	if(MOCK_HEAP_MEMBERS >= MOCK_HEAP_FULL)
+	{
+		assert_non_null(ptr);
+		assert_true(aligned(ptr, 256));
+		free(ptr);
+	}
+	else
+	{
+		assert_null(ptr);
+	}
+
+	// Sized frees use the sized free() when the heap has one
+	ptr = malloc(48);
+	before = Heap::calls;
+	free_sized(ptr, 48);
+
+	if(MOCK_HEAP_MEMBERS >= MOCK_HEAP_FULL)
+	{
+		assert_int_equal(Heap::calls.free_sized, before.free_sized + 1);
+		assert_int_equal(Heap::calls.last_free_size, 48);
+		assert_int_equal(Heap::calls.free, before.free);
+	}
+	else
+	{
+		assert_int_equal(Heap::calls.free, before.free + 1);
+	}
+}
+
+static void malloc_framework_rtos_realloc_test([[maybe_unused]] void** state)
+{
+#if MOCK_HEAP_MEMBERS >= MOCK_HEAP_USABLE_SIZE
+	char* ptr = static_cast<char*>(malloc(32));
+	assert_non_null(ptr);
+	assert_true(malloc_usable_size(ptr) >= 32);
+	assert_int_equal(malloc_usable_size(NULL), 0);
+	memset(ptr, 0x5A, 32);
+
+	// Shrinking keeps the allocation
+	Heap::Calls before = Heap::calls;
+	char* shrunk = static_cast<char*>(realloc(ptr, 8));
+
+	if(MOCK_HEAP_MEMBERS >= MOCK_HEAP_FULL)
+	{
+		assert_int_equal(Heap::calls.realloc, before.realloc + 1);
+	}
+	else
+	{
+		assert_ptr_equal(shrunk, ptr);
+	}
+
+	// Growing moves the contents
+	before = Heap::calls;
+	char* grown = static_cast<char*>(realloc(shrunk, 64));
+	assert_non_null(grown);
+	assert_true(malloc_usable_size(grown) >= 64);
+
+	for(size_t i = 0; i < 8; i++)
+	{
+		assert_int_equal(grown[i], 0x5A);
+	}
+
+	if(MOCK_HEAP_MEMBERS >= MOCK_HEAP_FULL)
+	{
+		assert_int_equal(Heap::calls.realloc, before.realloc + 1);
+	}
+	else
+	{
+		assert_int_equal(Heap::calls.alloc, before.alloc + 1);
+		assert_int_equal(Heap::calls.free, before.free + 1);
+	}
+
+	// NULL and zero sizes behave like malloc() and free()
+	ptr = static_cast<char*>(realloc(NULL, 16));
+	assert_non_null(ptr);
+	before = Heap::calls;
+	assert_null(realloc(ptr, 0));
+	assert_int_equal(Heap::calls.free, before.free + 1);
+
+	free(grown);
+#else
+	// The adapter leaves realloc() and malloc_usable_size() to the C library
+	skip();
+#endif
+}
+
+int malloc_framework_rtos_tests(void)
+{
+	const struct CMUnitTest malloc_framework_rtos_test_suite[] = {
+		cmocka_unit_test(malloc_framework_rtos_alloc_test),
+		cmocka_unit_test(malloc_framework_rtos_realloc_test),
+	};
+
+	return cmocka_run_group_tests(malloc_framework_rtos_test_suite, NULL, NULL);
+}
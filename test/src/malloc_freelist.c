@@ -3,8 +3,10 @@
  * License: MIT. See LICENSE file for details.
  */
 
+#include <errno.h>
 #include <malloc.h>
 #include <stdint.h>
+#include <string.h>
 #include <support/memory.h>
 #include <tests.h>
 
@@ -18,6 +20,26 @@
 
 #define ALLOCATION_TEST_COUNT 768
 
+// Matches the default in malloc_freelist.c. The compact test build defines this as 1.
+#ifndef FREELIST_COMPACT_HEADER
+#define FREELIST_COMPACT_HEADER 0
+#endif
+
+/// Bytes used by the freelist in front of each allocation, and the smallest payload size.
+/// In compact mode, the payload of a free block holds the free list links.
+#if FREELIST_COMPACT_HEADER
+#define EXPECTED_HEADER_SZ sizeof(size_t)
+#define EXPECTED_MIN_PAYLOAD_SZ (2 * sizeof(void*))
+#else
+#define EXPECTED_HEADER_SZ (3 * sizeof(void*))
+#define EXPECTED_MIN_PAYLOAD_SZ sizeof(void*)
+#endif
+
+// Matches the default in malloc_freelist.c. The compact test build defines this as 1.
+#ifndef FREELIST_SET_ERRNO
+#define FREELIST_SET_ERRNO 0
+#endif
+
 static void* pointer_array[ALLOCATION_TEST_COUNT];
 
 static void malloc_test(void** __attribute__((unused)) state)
@@ -82,9 +104,145 @@ static void malloc_test(void** __attribute__((unused)) state)
 	}
 }
 
+static void malloc_aligned_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	uintptr_t mem_block_addr = block_start_addr();
+	uintptr_t mem_block_end_addr = block_end_addr();
+
+	for(size_t align = 1; align <= 8192; align *= 2)
+	{
+		void* ptr = malloc_aligned(align, 32);
+		assert_non_null(ptr);
+		assert_in_range((uintptr_t)ptr, mem_block_addr, mem_block_end_addr);
+		assert_false(((uintptr_t)ptr) & (align - 1));
+		assert_true(malloc_usable_size(ptr) >= 32);
+
+		// Keep a neighbor alive so that the aligned block is not simply merged away
+		void* neighbor = malloc(64);
+		assert_non_null(neighbor);
+
+		// Aligned memory is released with free()
+		free(ptr);
+		free(neighbor);
+	}
+
+	assert_int_equal(malloc_usable_size(NULL), 0);
+
+	// All of the memory skipped for alignment was returned to the heap
+	void* ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+}
+
+static void malloc_header_size_test(void** __attribute__((unused)) state)
+{
+	// A private region is used so that the layout doesn't depend on the earlier tests
+	static uint8_t region[4096] __attribute__((aligned(16)));
+	const unsigned tag = 0x48;
+
+	malloc_addblock_ex(region, sizeof(region), tag);
+
+	// Consecutive allocations are split from the same free block
+	char* first = malloc_region(tag, 96);
+	char* second = malloc_region(tag, 96);
+	assert_non_null(first);
+	assert_non_null(second);
+	assert_int_equal(second - first, 96 + EXPECTED_HEADER_SZ);
+
+	// Small allocations still leave room for the free list links once they are freed
+	char* small = malloc_region(tag, 1);
+	char* after_small = malloc_region(tag, 1);
+	assert_non_null(small);
+	assert_non_null(after_small);
+	assert_true(malloc_usable_size(small) >= EXPECTED_MIN_PAYLOAD_SZ);
+	size_t after_small_size = malloc_usable_size(after_small);
+	memset(small, 0xAA, malloc_usable_size(small));
+	free(small);
+	assert_int_equal(malloc_usable_size(after_small), after_small_size);
+
+	free(after_small);
+	free(second);
+	free(first);
+
+	// Everything was merged back together
+	assert_true(malloc_removeblock(region, sizeof(region)));
+}
+
+static void malloc_sized_free_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	free_sized(NULL, 0);
+	free_aligned_sized(NULL, 64, 0);
+
+	void* ptr = malloc(100);
+	assert_non_null(ptr);
+	free_sized(ptr, 100);
+
+	for(size_t align = 8; align <= 1024; align *= 2)
+	{
+		ptr = malloc_aligned(align, 48);
+		void* unlocked = malloc_aligned_unlocked(align, 48);
+		assert_non_null(ptr);
+		assert_non_null(unlocked);
+		assert_false(((uintptr_t)unlocked) & (align - 1));
+		assert_true(malloc_usable_size(unlocked) >= 48);
+
+		free_aligned_sized(ptr, align, 48);
+		free_aligned_sized_unlocked(unlocked, align, 48);
+	}
+
+	// All of the memory was returned to the heap
+	ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+}
+
+static void malloc_overflow_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// Sizes which would wrap around when rounded up to a block size are rejected
+	for(size_t delta = 0; delta <= 64; delta++)
+	{
+		volatile size_t size = SIZE_MAX - delta;
+
+		errno = 0;
+		assert_null(malloc(size));
+#if FREELIST_SET_ERRNO
+		assert_int_equal(errno, ENOMEM);
+#endif
+		assert_null(malloc_aligned(64, size));
+		assert_null(malloc_try(size));
+	}
+
+	// The heap is still intact
+	void* ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+}
+
 int malloc_tests(void)
 {
-	const struct CMUnitTest malloc_test_suite[] = {cmocka_unit_test(malloc_test)};
+	const struct CMUnitTest malloc_test_suite[] = {cmocka_unit_test(malloc_test),
+												   cmocka_unit_test(malloc_aligned_test),
+												   cmocka_unit_test(malloc_header_size_test),
+												   cmocka_unit_test(malloc_sized_free_test),
+												   cmocka_unit_test(malloc_overflow_test)};
 
 	return cmocka_run_group_tests(malloc_test_suite, NULL, NULL);
 }
@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define REGION_SIZE (16 * 1024)
+/// Bookkeeping which each region may use
+#define REGION_OVERHEAD 128
+
+static uint8_t low_region[REGION_SIZE] __attribute__((aligned(16)));
+static uint8_t high_region[REGION_SIZE] __attribute__((aligned(16)));
+
+static size_t malloc_failures = 0;
+
+void vApplicationMallocFailedHook(void)
+{
+	malloc_failures++;
+}
+
+static void check_heap_stats(void)
+{
+	HeapStats_t heap_stats;
+	malloc_stats_t stats;
+
+	vPortGetHeapStats(&heap_stats);
+	malloc_get_stats(&stats);
+
+	assert_int_equal(heap_stats.xAvailableHeapSpaceInBytes, stats.free_bytes);
+	assert_int_equal(heap_stats.xSizeOfLargestFreeBlockInBytes, stats.largest_free_block);
+	assert_int_equal(heap_stats.xSizeOfSmallestFreeBlockInBytes, stats.smallest_free_block);
+	assert_int_equal(heap_stats.xNumberOfFreeBlocks, stats.free_blocks);
+	assert_int_equal(heap_stats.xMinimumEverFreeBytesRemaining, stats.min_free_bytes);
+	assert_int_equal(heap_stats.xNumberOfSuccessfulAllocations, stats.allocations);
+	assert_int_equal(heap_stats.xNumberOfSuccessfulFrees, stats.frees);
+
+	assert_int_equal(xPortGetFreeHeapSize(), stats.free_bytes);
+	assert_int_equal(xPortGetMinimumEverFreeHeapSize(), stats.min_free_bytes);
+}
+
+static void malloc_freertos_provider_regions_test(void** __attribute__((unused)) state)
+{
+	size_t before = xPortGetFreeHeapSize();
+
+	// Regions do not need to be sorted, unlike heap_5
+	const HeapRegion_t regions[] = {
+		{high_region, REGION_SIZE},
+		{low_region, REGION_SIZE},
+		{NULL, 0},
+	};
+
+	vPortDefineHeapRegions(regions);
+
+	size_t after = xPortGetFreeHeapSize();
+	assert_true(after <= (before + (2 * REGION_SIZE)));
+	assert_true(after >= (before + (2 * (REGION_SIZE - REGION_OVERHEAD))));
+
+	check_heap_stats();
+}
+
+static void malloc_freertos_provider_alloc_test(void** __attribute__((unused)) state)
+{
+	HeapStats_t before;
+	HeapStats_t after;
+
+	vPortGetHeapStats(&before);
+
+	// pvPortMalloc() and malloc() share the heap
+	void* ptr = pvPortMalloc(64);
+	assert_non_null(ptr);
+	void* other = malloc(64);
+	assert_non_null(other);
+
+	vPortGetHeapStats(&after);
+	assert_int_equal(after.xNumberOfSuccessfulAllocations,
+					 before.xNumberOfSuccessfulAllocations + 2);
+	assert_true(xPortGetFreeHeapSize() <= (before.xAvailableHeapSpaceInBytes - 128));
+	assert_true(xPortGetMinimumEverFreeHeapSize() <= xPortGetFreeHeapSize());
+	check_heap_stats();
+
+	vPortFree(ptr);
+	free(other);
+	vPortFree(NULL);
+
+	vPortGetHeapStats(&after);
+	assert_int_equal(after.xNumberOfSuccessfulFrees, before.xNumberOfSuccessfulFrees + 2);
+	check_heap_stats();
+
+	// Failed requests call the malloc failed hook
+	size_t failures = malloc_failures;
+	assert_null(pvPortMalloc(SIZE_MAX / 2));
+	assert_int_equal(malloc_failures, failures + 1);
+}
+
+int malloc_freertos_provider_tests(void)
+{
+	const struct CMUnitTest malloc_freertos_provider_test_suite[] = {
+		cmocka_unit_test(malloc_freertos_provider_regions_test),
+		cmocka_unit_test(malloc_freertos_provider_alloc_test),
+	};
+
+	return cmocka_run_group_tests(malloc_freertos_provider_test_suite, NULL, NULL);
+}
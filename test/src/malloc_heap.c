@@ -0,0 +1,141 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <malloc_heap.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define HEAP_SIZE (16 * 1024)
+
+static uint8_t network_memory[HEAP_SIZE] __attribute__((aligned(16)));
+static uint8_t ui_memory[HEAP_SIZE] __attribute__((aligned(16)));
+static uint8_t extra_memory[2 * HEAP_SIZE] __attribute__((aligned(16)));
+
+/// Lock depth for each heap, used as the lock context
+static int network_lock_depth;
+static int ui_lock_depth;
+static unsigned lock_calls;
+
+static void test_lock(void* context)
+{
+	int* depth = context;
+
+	// Calls must not nest
+	assert_int_equal(*depth, 0);
+	(*depth)++;
+	lock_calls++;
+}
+
+static void test_unlock(void* context)
+{
+	int* depth = context;
+
+	assert_int_equal(*depth, 1);
+	(*depth)--;
+}
+
+static bool in_buffer(const void* ptr, const uint8_t* buffer, size_t size)
+{
+	return ((uintptr_t)ptr >= (uintptr_t)buffer) && ((uintptr_t)ptr < ((uintptr_t)buffer + size));
+}
+
+static void malloc_heap_test(void** __attribute__((unused)) state)
+{
+	const heap_lock_t network_lock = {test_lock, test_unlock, &network_lock_depth};
+	const heap_lock_t ui_lock = {test_lock, test_unlock, &ui_lock_depth};
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	assert_null(heap_init(network_memory, 16, &network_lock));
+
+	heap_t* network = heap_init(network_memory, sizeof(network_memory), &network_lock);
+	heap_t* ui = heap_init(ui_memory, sizeof(ui_memory), &ui_lock);
+	assert_non_null(network);
+	assert_non_null(ui);
+	assert_ptr_not_equal(network, heap_default());
+
+	// Each heap allocates from its own memory, and takes its own lock
+	lock_calls = 0;
+	void* packet = heap_alloc(network, 256);
+	void* widget = heap_alloc(ui, 256);
+	assert_true(in_buffer(packet, network_memory, sizeof(network_memory)));
+	assert_true(in_buffer(widget, ui_memory, sizeof(ui_memory)));
+	assert_int_equal(malloc_usable_size(packet), 256);
+	assert_int_equal(lock_calls, 2);
+	assert_int_equal(network_lock_depth, 0);
+	assert_int_equal(ui_lock_depth, 0);
+
+	// The default heap is not used
+	void* ptr = malloc(64);
+	assert_true(in_buffer(ptr, (const uint8_t*)block_start_addr(), block_size()));
+	free(ptr);
+
+	for(size_t align = 8; align <= 512; align *= 2)
+	{
+		ptr = heap_aligned_alloc(network, align, 40);
+		assert_true(in_buffer(ptr, network_memory, sizeof(network_memory)));
+		assert_false(((uintptr_t)ptr) & (align - 1));
+		heap_free(network, ptr);
+	}
+
+	// Exhausting one heap does not take memory from the others
+	assert_null(heap_alloc(network, HEAP_SIZE));
+	assert_non_null(heap_alloc(ui, HEAP_SIZE / 2));
+
+	// Memory can be added to a heap later
+	heap_addblock(network, extra_memory, sizeof(extra_memory));
+	ptr = heap_alloc(network, HEAP_SIZE);
+	assert_true(in_buffer(ptr, extra_memory, sizeof(extra_memory)));
+	heap_free(network, ptr);
+
+	heap_free(network, packet);
+	heap_free(network, NULL);
+
+	// All of the memory was returned to the heap
+	ptr = heap_alloc(network, (3 * HEAP_SIZE) / 2);
+	assert_non_null(ptr);
+	heap_free(network, ptr);
+}
+
+static void malloc_heap_unlocked_test(void** __attribute__((unused)) state)
+{
+	static uint8_t memory[4096] __attribute__((aligned(16)));
+
+	// Heaps without lock callbacks are not thread-safe, but otherwise work the same way
+	heap_t* heap = heap_init(memory, sizeof(memory), NULL);
+	assert_non_null(heap);
+
+	void* first = heap_alloc(heap, 32);
+	void* second = heap_alloc(heap, 32);
+	assert_true(in_buffer(first, memory, sizeof(memory)));
+	assert_true(in_buffer(second, memory, sizeof(memory)));
+	assert_ptr_not_equal(first, second);
+
+	heap_free(heap, first);
+	heap_free(heap, second);
+	assert_null(heap_alloc(heap, 0));
+}
+
+int malloc_heap_tests(void)
+{
+	const struct CMUnitTest malloc_heap_test_suite[] = {
+		cmocka_unit_test(malloc_heap_test), cmocka_unit_test(malloc_heap_unlocked_test)};
+
+	return cmocka_run_group_tests(malloc_heap_test_suite, NULL, NULL);
+}
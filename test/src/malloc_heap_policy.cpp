@@ -0,0 +1,183 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <cstdint>
+#include <malloc_heap.hpp>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+using libmemory::BestFit;
+using libmemory::CountingStats;
+using libmemory::FirstFit;
+using libmemory::FixedHeap;
+using libmemory::Heap;
+using libmemory::MutexLock;
+using libmemory::NoStats;
+using libmemory::NullLock;
+
+#define HEAP_SIZE (8 * 1024)
+
+// Empty policies take no space
+static_assert(sizeof(Heap<FirstFit, NullLock, NoStats>) == sizeof(void*));
+static_assert(sizeof(Heap<BestFit, NullLock, NoStats>) == sizeof(void*));
+static_assert(FixedHeap<HEAP_SIZE>::capacity == HEAP_SIZE);
+
+/// Lock which checks that calls do not nest
+struct TestMutex
+{
+	void lock()
+	{
+		assert_int_equal(depth, 0);
+		depth++;
+	}
+
+	void unlock()
+	{
+		assert_int_equal(depth, 1);
+		depth--;
+	}
+
+	int depth = 0;
+};
+
+static FixedHeap<HEAP_SIZE> first_fit_heap;
+static FixedHeap<HEAP_SIZE, BestFit> best_fit_heap;
+
+static bool in_heap(const void* ptr, const void* heap, size_t size)
+{
+	return ((uintptr_t)ptr >= (uintptr_t)heap) && ((uintptr_t)ptr < ((uintptr_t)heap + size));
+}
+
+/**
+ * Leave a 256 byte hole in front of a 64 byte hole, and return the hole addresses.
+ * The blocks between the holes keep them from being merged.
+ */
+template<typename HeapType>
+static void make_holes(HeapType& heap, void*& large_hole, void*& small_hole)
+{
+	large_hole = heap.allocate(256);
+	void* separator = heap.allocate(64);
+	small_hole = heap.allocate(64);
+	void* tail = heap.allocate(64);
+	assert_non_null(tail);
+	(void)separator;
+
+	heap.deallocate(large_hole);
+	heap.deallocate(small_hole);
+}
+
+static void malloc_heap_policy_fit_test([[maybe_unused]] void** state)
+{
+	void* large_hole = nullptr;
+	void* small_hole = nullptr;
+
+	// The storage is inside the heap object
+	void* ptr = first_fit_heap.allocate(64);
+	assert_true(in_heap(ptr, &first_fit_heap, sizeof(first_fit_heap)));
+	assert_false(((uintptr_t)ptr) & (alignof(std::max_align_t) - 1));
+	assert_true(first_fit_heap.usable_size(ptr) >= 64);
+	first_fit_heap.deallocate(ptr);
+	first_fit_heap.deallocate(nullptr);
+	assert_int_equal(first_fit_heap.usable_size(nullptr), 0);
+
+	// First fit takes the first hole which is large enough
+	make_holes(first_fit_heap, large_hole, small_hole);
+	assert_ptr_equal(first_fit_heap.allocate(64), large_hole);
+
+	// Best fit takes the smallest hole which is large enough
+	make_holes(best_fit_heap, large_hole, small_hole);
+	assert_ptr_equal(best_fit_heap.allocate(64), small_hole);
+	assert_ptr_equal(best_fit_heap.allocate(200), large_hole);
+
+	assert_null(first_fit_heap.allocate(0));
+	assert_null(first_fit_heap.allocate(HEAP_SIZE));
+	assert_null(first_fit_heap.allocate(SIZE_MAX));
+}
+
+static void malloc_heap_policy_aligned_test([[maybe_unused]] void** state)
+{
+	FixedHeap<HEAP_SIZE, FirstFit, NullLock, CountingStats, sizeof(void*)> heap;
+	void* ptrs[7];
+	size_t i = 0;
+
+	malloc_stats_t stats = heap.stats();
+	const size_t initial_free = stats.free_bytes;
+	assert_int_equal(stats.free_blocks, 1);
+
+	for(size_t align = 8; align <= 512; align *= 2, i++)
+	{
+		ptrs[i] = heap.allocate_aligned(align, 40);
+		assert_true(in_heap(ptrs[i], &heap, sizeof(heap)));
+		assert_false(((uintptr_t)ptrs[i]) & (align - 1));
+	}
+
+	stats = heap.stats();
+	assert_int_equal(stats.allocations, 7);
+	assert_true(stats.free_bytes < initial_free);
+	assert_int_equal(stats.min_free_bytes, stats.free_bytes);
+
+	for(i = 0; i < 7; i++)
+	{
+		heap.deallocate(ptrs[i]);
+	}
+
+	// All of the blocks were merged back together
+	stats = heap.stats();
+	assert_int_equal(stats.free_blocks, 1);
+	assert_int_equal(stats.free_bytes, initial_free);
+	assert_int_equal(stats.largest_free_block, initial_free);
+	assert_int_equal(stats.frees, 7);
+	assert_true(stats.min_free_bytes < initial_free);
+
+	void* ptr = heap.allocate(initial_free);
+	assert_non_null(ptr);
+	heap.deallocate(ptr);
+}
+
+static void malloc_heap_policy_lock_test([[maybe_unused]] void** state)
+{
+	// The blocks are not adjacent, so they are not merged
+	static uint8_t memory[3 * 4096] __attribute__((aligned(16)));
+	uint8_t* extra_memory = &memory[2 * 4096];
+	Heap<FirstFit, MutexLock<TestMutex>> heap;
+
+	// Blocks which are too small to use are ignored
+	heap.add_block(memory, 4);
+	assert_null(heap.allocate(8));
+
+	heap.add_block(memory, 4096);
+	void* ptr = heap.allocate(1024);
+	assert_true(in_heap(ptr, memory, 4096));
+
+	// Memory can be added later
+	heap.add_block(extra_memory, 4096);
+	void* extra = heap.allocate(3 * 1024);
+	assert_true(in_heap(extra, extra_memory, 4096));
+
+	heap.deallocate(extra);
+	heap.deallocate(ptr);
+
+	// Without counters, stats() walks the free list
+	malloc_stats_t stats = heap.stats();
+	assert_int_equal(stats.free_blocks, 2);
+	assert_int_equal(stats.allocations, 0);
+}
+
+int malloc_heap_policy_tests(void)
+{
+	const struct CMUnitTest malloc_heap_policy_test_suite[] = {
+		cmocka_unit_test(malloc_heap_policy_fit_test),
+		cmocka_unit_test(malloc_heap_policy_aligned_test),
+		cmocka_unit_test(malloc_heap_policy_lock_test)};
+
+	return cmocka_run_group_tests(malloc_heap_policy_test_suite, NULL, NULL);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <malloc_instrumentation.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+/// Each read of the fake counter advances it by this many ticks
+#define COUNTER_STEP 10
+
+static uint32_t fake_counter = 0;
+
+static uint32_t fake_cycle_counter(void)
+{
+	fake_counter += COUNTER_STEP;
+	return fake_counter;
+}
+
+static void malloc_instrumentation_test(void** __attribute__((unused)) state)
+{
+	malloc_histogram_t histogram;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// Nothing is recorded while instrumentation is disabled
+	malloc_histogram_reset();
+	free(malloc(64));
+	malloc_histogram_read(MALLOC_OP_MALLOC, &histogram, false);
+	assert_int_equal(histogram.count, 0);
+
+	malloc_instrumentation_enable(fake_cycle_counter);
+
+	for(int i = 0; i < 4; i++)
+	{
+		void* ptr = malloc(64);
+		assert_non_null(ptr);
+		free(ptr);
+	}
+
+	// Requests which don't take the lock aren't counted
+	void* empty = malloc(0);
+	assert_null(empty);
+	free(NULL);
+
+	malloc_instrumentation_enable(NULL);
+
+	malloc_histogram_read(MALLOC_OP_MALLOC, &histogram, false);
+	assert_int_equal(histogram.count, 4);
+	assert_true(histogram.min >= COUNTER_STEP);
+	assert_true(histogram.max >= histogram.min);
+	assert_true(histogram.total >= (uint64_t)histogram.min * histogram.count);
+
+	uint32_t bucket_total = 0;
+	for(unsigned i = 0; i < MALLOC_HISTOGRAM_BUCKETS; i++)
+	{
+		bucket_total += histogram.buckets[i];
+	}
+	assert_int_equal(bucket_total, histogram.count);
+
+	malloc_histogram_read(MALLOC_OP_FREE, &histogram, true);
+	assert_int_equal(histogram.count, 4);
+
+	// One lock wait sample for each malloc() and free() call
+	malloc_histogram_read(MALLOC_OP_LOCK_WAIT, &histogram, false);
+	assert_int_equal(histogram.count, 8);
+	// Each lock wait sample is exactly one counter step with our fake counter
+	assert_int_equal(histogram.min, COUNTER_STEP);
+	assert_int_equal(histogram.max, COUNTER_STEP);
+	assert_int_equal(histogram.buckets[4], 8);
+
+	// The free histogram was reset by the previous read
+	malloc_histogram_read(MALLOC_OP_FREE, &histogram, false);
+	assert_int_equal(histogram.count, 0);
+
+	malloc_histogram_reset();
+	malloc_histogram_read(MALLOC_OP_LOCK_WAIT, &histogram, false);
+	assert_int_equal(histogram.count, 0);
+}
+
+/// Heap growth hook which enables instrumentation while malloc() is running
+static void* enable_instrumentation_morecore(size_t size)
+{
+	(void)size;
+	malloc_instrumentation_enable(fake_cycle_counter);
+	return NULL;
+}
+
+static void malloc_instrumentation_enable_race_test(void** __attribute__((unused)) state)
+{
+	malloc_histogram_t histogram;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// A large counter value would show up as the sample if the start was taken as 0
+	fake_counter = UINT32_MAX / 2;
+	malloc_instrumentation_enable(NULL);
+	malloc_histogram_reset();
+
+	// The start timestamp is taken before instrumentation is enabled by the hook
+	malloc_set_morecore(enable_instrumentation_morecore, 0);
+	assert_null(malloc(2 * block_size()));
+	malloc_set_morecore(NULL, 0);
+
+	malloc_instrumentation_enable(NULL);
+
+	malloc_histogram_read(MALLOC_OP_MALLOC, &histogram, false);
+	assert_int_equal(histogram.count, 0);
+	assert_int_equal(histogram.max, 0);
+}
+
+int malloc_instrumentation_tests(void)
+{
+	const struct CMUnitTest malloc_instrumentation_test_suite[] = {
+		cmocka_unit_test(malloc_instrumentation_test),
+		cmocka_unit_test(malloc_instrumentation_enable_race_test)};
+
+	return cmocka_run_group_tests(malloc_instrumentation_test_suite, NULL, NULL);
+}
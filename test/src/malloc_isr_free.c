@@ -0,0 +1,120 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+// Matches the default in malloc_freelist.c. The deferred test build overrides this.
+#ifndef FREELIST_DEFERRED_FREE_SLOTS
+#define FREELIST_DEFERRED_FREE_SLOTS 0
+#endif
+
+#define BLOCK_COUNT 8
+// Differs from the other sizes, so the blocks don't reuse deferred frees
+#define BLOCK_SIZE 192
+
+static void malloc_isr_free_test(void** __attribute__((unused)) state)
+{
+	void* blocks[BLOCK_COUNT];
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	free_from_isr(NULL);
+
+	void* ptr = malloc(128);
+	assert_non_null(ptr);
+	free_from_isr(ptr);
+
+	// The next allocation returns the pending block to the heap first
+	void* next = malloc(128);
+	assert_ptr_equal(next, ptr);
+	free(next);
+
+	for(size_t i = 0; i < BLOCK_COUNT; i++)
+	{
+		blocks[i] = malloc(BLOCK_SIZE);
+		assert_non_null(blocks[i]);
+	}
+
+	// Pending blocks are merged with each other and with the free list in one batch
+	for(size_t i = 0; i < BLOCK_COUNT; i++)
+	{
+		free_from_isr(blocks[i]);
+	}
+
+	malloc_drain();
+	malloc_drain();
+
+	// If the blocks were carved from one free block, they are merged back together
+	bool adjacent = true;
+	uintptr_t stride = (uintptr_t)blocks[1] - (uintptr_t)blocks[0];
+
+	for(size_t i = 1; i < BLOCK_COUNT; i++)
+	{
+		adjacent &= (((uintptr_t)blocks[i] - (uintptr_t)blocks[i - 1]) == stride);
+	}
+
+	ptr = malloc(BLOCK_COUNT * BLOCK_SIZE);
+	assert_non_null(ptr);
+
+	// The merged block may also include a free neighbor in front of the first block, so the
+	// first fit starts at the first block or before it
+	if(adjacent)
+	{
+		assert_true((uintptr_t)ptr <= (uintptr_t)blocks[0]);
+	}
+
+	free(ptr);
+}
+
+static void malloc_isr_free_mixed_test(void** __attribute__((unused)) state)
+{
+	void* first = malloc(256);
+	void* second = malloc(256);
+	void* third = malloc(256);
+	assert_non_null(first);
+	assert_non_null(second);
+	assert_non_null(third);
+
+	// free() also drains the pending list
+	free_from_isr(first);
+	free_from_isr(third);
+	free(second);
+
+	void* ptr = malloc(3 * 256);
+	assert_non_null(ptr);
+#if FREELIST_DEFERRED_FREE_SLOTS == 0
+	// Otherwise, `second` is held in the deferred free buffer
+	assert_ptr_equal(ptr, first);
+#endif
+	free(ptr);
+
+	// The heap is whole again
+	ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+}
+
+int malloc_isr_free_tests(void)
+{
+	const struct CMUnitTest malloc_isr_free_test_suite[] = {
+		cmocka_unit_test(malloc_isr_free_test), cmocka_unit_test(malloc_isr_free_mixed_test)};
+
+	return cmocka_run_group_tests(malloc_isr_free_test_suite, NULL, NULL);
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+// Matches the default in malloc_freelist.c. The isr test build overrides this.
+#ifndef FREELIST_ISR_POOL_CLASSES
+#define FREELIST_ISR_POOL_CLASSES 0
+#endif
+
+#define SMALL_CLASS 64
+#define SMALL_COUNT 4
+#define LARGE_CLASS 256
+#define LARGE_COUNT 2
+#define SINGLE_CLASS 128
+
+static void malloc_isr_pool_test(void** __attribute__((unused)) state)
+{
+	void* small[SMALL_COUNT];
+	void* large[LARGE_COUNT];
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+#if FREELIST_ISR_POOL_CLASSES > 0
+	assert_false(malloc_isr_reserve(0, 4));
+	assert_false(malloc_isr_reserve(SMALL_CLASS, 0));
+
+	// Classes may be reserved in any order
+	assert_true(malloc_isr_reserve(LARGE_CLASS, LARGE_COUNT));
+	assert_true(malloc_isr_reserve(SMALL_CLASS, SMALL_COUNT));
+	assert_null(malloc_from_isr(0));
+
+	for(size_t i = 0; i < SMALL_COUNT; i++)
+	{
+		small[i] = malloc_from_isr(SMALL_CLASS / 2);
+		assert_non_null(small[i]);
+		assert_int_equal(malloc_usable_size(small[i]), SMALL_CLASS);
+	}
+
+	// Once a class is empty, the next larger class is used
+	for(size_t i = 0; i < LARGE_COUNT; i++)
+	{
+		large[i] = malloc_from_isr(SMALL_CLASS);
+		assert_non_null(large[i]);
+		assert_int_equal(malloc_usable_size(large[i]), LARGE_CLASS);
+	}
+
+	assert_null(malloc_from_isr(1));
+	assert_null(malloc_from_isr(LARGE_CLASS + 1));
+
+	// Thread context refills the pools
+	for(size_t i = 0; i < SMALL_COUNT; i++)
+	{
+		free(small[i]);
+	}
+
+	for(size_t i = 0; i < LARGE_COUNT; i++)
+	{
+		free_from_isr(large[i]);
+	}
+
+	malloc_drain();
+
+	for(size_t i = 0; i < SMALL_COUNT; i++)
+	{
+		small[i] = malloc_from_isr(SMALL_CLASS);
+		assert_non_null(small[i]);
+		assert_int_equal(malloc_usable_size(small[i]), SMALL_CLASS);
+	}
+
+	for(size_t i = 0; i < SMALL_COUNT; i++)
+	{
+		free(small[i]);
+	}
+
+	// A pool of one block is refilled once its block is taken. The block is not split when
+	// the remainder would be too small, so it may be larger than the class.
+	assert_true(malloc_isr_reserve(SINGLE_CLASS, 1));
+	void* single = malloc_from_isr(SINGLE_CLASS);
+	assert_in_range(malloc_usable_size(single), SINGLE_CLASS, LARGE_CLASS - 1);
+	free(single);
+
+	single = malloc_from_isr(SINGLE_CLASS);
+	assert_in_range(malloc_usable_size(single), SINGLE_CLASS, LARGE_CLASS - 1);
+	free(single);
+#else
+	(void)small;
+	(void)large;
+	assert_false(malloc_isr_reserve(SMALL_CLASS, SMALL_COUNT));
+	assert_null(malloc_from_isr(SMALL_CLASS));
+#endif
+}
+
+static void malloc_isr_pool_grow_test(void** __attribute__((unused)) state)
+{
+#if FREELIST_ISR_POOL_CLASSES > 0
+	void* blocks[2 * SMALL_COUNT];
+
+	// Reserving a class again adds to its pool
+	assert_true(malloc_isr_reserve(SMALL_CLASS, SMALL_COUNT));
+
+	for(size_t i = 0; i < (2 * SMALL_COUNT); i++)
+	{
+		blocks[i] = malloc_from_isr(SMALL_CLASS);
+		assert_non_null(blocks[i]);
+		assert_int_equal(malloc_usable_size(blocks[i]), SMALL_CLASS);
+	}
+
+	for(size_t i = 0; i < (2 * SMALL_COUNT); i++)
+	{
+		free(blocks[i]);
+	}
+
+	// The class table is limited
+	for(size_t i = 0; i < FREELIST_ISR_POOL_CLASSES; i++)
+	{
+		(void)malloc_isr_reserve(LARGE_CLASS * (i + 2), 1);
+	}
+
+	assert_false(malloc_isr_reserve(LARGE_CLASS * (FREELIST_ISR_POOL_CLASSES + 2), 1));
+#else
+	skip();
+#endif
+}
+
+int malloc_isr_pool_tests(void)
+{
+	const struct CMUnitTest malloc_isr_pool_test_suite[] = {
+		cmocka_unit_test(malloc_isr_pool_test), cmocka_unit_test(malloc_isr_pool_grow_test)};
+
+	return cmocka_run_group_tests(malloc_isr_pool_test_suite, NULL, NULL);
+}
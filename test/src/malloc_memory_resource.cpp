@@ -0,0 +1,228 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <cstdint>
+#include <malloc.h>
+#include <malloc_memory_resource.hpp>
+#include <new>
+#include <support/memory.h>
+#include <tests.h>
+#include <vector>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+using libmemory::heap_resource;
+using libmemory::monotonic_heap_memory_resource;
+using libmemory::unsynchronized_heap_resource;
+
+#define OBJECT_COUNT 16
+// Blocks of this size alternate between 8 and 16 byte payload alignments
+#define OBJECT_SIZE 48
+
+static bool in_heap(const void* ptr)
+{
+	return ((uintptr_t)ptr >= block_start_addr()) && ((uintptr_t)ptr < block_end_addr());
+}
+
+static bool aligned(const void* ptr, size_t alignment)
+{
+	return (((uintptr_t)ptr) & (alignment - 1)) == 0;
+}
+
+/// Allocations and frees which have not been matched yet
+static size_t outstanding_allocations()
+{
+	malloc_stats_t stats;
+	malloc_get_stats(&stats);
+
+	return stats.allocations - stats.frees;
+}
+
+static void check_heap_resource(std::pmr::memory_resource* resource)
+{
+	void* objects[OBJECT_COUNT];
+	malloc_stats_t before;
+	malloc_stats_t after;
+
+	// Requests with the native alignment pack blocks like malloc()
+	malloc_get_stats(&before);
+
+	for(size_t i = 0; i < OBJECT_COUNT; i++)
+	{
+		objects[i] = resource->allocate(OBJECT_SIZE, alignof(void*));
+		assert_true(in_heap(objects[i]));
+		assert_true(aligned(objects[i], alignof(void*)));
+	}
+
+	malloc_get_stats(&after);
+	assert_true(after.free_blocks <= (before.free_blocks + 1));
+
+	for(size_t i = 0; i < OBJECT_COUNT; i++)
+	{
+		resource->deallocate(objects[i], OBJECT_SIZE, alignof(void*));
+	}
+
+	// Over-aligned and zero-sized requests
+	void* ptr = resource->allocate(40, 256);
+	assert_true(in_heap(ptr));
+	assert_true(aligned(ptr, 256));
+	resource->deallocate(ptr, 40, 256);
+
+	void* first = resource->allocate(0);
+	void* second = resource->allocate(0);
+	assert_ptr_not_equal(first, second);
+	assert_true(aligned(first, alignof(std::max_align_t)));
+	resource->deallocate(first, 0);
+	resource->deallocate(second, 0);
+
+	// Containers allocate with the alignment of their elements
+	{
+		std::pmr::vector<uint64_t> values(resource);
+
+		for(uint64_t i = 0; i < 100; i++)
+		{
+			values.push_back(i);
+		}
+
+		assert_true(in_heap(values.data()));
+		assert_int_equal(values[99], 99);
+	}
+
+	bool thrown = false;
+	try
+	{
+		volatile size_t huge = SIZE_MAX - 64;
+		ptr = resource->allocate(huge);
+		resource->deallocate(ptr, huge);
+	}
+	catch(const std::bad_alloc&)
+	{
+		thrown = true;
+	}
+	assert_true(thrown);
+}
+
+static void malloc_memory_resource_heap_test([[maybe_unused]] void** state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	const size_t outstanding = outstanding_allocations();
+
+	// The shared instances are returned for each call
+	assert_ptr_equal(heap_resource(), heap_resource());
+	assert_ptr_equal(unsynchronized_heap_resource(), unsynchronized_heap_resource());
+
+	check_heap_resource(heap_resource());
+	check_heap_resource(unsynchronized_heap_resource());
+
+	assert_int_equal(outstanding_allocations(), outstanding);
+}
+
+static void malloc_memory_resource_monotonic_test([[maybe_unused]] void** state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	const size_t outstanding = outstanding_allocations();
+
+	{
+		monotonic_heap_memory_resource resource(256);
+		assert_int_equal(outstanding_allocations(), outstanding + 1);
+		const size_t initial_remaining = resource.remaining();
+		assert_true(initial_remaining < 256);
+
+		// Allocations are carved from the block
+		void* first = resource.allocate(32, 8);
+		void* second = resource.allocate(32, 8);
+		assert_true(in_heap(first));
+		assert_int_equal((uintptr_t)second - (uintptr_t)first, 32);
+		assert_int_equal(resource.remaining(), initial_remaining - 64);
+
+		void* ptr = resource.allocate(1, 64);
+		assert_true(aligned(ptr, 64));
+
+		// Deallocation does not return memory
+		const size_t remaining = resource.remaining();
+		resource.deallocate(ptr, 1, 64);
+		assert_int_equal(resource.remaining(), remaining);
+
+		// A block which is twice the size is added when the first one is full
+		ptr = resource.allocate(remaining + 1, 1);
+		assert_true(in_heap(ptr));
+		assert_int_equal(outstanding_allocations(), outstanding + 2);
+		assert_true(resource.remaining() > initial_remaining);
+
+		// Large requests get a block which fits them
+		ptr = resource.allocate(4096, 16);
+		assert_true(in_heap(ptr));
+		assert_true(aligned(ptr, 16));
+		assert_int_equal(outstanding_allocations(), outstanding + 3);
+
+		// release() returns every block, and the resource starts over with the initial size
+		resource.release();
+		assert_int_equal(outstanding_allocations(), outstanding);
+		assert_int_equal(resource.remaining(), 0);
+
+		ptr = resource.allocate(16, 8);
+		assert_true(in_heap(ptr));
+		assert_int_equal(outstanding_allocations(), outstanding + 1);
+		assert_int_equal(resource.remaining(), initial_remaining - 16);
+	}
+
+	// The destructor releases the blocks
+	assert_int_equal(outstanding_allocations(), outstanding);
+}
+
+static void malloc_memory_resource_equal_test([[maybe_unused]] void** state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	monotonic_heap_memory_resource first(256);
+	monotonic_heap_memory_resource second(256);
+
+	// Each resource is only equal to itself
+	assert_true(heap_resource()->is_equal(*heap_resource()));
+	assert_true(unsynchronized_heap_resource()->is_equal(*unsynchronized_heap_resource()));
+	assert_false(heap_resource()->is_equal(*unsynchronized_heap_resource()));
+	assert_false(unsynchronized_heap_resource()->is_equal(*heap_resource()));
+	assert_false(heap_resource()->is_equal(first));
+
+	assert_true(first.is_equal(first));
+	assert_false(first.is_equal(second));
+	assert_false(first.is_equal(*heap_resource()));
+
+	// Allocators compare equal when their resources do
+	assert_true(std::pmr::polymorphic_allocator<int>(heap_resource()) ==
+				std::pmr::polymorphic_allocator<int>(heap_resource()));
+	assert_true(std::pmr::polymorphic_allocator<int>(&first) !=
+				std::pmr::polymorphic_allocator<int>(&second));
+}
+
+int malloc_memory_resource_tests(void)
+{
+	const struct CMUnitTest malloc_memory_resource_test_suite[] = {
+		cmocka_unit_test(malloc_memory_resource_heap_test),
+		cmocka_unit_test(malloc_memory_resource_monotonic_test),
+		cmocka_unit_test(malloc_memory_resource_equal_test)};
+
+	return cmocka_run_group_tests(malloc_memory_resource_test_suite, NULL, NULL);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define GROWTH_POOL_SIZE (512 * 1024)
+#define GROWTH_GRANULARITY (64 * 1024)
+
+static uint8_t growth_pool[GROWTH_POOL_SIZE] __attribute__((aligned(16)));
+static volatile size_t growth_pool_used = 0;
+static volatile unsigned morecore_calls = 0;
+
+/// sbrk()-style provider: hands out contiguous chunks of the growth pool
+static void* fake_morecore(size_t size)
+{
+	void* ptr = NULL;
+
+	morecore_calls++;
+
+	// Requests are rounded up to the granularity
+	assert_int_equal(size % GROWTH_GRANULARITY, 0);
+
+	if((growth_pool_used + size) <= GROWTH_POOL_SIZE)
+	{
+		ptr = &growth_pool[growth_pool_used];
+		growth_pool_used += size;
+	}
+
+	return ptr;
+}
+
+static bool in_growth_pool(void* ptr)
+{
+	return ((uintptr_t)ptr >= (uintptr_t)growth_pool) &&
+		   ((uintptr_t)ptr < ((uintptr_t)growth_pool + GROWTH_POOL_SIZE));
+}
+
+static void malloc_morecore_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// Use up most of the test block, so that the next request cannot be satisfied
+	void* filler = malloc(block_size() - (64 * 1024));
+	assert_non_null(filler);
+	assert_null(malloc(200 * 1024));
+
+	malloc_set_morecore(fake_morecore, GROWTH_GRANULARITY);
+
+	void* first = malloc(200 * 1024);
+	assert_non_null(first);
+	assert_true(in_growth_pool(first));
+	assert_int_equal(morecore_calls, 1);
+	assert_int_equal(growth_pool_used, 4 * GROWTH_GRANULARITY);
+
+	// The second chunk is contiguous with the first one, so the free tail of the
+	// first chunk is merged with it to satisfy this request
+	void* second = malloc(100 * 1024);
+	assert_non_null(second);
+	assert_int_equal(morecore_calls, 2);
+	assert_true((uintptr_t)second < ((uintptr_t)growth_pool + (4 * GROWTH_GRANULARITY)));
+
+	// Requests which can't be satisfied by the provider still fail
+	assert_null(malloc(2 * GROWTH_POOL_SIZE));
+
+	// Requests whose growth size would wrap around don't reach the provider
+	unsigned calls = morecore_calls;
+	volatile size_t huge = SIZE_MAX - (GROWTH_GRANULARITY / 2);
+	assert_null(malloc(huge));
+	assert_null(malloc_aligned(4096, huge));
+	assert_int_equal(morecore_calls, calls);
+
+	malloc_set_morecore(NULL, 0);
+
+	free(first);
+	free(second);
+	free(filler);
+
+	// Hand the grown memory back so the remaining tests only use the default test block
+	assert_true(malloc_removeblock(growth_pool, growth_pool_used));
+}
+
+int malloc_morecore_tests(void)
+{
+	const struct CMUnitTest malloc_morecore_test_suite[] = {
+		cmocka_unit_test(malloc_morecore_test)};
+
+	return cmocka_run_group_tests(malloc_morecore_test_suite, NULL, NULL);
+}
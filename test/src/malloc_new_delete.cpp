@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <cstdint>
+#include <malloc.h>
+#include <malloc_profiler.h>
+#include <new>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define OBJECT_COUNT 16
+// Blocks of this size alternate between 8 and 16 byte payload alignments
+#define OBJECT_SIZE 48
+#define MAX_FILLERS 256
+/// Upper bound on the size of new_from_callsite()
+#define CALLSITE_FUNCTION_SIZE 256
+
+struct alignas(256) over_aligned_t
+{
+	char data[40];
+};
+
+static bool in_heap(const void* ptr)
+{
+	return ((uintptr_t)ptr >= block_start_addr()) && ((uintptr_t)ptr < block_end_addr());
+}
+
+static void malloc_new_delete_test([[maybe_unused]] void** state)
+{
+	char* objects[OBJECT_COUNT];
+	malloc_stats_t before;
+	malloc_stats_t after;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// Plain new has the default new alignment. When malloc() provides it, blocks are packed
+	// like malloc(), without a gap in front of each one.
+	malloc_get_stats(&before);
+
+	for(size_t i = 0; i < OBJECT_COUNT; i++)
+	{
+		objects[i] = new char[OBJECT_SIZE];
+		assert_true(in_heap(objects[i]));
+		assert_false(((uintptr_t)objects[i]) & (__STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1));
+	}
+
+	malloc_get_stats(&after);
+
+	if(__STDCPP_DEFAULT_NEW_ALIGNMENT__ <= MALLOC_NATIVE_ALIGNMENT)
+	{
+		assert_true(after.free_blocks <= (before.free_blocks + 1));
+	}
+
+	for(size_t i = 0; i < OBJECT_COUNT; i++)
+	{
+		delete[] objects[i];
+	}
+
+	// Types at the default new alignment
+	for(size_t i = 0; i < OBJECT_COUNT; i++)
+	{
+		auto* value = new long double(i);
+		assert_false(((uintptr_t)value) & (alignof(long double) - 1));
+		objects[i] = reinterpret_cast<char*>(value);
+	}
+
+	for(size_t i = 0; i < OBJECT_COUNT; i++)
+	{
+		delete reinterpret_cast<long double*>(objects[i]);
+	}
+
+	// Over-aligned types come from the heap with their alignment
+	auto* aligned = new over_aligned_t;
+	assert_true(in_heap(aligned));
+	assert_false(((uintptr_t)aligned) & (alignof(over_aligned_t) - 1));
+	delete aligned;
+
+	// Sized deletes
+	void* ptr = ::operator new(64);
+	assert_true(in_heap(ptr));
+	::operator delete(ptr, 64);
+	ptr = ::operator new(64, std::align_val_t{128});
+	assert_false(((uintptr_t)ptr) & 127);
+	::operator delete(ptr, 64, std::align_val_t{128});
+
+	// Each zero-sized allocation is distinct
+	void* first = ::operator new(0);
+	void* second = ::operator new(0);
+	assert_ptr_not_equal(first, second);
+	::operator delete(first, size_t{0});
+	::operator delete(second, size_t{0});
+}
+
+static void* reserve_ = nullptr;
+static int handler_calls_ = 0;
+
+/// Release a reserve block, so the allocation succeeds when it is retried
+static void release_reserve()
+{
+	handler_calls_++;
+	free(reserve_);
+	reserve_ = nullptr;
+	std::set_new_handler(nullptr);
+}
+
+static void malloc_new_delete_failure_test([[maybe_unused]] void** state)
+{
+	volatile size_t huge = SIZE_MAX - 64;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	assert_null(new(std::nothrow) char[huge]);
+	assert_null(::operator new(huge, std::align_val_t{64}, std::nothrow));
+
+	bool thrown = false;
+	try
+	{
+		void* ptr = ::operator new(huge);
+		::operator delete(ptr);
+	}
+	catch(const std::bad_alloc&)
+	{
+		thrown = true;
+	}
+	assert_true(thrown);
+
+	// The new_handler is called until the allocation succeeds. Fill the heap so that only
+	// the reserve can satisfy the request.
+	reserve_ = malloc(1024);
+	assert_non_null(reserve_);
+
+	void* filler[MAX_FILLERS];
+	size_t filled = 0;
+	for(size_t size = block_size(); (size >= 64) && (filled < MAX_FILLERS); size /= 2)
+	{
+		while((filled < MAX_FILLERS) && (filler[filled] = malloc(size)))
+		{
+			filled++;
+		}
+	}
+
+	std::set_new_handler(release_reserve);
+	void* ptr = ::operator new(512);
+	assert_non_null(ptr);
+	assert_int_equal(handler_calls_, 1);
+	::operator delete(ptr, 512);
+
+	while(filled)
+	{
+		free(filler[--filled]);
+	}
+}
+
+static __attribute__((noinline)) char* new_from_callsite()
+{
+	char* ptr = new char[24];
+
+	// Writing to the object keeps the call to operator new from being a tail call
+	*ptr = 'n';
+
+	return ptr;
+}
+
+static void record_callsite(const malloc_callsite_t* callsite, void* context)
+{
+	*static_cast<malloc_callsite_t*>(context) = *callsite;
+}
+
+static void malloc_new_delete_profiler_test([[maybe_unused]] void** state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// An interval of 1 byte samples every allocation
+	malloc_profiler_enable(1, nullptr);
+
+	char* ptr = new_from_callsite();
+	malloc_callsite_t callsite = {};
+	malloc_profiler_dump(record_callsite, &callsite);
+
+	// The sample is charged to the new-expression, not to operator new
+	auto start = reinterpret_cast<uintptr_t>(&new_from_callsite);
+	auto frame = reinterpret_cast<uintptr_t>(callsite.frames[0]);
+	assert_int_equal(callsite.frame_cnt, 1);
+	assert_int_equal(callsite.live_samples, 1);
+	assert_true(frame > start);
+	assert_true(frame < start + CALLSITE_FUNCTION_SIZE);
+
+	delete[] ptr;
+	malloc_profiler_enable(0, nullptr);
+}
+
+int malloc_new_delete_tests(void)
+{
+	const struct CMUnitTest malloc_new_delete_test_suite[] = {
+		cmocka_unit_test(malloc_new_delete_test),
+		cmocka_unit_test(malloc_new_delete_failure_test),
+		cmocka_unit_test(malloc_new_delete_profiler_test)};
+
+	return cmocka_run_group_tests(malloc_new_delete_test_suite, NULL, NULL);
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <malloc_profiler.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define FAKE_FRAME ((void*)0x1234)
+
+typedef struct
+{
+	size_t callsites;
+	size_t live_bytes;
+	size_t live_samples;
+	size_t total_samples;
+	bool saw_fake_frame;
+} profile_totals_t;
+
+static __attribute__((noinline)) void* allocate_from_site_a(size_t size)
+{
+	char* ptr = malloc(size);
+
+	// Writing a distinct value keeps the call sites from being merged or tail-called
+	if(ptr)
+	{
+		*ptr = 'a';
+	}
+
+	return ptr;
+}
+
+static __attribute__((noinline)) void* allocate_from_site_b(size_t size)
+{
+	char* ptr = malloc(size);
+
+	// Writing a distinct value keeps the call sites from being merged or tail-called
+	if(ptr)
+	{
+		*ptr = 'b';
+	}
+
+	return ptr;
+}
+
+static size_t fake_unwinder(void** frames, size_t max_frames)
+{
+	assert_true(max_frames >= 2);
+	frames[0] = FAKE_FRAME;
+	frames[1] = FAKE_FRAME;
+	return 2;
+}
+
+static void sum_callsites(const malloc_callsite_t* callsite, void* context)
+{
+	profile_totals_t* totals = context;
+
+	totals->callsites++;
+	totals->live_bytes += callsite->live_bytes;
+	totals->live_samples += callsite->live_samples;
+	totals->total_samples += callsite->total_samples;
+
+	if(callsite->frame_cnt == 2 && callsite->frames[0] == FAKE_FRAME)
+	{
+		totals->saw_fake_frame = true;
+	}
+}
+
+static void malloc_profiler_test(void** __attribute__((unused)) state)
+{
+	profile_totals_t totals = {0};
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// Nothing is recorded while the profiler is disabled
+	free(malloc(64));
+	malloc_profiler_dump(sum_callsites, &totals);
+	assert_int_equal(totals.callsites, 0);
+
+	// An interval of 1 byte samples every allocation
+	malloc_profiler_enable(1, NULL);
+
+	void* a1 = allocate_from_site_a(64);
+	void* a2 = allocate_from_site_a(128);
+	void* b1 = allocate_from_site_b(256);
+	assert_non_null(a1);
+	assert_non_null(a2);
+	assert_non_null(b1);
+
+	// The sampled flag doesn't leak into the usable size
+	assert_true(malloc_usable_size(a1) >= 64);
+	assert_true(malloc_usable_size(a1) < 64 + 64);
+
+	malloc_profiler_dump(sum_callsites, &totals);
+	assert_int_equal(totals.callsites, 2);
+	assert_int_equal(totals.live_bytes, 64 + 128 + 256);
+	assert_int_equal(totals.live_samples, 3);
+	assert_int_equal(totals.total_samples, 3);
+
+	free(a1);
+	free(b1);
+
+	totals = (profile_totals_t){0};
+	malloc_profiler_dump(sum_callsites, &totals);
+	assert_int_equal(totals.live_bytes, 128);
+	assert_int_equal(totals.live_samples, 1);
+	assert_int_equal(totals.total_samples, 3);
+
+	// Re-enabling discards the previous samples, and frees of old samples are ignored
+	malloc_profiler_enable(1, fake_unwinder);
+	free(a2);
+
+	void* c1 = malloc(32);
+	assert_non_null(c1);
+
+	totals = (profile_totals_t){0};
+	malloc_profiler_dump(sum_callsites, &totals);
+	assert_int_equal(totals.callsites, 1);
+	assert_int_equal(totals.live_bytes, 32);
+	assert_true(totals.saw_fake_frame);
+
+	free(c1);
+
+	// With a large interval, only a fraction of the allocations are sampled
+	malloc_profiler_enable(4096, NULL);
+
+	for(int i = 0; i < 256; i++)
+	{
+		free(allocate_from_site_a(64));
+	}
+
+	totals = (profile_totals_t){0};
+	malloc_profiler_dump(sum_callsites, &totals);
+	assert_true(totals.total_samples > 0);
+	assert_true(totals.total_samples < 256);
+	assert_int_equal(totals.live_bytes, 0);
+	assert_int_equal(malloc_profiler_dropped_samples(), 0);
+
+	malloc_profiler_enable(0, NULL);
+}
+
+static void record_callsite(const malloc_callsite_t* callsite, void* context)
+{
+	*(malloc_callsite_t*)context = *callsite;
+}
+
+static void malloc_profiler_caller_test(void** __attribute__((unused)) state)
+{
+	malloc_callsite_t callsite;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	malloc_profiler_enable(1, NULL);
+
+	// Wrappers attribute their allocations to the caller they were given
+	void* ptrs[] = {
+		malloc_for_caller(64, FAKE_FRAME),
+		malloc_aligned_for_caller(64, 64, FAKE_FRAME),
+		malloc_aligned_unlocked_for_caller(128, 64, FAKE_FRAME),
+	};
+
+	callsite = (malloc_callsite_t){0};
+	malloc_profiler_dump(record_callsite, &callsite);
+	assert_int_equal(callsite.frame_cnt, 1);
+	assert_ptr_equal(callsite.frames[0], FAKE_FRAME);
+	assert_int_equal(callsite.live_samples, 3);
+	assert_int_equal(callsite.live_bytes, 3 * 64);
+	assert_true(((uintptr_t)ptrs[2] & 127) == 0);
+
+	for(size_t i = 0; i < (sizeof(ptrs) / sizeof(ptrs[0])); i++)
+	{
+		free(ptrs[i]);
+	}
+
+	malloc_profiler_enable(0, NULL);
+}
+
+int malloc_profiler_tests(void)
+{
+	const struct CMUnitTest malloc_profiler_test_suite[] = {
+		cmocka_unit_test(malloc_profiler_test),
+		cmocka_unit_test(malloc_profiler_caller_test)};
+
+	return cmocka_run_group_tests(malloc_profiler_test_suite, NULL, NULL);
+}
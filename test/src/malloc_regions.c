@@ -0,0 +1,110 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define REGION_SIZE 4096
+#define REGION_FAST 1
+#define REGION_SLOW 2
+
+static uint8_t fast_region[REGION_SIZE];
+static uint8_t slow_region[REGION_SIZE];
+
+static bool in_region(void* ptr, const uint8_t* region)
+{
+	return ((uintptr_t)ptr >= (uintptr_t)region) &&
+		   ((uintptr_t)ptr < ((uintptr_t)region + REGION_SIZE));
+}
+
+static bool in_default_block(void* ptr)
+{
+	return ((uintptr_t)ptr >= block_start_addr()) && ((uintptr_t)ptr < block_end_addr());
+}
+
+static void malloc_region_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	malloc_addblock_ex(fast_region, REGION_SIZE, REGION_FAST);
+	malloc_addblock_ex(slow_region, REGION_SIZE, REGION_SLOW);
+
+	// Targeted allocations land in the requested region
+	void* fast = malloc_region(REGION_FAST, 256);
+	assert_non_null(fast);
+	assert_true(in_region(fast, fast_region));
+
+	void* slow = malloc_region(REGION_SLOW, 256);
+	assert_non_null(slow);
+	assert_true(in_region(slow, slow_region));
+
+	// Requests which don't fit in the region fall back to other memory
+	void* large = malloc_region(REGION_FAST, 2 * REGION_SIZE);
+	assert_non_null(large);
+	assert_true(in_default_block(large));
+
+	free(fast);
+	free(slow);
+	free(large);
+
+	// The region is fully available again after free
+	fast = malloc_region(REGION_FAST, REGION_SIZE / 2);
+	assert_non_null(fast);
+	assert_true(in_region(fast, fast_region));
+	free(fast);
+
+	// malloc() honors the preference order
+	const unsigned slow_first[] = {REGION_SLOW, REGION_FAST};
+	malloc_region_preference(slow_first, 2);
+
+	void* ptr = malloc(128);
+	assert_non_null(ptr);
+	assert_true(in_region(ptr, slow_region));
+	free(ptr);
+
+	// malloc_region() falls back through the preference order
+	const unsigned fast_first[] = {REGION_FAST};
+	malloc_region_preference(fast_first, 1);
+
+	slow = malloc_region(REGION_SLOW, REGION_SIZE / 2);
+	assert_non_null(slow);
+	ptr = malloc_region(REGION_SLOW, REGION_SIZE / 2);
+	assert_non_null(ptr);
+	assert_true(in_region(ptr, fast_region));
+	free(ptr);
+	free(slow);
+
+	malloc_region_preference(NULL, 0);
+
+	// Hand the regions back so the remaining tests only use the default test block
+	assert_true(malloc_removeblock(fast_region, REGION_SIZE));
+	assert_true(malloc_removeblock(slow_region, REGION_SIZE));
+
+	ptr = malloc_region(REGION_FAST, 128);
+	assert_non_null(ptr);
+	assert_true(in_default_block(ptr));
+	free(ptr);
+}
+
+int malloc_region_tests(void)
+{
+	const struct CMUnitTest malloc_region_test_suite[] = {cmocka_unit_test(malloc_region_test)};
+
+	return cmocka_run_group_tests(malloc_region_test_suite, NULL, NULL);
+}
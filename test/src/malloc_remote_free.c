@@ -0,0 +1,241 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <malloc_heap.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+// Matches the default in malloc_freelist.c. The segments test build overrides this.
+#ifndef FREELIST_MAX_SEGMENTS
+#define FREELIST_MAX_SEGMENTS 0
+#endif
+
+#define SEGMENT_SIZE (16 * 1024)
+#define SEGMENT_SLACK 64
+#define BLOCK_COUNT 16
+
+/// Threads which release blocks into another thread's segment at the same time
+#define REMOTE_THREAD_COUNT 4
+#define BLOCKS_PER_THREAD 16
+
+#if FREELIST_MAX_SEGMENTS > 0
+/// Blocks which one thread releases, and the segment which owns them
+typedef struct
+{
+	heap_t* segment;
+	void* blocks[BLOCKS_PER_THREAD];
+} remote_free_work_t;
+
+static atomic_bool remote_free_start;
+static atomic_uint remote_free_done;
+
+static bool in_segment(const void* ptr, const void* segment)
+{
+	// The heap bookkeeping is near the start of the segment's memory, after any padding needed
+	// to align it. Blocks allocated from the segment are far from its end.
+	return ((uintptr_t)ptr > (uintptr_t)segment) &&
+		   ((uintptr_t)ptr < ((uintptr_t)segment + SEGMENT_SIZE - SEGMENT_SLACK));
+}
+
+static void* release_remotely(void* arg)
+{
+	remote_free_work_t* work = arg;
+
+	while(!atomic_load(&remote_free_start))
+	{
+	}
+
+	// Both ways of releasing segment memory push onto the same queue
+	for(size_t i = 0; i < BLOCKS_PER_THREAD; i++)
+	{
+		if(i & 1)
+		{
+			heap_free_remote(work->segment, work->blocks[i]);
+		}
+		else
+		{
+			free(work->blocks[i]);
+		}
+	}
+
+	atomic_fetch_add(&remote_free_done, 1);
+
+	return NULL;
+}
+#endif
+
+static void malloc_remote_free_test(void** __attribute__((unused)) state)
+{
+#if FREELIST_MAX_SEGMENTS > 0
+	void* blocks[BLOCK_COUNT];
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	heap_t* segment = heap_segment_create(SEGMENT_SIZE);
+	assert_non_null(segment);
+
+	for(size_t i = 0; i < BLOCK_COUNT; i++)
+	{
+		blocks[i] = heap_alloc(segment, 128);
+		assert_true(in_segment(blocks[i], segment));
+	}
+
+	// The default heap does not hand out segment memory
+	void* ptr = malloc(128);
+	assert_false(in_segment(ptr, segment));
+	free(ptr);
+
+	// free() queues segment memory for the owner, which merges it on the next allocation
+	for(size_t i = 0; i < BLOCK_COUNT; i += 2)
+	{
+		free(blocks[i]);
+	}
+
+	ptr = heap_alloc(segment, 128);
+	assert_ptr_equal(ptr, blocks[0]);
+	heap_free(segment, ptr);
+
+	// Explicit remote frees use the same queue
+	for(size_t i = 1; i < BLOCK_COUNT; i += 2)
+	{
+		heap_free_remote(segment, blocks[i]);
+	}
+
+	// Everything was merged back together
+	ptr = heap_alloc(segment, SEGMENT_SIZE / 2);
+	assert_ptr_equal(ptr, blocks[0]);
+	free(ptr);
+
+	heap_segment_destroy(segment);
+	heap_segment_destroy(NULL);
+
+	// The segment's memory was returned to the default heap
+	ptr = malloc(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+#else
+	assert_null(heap_segment_create(SEGMENT_SIZE));
+#endif
+}
+
+static void malloc_remote_free_limit_test(void** __attribute__((unused)) state)
+{
+#if FREELIST_MAX_SEGMENTS > 0
+	heap_t* segments[FREELIST_MAX_SEGMENTS];
+
+	for(size_t i = 0; i < FREELIST_MAX_SEGMENTS; i++)
+	{
+		segments[i] = heap_segment_create(8 * 1024);
+		assert_non_null(segments[i]);
+	}
+
+	assert_null(heap_segment_create(8 * 1024));
+
+	for(size_t i = 0; i < FREELIST_MAX_SEGMENTS; i++)
+	{
+		heap_segment_destroy(segments[i]);
+	}
+
+	// Slots are reused
+	heap_t* segment = heap_segment_create(8 * 1024);
+	assert_non_null(segment);
+	heap_segment_destroy(segment);
+#else
+	skip();
+#endif
+}
+
+static void malloc_remote_free_concurrent_test(void** __attribute__((unused)) state)
+{
+#if FREELIST_MAX_SEGMENTS > 0
+	remote_free_work_t work[REMOTE_THREAD_COUNT];
+	pthread_t threads[REMOTE_THREAD_COUNT];
+	void* first = NULL;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	heap_t* segment = heap_segment_create(SEGMENT_SIZE);
+	assert_non_null(segment);
+
+	for(size_t i = 0; i < REMOTE_THREAD_COUNT; i++)
+	{
+		work[i].segment = segment;
+
+		for(size_t j = 0; j < BLOCKS_PER_THREAD; j++)
+		{
+			work[i].blocks[j] = heap_alloc(segment, 128);
+			assert_true(in_segment(work[i].blocks[j], segment));
+
+			if(!first || (work[i].blocks[j] < first))
+			{
+				first = work[i].blocks[j];
+			}
+		}
+	}
+
+	atomic_store(&remote_free_start, false);
+	atomic_store(&remote_free_done, 0);
+
+	for(size_t i = 0; i < REMOTE_THREAD_COUNT; i++)
+	{
+		assert_int_equal(pthread_create(&threads[i], NULL, release_remotely, &work[i]), 0);
+	}
+
+	// The owner keeps draining the queue while the other threads push onto it
+	atomic_store(&remote_free_start, true);
+
+	while(atomic_load(&remote_free_done) < REMOTE_THREAD_COUNT)
+	{
+		void* ptr = heap_alloc(segment, 64);
+		assert_true(in_segment(ptr, segment));
+		heap_free(segment, ptr);
+	}
+
+	for(size_t i = 0; i < REMOTE_THREAD_COUNT; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	// No block was lost or released twice: once the rest of the queue is drained, the
+	// segment's memory is one free block again
+	void* ptr = heap_alloc(segment, SEGMENT_SIZE / 2);
+	assert_ptr_equal(ptr, first);
+	heap_free(segment, ptr);
+
+	heap_segment_destroy(segment);
+#else
+	skip();
+#endif
+}
+
+int malloc_remote_free_tests(void)
+{
+	const struct CMUnitTest malloc_remote_free_test_suite[] = {
+		cmocka_unit_test(malloc_remote_free_test),
+		cmocka_unit_test(malloc_remote_free_concurrent_test),
+		cmocka_unit_test(malloc_remote_free_limit_test)};
+
+	return cmocka_run_group_tests(malloc_remote_free_test_suite, NULL, NULL);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define SCRATCH_SIZE 8192
+#define SCRATCH_TAG 3
+
+static uint8_t scratch[SCRATCH_SIZE] __attribute__((aligned(16)));
+
+static size_t scratch_released = 0;
+static unsigned trim_callback_count = 0;
+
+static bool in_scratch(uintptr_t addr)
+{
+	return (addr >= (uintptr_t)scratch) && (addr < ((uintptr_t)scratch + SCRATCH_SIZE));
+}
+
+static void trim_callback(void* addr, size_t size, unsigned tag)
+{
+	trim_callback_count++;
+
+	if(in_scratch((uintptr_t)addr))
+	{
+		assert_int_equal(tag, SCRATCH_TAG);
+		assert_true(((uintptr_t)addr + size) <= ((uintptr_t)scratch + SCRATCH_SIZE));
+		scratch_released += size;
+	}
+	else
+	{
+		// Memory from the default test block is returned to the heap
+		malloc_addblock(addr, size);
+	}
+}
+
+static void malloc_removeblock_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	malloc_addblock_ex(scratch, SCRATCH_SIZE, SCRATCH_TAG);
+
+	// Memory which is in use cannot be removed
+	void* ptr = malloc_region(SCRATCH_TAG, 128);
+	assert_non_null(ptr);
+	assert_true(in_scratch((uintptr_t)ptr));
+	assert_false(malloc_removeblock(scratch, SCRATCH_SIZE));
+
+	free(ptr);
+
+	// Remove a hole in the middle, then the remaining pieces on either side
+	assert_true(malloc_removeblock(&scratch[2048], 1024));
+	assert_false(malloc_removeblock(&scratch[2048], 1024));
+
+	// The memory around the hole is still usable
+	ptr = malloc_region(SCRATCH_TAG, 1024);
+	assert_non_null(ptr);
+	assert_true(in_scratch((uintptr_t)ptr));
+	free(ptr);
+
+	assert_true(malloc_removeblock(scratch, 2048));
+	assert_true(malloc_removeblock(&scratch[3072], SCRATCH_SIZE - 3072));
+
+	// Nothing is left in the scratch area
+	ptr = malloc_region(SCRATCH_TAG, 128);
+	assert_non_null(ptr);
+	assert_false(in_scratch((uintptr_t)ptr));
+	free(ptr);
+}
+
+static void malloc_trim_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	scratch_released = 0;
+	trim_callback_count = 0;
+
+	malloc_addblock_ex(scratch, SCRATCH_SIZE, SCRATCH_TAG);
+
+	void* ptr = malloc_region(SCRATCH_TAG, 256);
+	assert_non_null(ptr);
+	assert_true(in_scratch((uintptr_t)ptr));
+
+	// Everything behind the allocation (minus the padding) is released
+	size_t released = malloc_trim(512, trim_callback);
+	assert_true(released > 0);
+	assert_true(trim_callback_count > 0);
+	assert_true(scratch_released > 0);
+	assert_true(scratch_released < (SCRATCH_SIZE - 256 - 512));
+
+	free(ptr);
+
+	// Once the region is entirely free, it is fully released
+	malloc_trim(0, trim_callback);
+	assert_int_equal(scratch_released, SCRATCH_SIZE);
+
+	ptr = malloc_region(SCRATCH_TAG, 128);
+	assert_non_null(ptr);
+	assert_false(in_scratch((uintptr_t)ptr));
+	free(ptr);
+}
+
+int malloc_removeblock_tests(void)
+{
+	const struct CMUnitTest malloc_removeblock_test_suite[] = {
+		cmocka_unit_test(malloc_removeblock_test),
+		cmocka_unit_test(malloc_trim_test),
+	};
+
+	return cmocka_run_group_tests(malloc_removeblock_test_suite, NULL, NULL);
+}
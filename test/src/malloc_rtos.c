@@ -0,0 +1,99 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <support/rtos_host.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define TIMEOUT_TICKS 20
+#define RELEASE_DELAY_TICKS 10
+
+static void* release_after_delay(void* ptr)
+{
+	rtos_host_sleep(RELEASE_DELAY_TICKS);
+	free(ptr);
+	return NULL;
+}
+
+static void malloc_rtos_test(void** __attribute__((unused)) state)
+{
+	void* ptr = malloc(64);
+	assert_non_null(ptr);
+	assert_in_range((uintptr_t)ptr, block_start_addr(), block_end_addr());
+	free(ptr);
+
+	assert_null(malloc(0));
+	assert_null(malloc_try(0));
+	free(NULL);
+
+	// Memory which is released can be allocated again
+	for(size_t i = 0; i < 4; i++)
+	{
+		ptr = malloc(block_size() / 2);
+		assert_non_null(ptr);
+		free(ptr);
+	}
+}
+
+static void malloc_rtos_try_test(void** __attribute__((unused)) state)
+{
+	void* held = malloc_try(block_size() / 2);
+	assert_non_null(held);
+
+	// The request would block in malloc()
+	assert_null(malloc_try(block_size() / 2));
+	assert_null(malloc_timed(block_size() / 2, 0));
+
+	free(held);
+
+	void* ptr = malloc_try(block_size() / 2);
+	assert_non_null(ptr);
+	free(ptr);
+}
+
+static void malloc_rtos_timed_test(void** __attribute__((unused)) state)
+{
+	void* held = malloc(block_size() / 2);
+	assert_non_null(held);
+
+	// Nothing is released, so the request times out
+	uint32_t start = rtos_host_tick_count();
+	assert_null(malloc_timed(block_size() / 2, TIMEOUT_TICKS));
+	assert_true((rtos_host_tick_count() - start) >= (TIMEOUT_TICKS - 1));
+
+	// Another task releases memory while the request waits
+	pthread_t thread;
+	assert_int_equal(pthread_create(&thread, NULL, release_after_delay, held), 0);
+
+	start = rtos_host_tick_count();
+	void* ptr = malloc_timed(block_size() / 2, MALLOC_WAIT_FOREVER);
+	assert_non_null(ptr);
+	assert_true((rtos_host_tick_count() - start) >= (RELEASE_DELAY_TICKS - 1));
+
+	pthread_join(thread, NULL);
+	free(ptr);
+}
+
+int malloc_rtos_tests(void)
+{
+	const struct CMUnitTest malloc_rtos_test_suite[] = {
+		cmocka_unit_test(malloc_rtos_test),
+		cmocka_unit_test(malloc_rtos_try_test),
+		cmocka_unit_test(malloc_rtos_timed_test),
+	};
+
+	return cmocka_run_group_tests(malloc_rtos_test_suite, NULL, NULL);
+}
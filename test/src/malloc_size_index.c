@@ -0,0 +1,162 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+// Matches the default in malloc_freelist.c. The deferred free test build overrides this.
+#ifndef FREELIST_DEFERRED_FREE_SLOTS
+#define FREELIST_DEFERRED_FREE_SLOTS 0
+#endif
+
+// Matches the default in malloc_freelist.c. The indexed test build overrides this.
+#ifndef FREELIST_SIZE_INDEX_ENTRIES
+#define FREELIST_SIZE_INDEX_ENTRIES 0
+#endif
+
+#if FREELIST_DEFERRED_FREE_SLOTS == 0
+#define REGION_TAG 0x51
+#define MAX_HOLES 48
+
+static uint8_t region[64 * 1024] __attribute__((aligned(16)));
+static char* blocks[2 * MAX_HOLES];
+
+/**
+ * Sizes of the holes left in the region. They vary so that first fit is not trivial, but
+ * differ by less than the minimum split size, so a hole is never split.
+ */
+static size_t hole_size(size_t i)
+{
+	return 64 + (((i * 37) % 3) * 16);
+}
+
+/**
+ * Number of holes to leave in the region. The index is only searched while there are at most
+ * half as many free blocks as index entries, so the holes are limited to keep it in use.
+ */
+static size_t hole_count(void)
+{
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	malloc_stats_t stats;
+	malloc_get_stats(&stats);
+
+	size_t limit = (FREELIST_SIZE_INDEX_ENTRIES / 2);
+	limit = (limit > stats.free_blocks) ? (limit - stats.free_blocks) : 0;
+
+	return (limit < MAX_HOLES) ? limit : MAX_HOLES;
+#else
+	return MAX_HOLES;
+#endif
+}
+#endif
+
+static void malloc_size_index_test(void** __attribute__((unused)) state)
+{
+#if FREELIST_DEFERRED_FREE_SLOTS > 0
+	// Recently freed blocks are reused before first fit is applied
+	skip();
+#else
+	char* taken[MAX_HOLES];
+	size_t taken_cnt = 0;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	malloc_addblock_ex(region, sizeof(region), REGION_TAG);
+
+	const size_t block_cnt = 2 * hole_count();
+	assert_true(block_cnt > 0);
+
+	for(size_t i = 0; i < block_cnt; i++)
+	{
+		blocks[i] = malloc_region(REGION_TAG, (i % 2) ? 32 : hole_size(i));
+		assert_non_null(blocks[i]);
+	}
+
+	// Leave holes of varying sizes, separated by allocated blocks
+	for(size_t i = 0; i < block_cnt; i += 2)
+	{
+		free(blocks[i]);
+	}
+
+#if FREELIST_SIZE_INDEX_ENTRIES > 0
+	// The requests below are served by the size index, not by walking the free list
+	malloc_stats_t stats;
+	malloc_get_stats(&stats);
+	assert_true(stats.free_blocks <= (FREELIST_SIZE_INDEX_ENTRIES / 2));
+#endif
+
+	// Every request gets the lowest-addressed hole which is large enough, as a walk of the
+	// free list would find. Requests which don't fit in any hole come from the end of the region.
+	for(size_t request = 96; taken_cnt < (block_cnt / 2);
+		request = (request > 64) ? (request - 16) : 96)
+	{
+		size_t expected = block_cnt;
+
+		for(size_t i = 0; i < block_cnt; i += 2)
+		{
+			if(blocks[i] && (hole_size(i) >= request))
+			{
+				expected = i;
+				break;
+			}
+		}
+
+		char* ptr = malloc_region(REGION_TAG, request);
+		assert_non_null(ptr);
+
+		if(expected < block_cnt)
+		{
+			assert_ptr_equal(ptr, blocks[expected]);
+			blocks[expected] = NULL;
+		}
+		else
+		{
+			assert_true(ptr > blocks[block_cnt - 1]);
+		}
+
+		taken[taken_cnt++] = ptr;
+	}
+
+	// Requests which don't fit in any hole come from the end of the region
+	char* large = malloc_region(REGION_TAG, 1024);
+	assert_non_null(large);
+	assert_true(large > blocks[block_cnt - 1]);
+	free(large);
+
+	for(size_t i = 0; i < taken_cnt; i++)
+	{
+		free(taken[i]);
+	}
+
+	for(size_t i = 1; i < block_cnt; i += 2)
+	{
+		free(blocks[i]);
+	}
+
+	assert_true(malloc_removeblock(region, sizeof(region)));
+#endif
+}
+
+int malloc_size_index_tests(void)
+{
+	const struct CMUnitTest malloc_size_index_test_suite[] = {
+		cmocka_unit_test(malloc_size_index_test)};
+
+	return cmocka_run_group_tests(malloc_size_index_test_suite, NULL, NULL);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+// Matches the default in malloc_freelist.c. The deferred test build overrides this.
+#ifndef FREELIST_DEFERRED_FREE_SLOTS
+#define FREELIST_DEFERRED_FREE_SLOTS 0
+#endif
+
+#define ALLOCATION_SIZE 1024
+
+static void malloc_stats_test(void** __attribute__((unused)) state)
+{
+	malloc_stats_t before;
+	malloc_stats_t during;
+	malloc_stats_t after;
+
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// The earlier tests have exercised every path which changes the free list, and the
+	// running totals are checked against it
+	malloc_get_stats(&before);
+	assert_true(before.free_blocks > 0);
+	assert_true(before.smallest_free_block <= before.largest_free_block);
+	assert_true(before.largest_free_block <= before.free_bytes);
+	assert_true(before.min_free_bytes <= before.free_bytes);
+	assert_true(before.frees <= before.allocations);
+	assert_int_equal(malloc_free_bytes(), before.free_bytes);
+	assert_int_equal(malloc_min_free_bytes(), before.min_free_bytes);
+
+	void* ptr = malloc(ALLOCATION_SIZE);
+	assert_non_null(ptr);
+
+	malloc_get_stats(&during);
+#if FREELIST_DEFERRED_FREE_SLOTS == 0
+	// Otherwise, malloc() may merge the deferred free buffer into the free list
+	assert_true(during.free_bytes <= (before.free_bytes - ALLOCATION_SIZE));
+#endif
+	assert_true(during.min_free_bytes <= during.free_bytes);
+	assert_int_equal(malloc_free_bytes(), during.free_bytes);
+	assert_int_equal(malloc_min_free_bytes(), during.min_free_bytes);
+	assert_int_equal(during.allocations, before.allocations + 1);
+	assert_int_equal(during.frees, before.frees);
+
+	free(ptr);
+
+	malloc_get_stats(&after);
+	assert_int_equal(after.allocations, during.allocations);
+	assert_int_equal(after.frees, during.frees + 1);
+	assert_true(after.min_free_bytes <= during.free_bytes);
+#if FREELIST_DEFERRED_FREE_SLOTS == 0
+	assert_int_equal(after.free_bytes, before.free_bytes);
+#endif
+}
+
+int malloc_stats_tests(void)
+{
+	const struct CMUnitTest malloc_stats_test_suite[] = {cmocka_unit_test(malloc_stats_test)};
+
+	return cmocka_run_group_tests(malloc_stats_test_suite, NULL, NULL);
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <support/rtos_host.h>
+#include <support/threadx_host.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+// Matches the definitions in malloc_threadx.c. The test builds may override the policy.
+#define THREADX_POOL_SIZE_ROUTED 1
+
+#ifndef THREADX_POOL_POLICY
+#define THREADX_POOL_POLICY 0
+#endif
+
+#ifndef THREADX_POOL_ROUTE_THRESHOLD
+#define THREADX_POOL_ROUTE_THRESHOLD 256
+#endif
+
+/// Memory for a second byte pool, which is added by the multiple pool tests
+#define SECOND_POOL_SIZE (64 * 1024)
+
+/// Requests of this size are served from the first pool by both policies. They are larger
+/// than the block pools in the block pool test build.
+#define SMALL_REQUEST 200
+
+/// Smallest request which the pools are filled with
+#define FILL_SIZE 256
+#define MAX_HELD 128
+
+#define WAIT_TIMEOUT_TICKS 1000
+#define RELEASE_DELAY_TICKS 10
+
+static uint8_t second_pool[SECOND_POOL_SIZE] __attribute__((aligned(16)));
+
+static bool in_first_pool(const void* ptr)
+{
+	return ((uintptr_t)ptr >= block_start_addr()) && ((uintptr_t)ptr < block_end_addr());
+}
+
+static bool in_second_pool(const void* ptr)
+{
+	return ((uintptr_t)ptr >= (uintptr_t)second_pool) &&
+		   ((uintptr_t)ptr < ((uintptr_t)second_pool + SECOND_POOL_SIZE));
+}
+
+static void add_second_pool(void)
+{
+	static bool added = false;
+
+	if(!added)
+	{
+		malloc_addblock(second_pool, SECOND_POOL_SIZE);
+		added = true;
+	}
+}
+
+static void* release_after_delay(void* ptr)
+{
+	rtos_host_sleep(RELEASE_DELAY_TICKS);
+	free(ptr);
+	return NULL;
+}
+
+#ifdef THREADX_BLOCK_POOL_SIZES
+/// The same configuration as the library, which gets these from the test build
+static const ULONG block_pool_sizes[] = THREADX_BLOCK_POOL_SIZES;
+static const ULONG block_pool_counts[] = THREADX_BLOCK_POOL_COUNTS;
+
+#define BLOCK_POOL_CNT (sizeof(block_pool_sizes) / sizeof(block_pool_sizes[0]))
+
+/// Largest number of blocks in any class, which the test allocates at once
+#define MAX_BLOCKS 64
+
+/// Allocate `size` bytes and return the block pool which served the request
+static TX_BLOCK_POOL* allocate_block(size_t size, void** ptr)
+{
+	*ptr = malloc(size);
+	assert_non_null(*ptr);
+
+	return threadx_host_block_pool_of(*ptr);
+}
+#endif
+
+static void malloc_threadx_block_pool_test(void** __attribute__((unused)) state)
+{
+#ifdef THREADX_BLOCK_POOL_SIZES
+	TX_BLOCK_POOL* pools[BLOCK_POOL_CNT];
+	void* blocks[BLOCK_POOL_CNT][MAX_BLOCKS];
+	void* ptr = NULL;
+
+	// Each request is served by the smallest class which fits
+	for(size_t i = 0; i < BLOCK_POOL_CNT; i++)
+	{
+		assert_true(block_pool_counts[i] <= MAX_BLOCKS);
+
+		pools[i] = allocate_block(block_pool_sizes[i], &ptr);
+		assert_non_null(pools[i]);
+		assert_true(pools[i]->tx_block_pool_block_size >= block_pool_sizes[i]);
+		assert_true((i == 0) || (pools[i] != pools[i - 1]));
+		free(ptr);
+
+		assert_ptr_equal(allocate_block(block_pool_sizes[i] - 1, &ptr), pools[i]);
+		free(ptr);
+	}
+
+	// Larger requests fall back to the byte pool
+	ptr = malloc(block_pool_sizes[BLOCK_POOL_CNT - 1] + 1);
+	assert_non_null(ptr);
+	assert_null(threadx_host_block_pool_of(ptr));
+	assert_non_null(threadx_host_byte_pool_of(ptr));
+	free(ptr);
+
+	// Once a class is empty, the next larger class with a free block is used, and then the
+	// byte pool
+	for(size_t i = 0; i < BLOCK_POOL_CNT; i++)
+	{
+		for(size_t j = 0; j < block_pool_counts[i]; j++)
+		{
+			assert_ptr_equal(allocate_block(block_pool_sizes[0], &blocks[i][j]), pools[i]);
+		}
+
+		assert_int_equal(pools[i]->tx_block_pool_available, 0);
+	}
+
+	ptr = malloc(block_pool_sizes[0]);
+	assert_non_null(ptr);
+	assert_non_null(threadx_host_byte_pool_of(ptr));
+	free(ptr);
+
+	// free() returns each block to the pool which owns it
+	for(size_t i = 0; i < BLOCK_POOL_CNT; i++)
+	{
+		for(size_t j = 0; j < block_pool_counts[i]; j++)
+		{
+			free(blocks[i][j]);
+			assert_int_equal(pools[i]->tx_block_pool_available, j + 1);
+		}
+
+		assert_int_equal(pools[i]->tx_block_pool_available, pools[i]->tx_block_pool_total);
+	}
+
+	assert_ptr_equal(allocate_block(block_pool_sizes[0], &ptr), pools[0]);
+	free(ptr);
+#else
+	skip();
+#endif
+}
+
+static void malloc_threadx_pool_policy_test(void** __attribute__((unused)) state)
+{
+	add_second_pool();
+
+	// Small requests use the first pool with space
+	void* small = malloc(SMALL_REQUEST);
+	assert_true(in_first_pool(small));
+
+	// Large requests are routed to the last pool, which keeps them apart from small ones
+	void* large = malloc(THREADX_POOL_ROUTE_THRESHOLD + 1);
+
+	if(THREADX_POOL_POLICY == THREADX_POOL_SIZE_ROUTED)
+	{
+		assert_true(in_second_pool(large));
+	}
+	else
+	{
+		assert_true(in_first_pool(large));
+	}
+
+	free(large);
+	free(small);
+}
+
+static void malloc_threadx_multiple_pool_test(void** __attribute__((unused)) state)
+{
+	void* held[MAX_HELD];
+	size_t held_cnt = 0;
+	void* second_held = NULL;
+
+	add_second_pool();
+
+	// Fill both pools. Once the first pool is full, requests are served by the second one.
+	for(size_t size = block_size(); size >= FILL_SIZE; size /= 2)
+	{
+		while((held_cnt < MAX_HELD) && (held[held_cnt] = malloc_try(size)))
+		{
+			if(in_second_pool(held[held_cnt]))
+			{
+				second_held = held[held_cnt];
+			}
+			else
+			{
+				assert_true(in_first_pool(held[held_cnt]));
+			}
+
+			held_cnt++;
+		}
+	}
+
+	assert_null(malloc_try(FILL_SIZE));
+	assert_non_null(second_held);
+
+	TX_BYTE_POOL* first = threadx_host_byte_pool_of(held[0]);
+	TX_BYTE_POOL* second = threadx_host_byte_pool_of(second_held);
+	assert_non_null(first);
+	assert_non_null(second);
+	assert_ptr_not_equal(first, second);
+
+	// A request which waits on the first pool is woken when memory is released to the second
+	pthread_t thread;
+	assert_int_equal(pthread_create(&thread, NULL, release_after_delay, second_held), 0);
+
+	uint32_t start = rtos_host_tick_count();
+	void* ptr = malloc_timed(FILL_SIZE, WAIT_TIMEOUT_TICKS);
+	assert_true(in_second_pool(ptr));
+	assert_true((rtos_host_tick_count() - start) < (WAIT_TIMEOUT_TICKS / 2));
+
+	pthread_join(thread, NULL);
+
+	// The released block was reused, so the held pointer is replaced
+	for(size_t i = 0; i < held_cnt; i++)
+	{
+		if(held[i] == second_held)
+		{
+			held[i] = ptr;
+		}
+	}
+
+	// free() returns memory to the pool which contains it
+	for(size_t i = 0; i < held_cnt; i++)
+	{
+		TX_BYTE_POOL* owner = in_second_pool(held[i]) ? second : first;
+		TX_BYTE_POOL* other = (owner == first) ? second : first;
+		ULONG owner_available = owner->tx_byte_pool_available;
+		ULONG other_available = other->tx_byte_pool_available;
+
+		assert_ptr_equal(threadx_host_byte_pool_of(held[i]), owner);
+		free(held[i]);
+
+		assert_true(owner->tx_byte_pool_available > owner_available);
+		assert_int_equal(other->tx_byte_pool_available, other_available);
+	}
+}
+
+int malloc_threadx_tests(void)
+{
+	const struct CMUnitTest malloc_threadx_test_suite[] = {
+		cmocka_unit_test(malloc_threadx_block_pool_test),
+		cmocka_unit_test(malloc_threadx_pool_policy_test),
+		cmocka_unit_test(malloc_threadx_multiple_pool_test),
+	};
+
+	return cmocka_run_group_tests(malloc_threadx_test_suite, NULL, NULL);
+}
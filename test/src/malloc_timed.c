@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <support/memory.h>
+#include <tests.h>
+
+// CMocka needs these
+// clang-format off
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <cmocka.h>
+// clang-format on
+
+#define TIMEOUT_TICKS 10
+
+/// Block which the wait hook releases, standing in for another task
+static void* held_block;
+static uint32_t ticks;
+static unsigned wait_calls;
+static unsigned release_calls;
+static bool released;
+
+static bool test_wait(uint32_t timeout_ticks)
+{
+	assert_true(timeout_ticks <= TIMEOUT_TICKS);
+	wait_calls++;
+
+	if(held_block)
+	{
+		free(held_block);
+		held_block = NULL;
+	}
+
+	// Without a release, time out. A real hook would block here.
+	if(!released)
+	{
+		ticks += timeout_ticks;
+		return false;
+	}
+
+	released = false;
+	ticks++;
+	return true;
+}
+
+static void test_release(void)
+{
+	release_calls++;
+	released = true;
+}
+
+static uint32_t test_ticks(void)
+{
+	return ticks;
+}
+
+/// Wake without releasing anything that fits, like a free() of a small block
+static bool spurious_wait(uint32_t timeout_ticks)
+{
+	assert_int_equal(timeout_ticks, TIMEOUT_TICKS);
+
+	// Give up eventually, so that a failure doesn't hang the test
+	return (++wait_calls < 100);
+}
+
+static size_t largest_free_block(void)
+{
+	malloc_stats_t stats;
+	malloc_get_stats(&stats);
+	return stats.largest_free_block;
+}
+
+static void malloc_timed_test(void** __attribute__((unused)) state)
+{
+	// Make sure memory was previously allocated
+	if(!memory_allocated())
+	{
+		allocate_memory();
+	}
+
+	// Without hooks, malloc_timed() does not wait
+	assert_null(malloc_timed(2 * block_size(), TIMEOUT_TICKS));
+
+	void* ptr = malloc_try(128);
+	assert_non_null(ptr);
+	free(ptr);
+	assert_null(malloc_try(2 * block_size()));
+
+	malloc_set_wait_hooks(test_wait, test_release, test_ticks);
+	wait_calls = 0;
+	release_calls = 0;
+
+	// The request is satisfied once another task releases memory
+	size_t size = largest_free_block();
+	held_block = malloc(size);
+	assert_non_null(held_block);
+
+	ptr = malloc_timed(size, TIMEOUT_TICKS);
+	assert_non_null(ptr);
+	assert_int_equal(wait_calls, 1);
+	assert_int_equal(release_calls, 1);
+	free(ptr);
+
+	// Frees without a waiter don't signal
+	assert_int_equal(release_calls, 1);
+
+	// The request fails once the timeout elapses
+	wait_calls = 0;
+	uint32_t start = ticks;
+	assert_null(malloc_timed(2 * block_size(), TIMEOUT_TICKS));
+	assert_int_equal(wait_calls, 1);
+	assert_int_equal(ticks - start, TIMEOUT_TICKS);
+
+	// A zero timeout does not wait
+	wait_calls = 0;
+	assert_null(malloc_timed(2 * block_size(), 0));
+	assert_null(malloc_timed(0, TIMEOUT_TICKS));
+	assert_int_equal(wait_calls, 0);
+
+	// Without a tick source, the elapsed time is unknown, so a finite timeout waits only once
+	malloc_set_wait_hooks(spurious_wait, test_release, NULL);
+	wait_calls = 0;
+	assert_null(malloc_timed(2 * block_size(), TIMEOUT_TICKS));
+	assert_int_equal(wait_calls, 1);
+
+	malloc_set_wait_hooks(NULL, NULL, NULL);
+}
+
+int malloc_timed_tests(void)
+{
+	const struct CMUnitTest malloc_timed_test_suite[] = {cmocka_unit_test(malloc_timed_test)};
+
+	return cmocka_run_group_tests(malloc_timed_test_suite, NULL, NULL);
+}
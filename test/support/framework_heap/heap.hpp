@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef FRAMEWORK_HEAP_MOCK_HPP_
+#define FRAMEWORK_HEAP_MOCK_HPP_
+
+/**
+ * NOTE: Stand-in for the Embedded Virtual Machine framework's os::Heap.
+ *
+ * Each test build of malloc_framework_rtos.cpp selects which of the optional members the
+ *	heap provides with MOCK_HEAP_MEMBERS, so each of the adapter's paths is compiled. The heap
+ *	bumps a pointer through the block which was added, and never reuses memory. It counts the
+ *	calls to each member, so tests can check which one the adapter used.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/// Only alloc() and free()
+#define MOCK_HEAP_MINIMAL 0
+/// Adds usableSize()
+#define MOCK_HEAP_USABLE_SIZE 1
+/// Adds allocAligned(), a sized free(), and realloc()
+#define MOCK_HEAP_FULL 2
+
+#ifndef MOCK_HEAP_MEMBERS
+#define MOCK_HEAP_MEMBERS MOCK_HEAP_FULL
+#endif
+
+namespace os
+{
+class Heap
+{
+  public:
+	/// Number of calls to each member
+	struct Calls
+	{
+		std::size_t alloc;
+		std::size_t alloc_aligned;
+		std::size_t free;
+		std::size_t free_sized;
+		std::size_t realloc;
+		std::size_t usable_size;
+		/// Size which was passed to the last sized free()
+		std::size_t last_free_size;
+	};
+
+	static inline Calls calls = {};
+
+	static void addBlock(void* addr, std::size_t size)
+	{
+		pos_ = reinterpret_cast<uintptr_t>(addr);
+		end_ = pos_ + size;
+	}
+
+	static void init() {}
+
+	static void* alloc(std::size_t size)
+	{
+		calls.alloc++;
+		return carve(size, alignof(std::max_align_t));
+	}
+
+	static void free(void* ptr)
+	{
+		calls.free++;
+		(void)ptr;
+	}
+
+#if MOCK_HEAP_MEMBERS >= MOCK_HEAP_USABLE_SIZE
+	static std::size_t usableSize(void* ptr)
+	{
+		calls.usable_size++;
+		return size_of(ptr);
+	}
+#endif
+
+#if MOCK_HEAP_MEMBERS >= MOCK_HEAP_FULL
+	static void* allocAligned(std::size_t align, std::size_t size)
+	{
+		calls.alloc_aligned++;
+		return carve(size, align);
+	}
+
+	static void free(void* ptr, std::size_t size)
+	{
+		calls.free_sized++;
+		calls.last_free_size = size;
+		(void)ptr;
+	}
+
+	static void* realloc(void* ptr, std::size_t size)
+	{
+		calls.realloc++;
+
+		if(size == 0)
+		{
+			free(ptr);
+			return nullptr;
+		}
+
+		void* new_ptr = carve(size, alignof(std::max_align_t));
+
+		if(ptr && new_ptr)
+		{
+			std::memcpy(new_ptr, ptr, (size < size_of(ptr)) ? size : size_of(ptr));
+		}
+
+		return new_ptr;
+	}
+#endif
+
+  private:
+	/// The size of each allocation is stored in front of it
+	static constexpr std::size_t header_size = alignof(std::max_align_t);
+
+	static inline uintptr_t pos_ = 0;
+	static inline uintptr_t end_ = 0;
+
+	static std::size_t size_of(void* ptr)
+	{
+		std::size_t size;
+		std::memcpy(&size, static_cast<uint8_t*>(ptr) - header_size, sizeof(size));
+
+		return size;
+	}
+
+	static void* carve(std::size_t size, std::size_t align)
+	{
+		uintptr_t start = (pos_ + header_size + (align - 1)) & ~(uintptr_t)(align - 1);
+
+		if((start > end_) || ((end_ - start) < size))
+		{
+			return nullptr;
+		}
+
+		std::memcpy(reinterpret_cast<void*>(start - header_size), &size, sizeof(size));
+		pos_ = start + size;
+
+		return reinterpret_cast<void*>(start);
+	}
+};
+} // namespace os
+
+#endif // FRAMEWORK_HEAP_MOCK_HPP_
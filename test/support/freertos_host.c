@@ -0,0 +1,135 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This file is a host stand-in for the FreeRTOS kernel services used by malloc_freertos.c
+ * and malloc_freertos_provider.c. The heap_5.c style heap is in freertos_host_heap.c.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <support/rtos_host.h>
+
+#pragma mark - Definitions -
+
+/// Event group state, which is stored in a StaticEventGroup_t
+typedef struct
+{
+	EventBits_t bits;
+} event_group_t;
+
+_Static_assert(sizeof(event_group_t) <= sizeof(StaticEventGroup_t),
+			   "The event group must fit in StaticEventGroup_t");
+
+#pragma mark - Event Groups -
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t* pxEventGroupBuffer)
+{
+	event_group_t* group = (event_group_t*)pxEventGroupBuffer;
+	group->bits = 0;
+
+	return group;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor,
+								const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits,
+								TickType_t xTicksToWait)
+{
+	event_group_t* group = xEventGroup;
+	uint32_t start = rtos_host_tick_count();
+	uint32_t ticks = (xTicksToWait == portMAX_DELAY) ? RTOS_HOST_WAIT_FOREVER : xTicksToWait;
+	bool satisfied = false;
+
+	rtos_host_lock();
+
+	for(;;)
+	{
+		EventBits_t set = group->bits & uxBitsToWaitFor;
+		satisfied = xWaitForAllBits ? (set == uxBitsToWaitFor) : (set != 0);
+
+		if(satisfied || (xTicksToWait == 0) || !rtos_host_wait(start, ticks))
+		{
+			break;
+		}
+	}
+
+	EventBits_t bits = group->bits;
+
+	if(satisfied && xClearOnExit)
+	{
+		group->bits &= ~uxBitsToWaitFor;
+	}
+
+	rtos_host_unlock();
+
+	return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear)
+{
+	event_group_t* group = xEventGroup;
+
+	rtos_host_lock();
+	EventBits_t bits = group->bits;
+	group->bits &= ~uxBitsToClear;
+	rtos_host_unlock();
+
+	return bits;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet)
+{
+	event_group_t* group = xEventGroup;
+
+	rtos_host_lock();
+	group->bits |= uxBitsToSet;
+	EventBits_t bits = group->bits;
+	rtos_host_notify();
+	rtos_host_unlock();
+
+	return bits;
+}
+
+#pragma mark - Tasks and Time -
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)rtos_host_tick_count();
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+	rtos_host_sleep((uint32_t)xTicksToDelay);
+}
+
+void vTaskSuspendAll(void)
+{
+	rtos_host_lock();
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+	rtos_host_unlock();
+
+	return pdFALSE;
+}
+
+void vPortYield(void)
+{
+	rtos_host_yield();
+}
+
+void vPortEnterCritical(void)
+{
+	rtos_host_lock();
+}
+
+void vPortExitCritical(void)
+{
+	rtos_host_unlock();
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This file is a host stand-in for the FreeRTOS heap used by malloc_freertos.c. Tests of
+ * the freelist FreeRTOS heap provider, which replaces it, link the provider instead.
+ *
+ * The heap follows heap_5.c: vPortDefineHeapRegions() puts each region on one free list, which
+ * is sorted by address. pvPortMalloc() takes the first block which fits, and vPortFree() merges
+ * the block with its free neighbors. Blocks are aligned for the host's max_align_t instead of
+ * portBYTE_ALIGNMENT.
+ */
+
+#include <assert.h>
+#include <freertos/FreeRTOS.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <support/rtos_host.h>
+
+#pragma mark - Definitions -
+
+/// Header in front of each heap block, which links free blocks together
+typedef struct block_link
+{
+	struct block_link* next_free;
+	/// Size of the block, including this header. The top bit is set while it is allocated.
+	size_t size;
+} block_link_t;
+
+#define HEAP_ALIGNMENT (2 * sizeof(void*))
+#define BLOCK_ALLOCATED_BIT ((size_t)1 << ((sizeof(size_t) * 8) - 1))
+
+/// Blocks are not split if the remainder could not hold a header and a small allocation
+#define MINIMUM_BLOCK_SIZE (2 * sizeof(block_link_t))
+
+#define align_up(num, align) (((num) + ((align)-1)) & ~((align)-1))
+
+_Static_assert(sizeof(block_link_t) == HEAP_ALIGNMENT, "Headers must keep blocks aligned");
+
+#pragma mark - Declarations -
+
+/// Free blocks sorted by address. The list starts at free_list_.next_free, and ends with NULL.
+static block_link_t free_list_;
+
+static size_t free_bytes_ = 0;
+static size_t min_free_bytes_ = 0;
+
+#pragma mark - Private Functions -
+
+/// Put a block back on the free list, merging it with its neighbors. Call with the lock held.
+static void insert_free_block(block_link_t* block)
+{
+	block_link_t* prev = &free_list_;
+
+	while(prev->next_free && (prev->next_free < block))
+	{
+		prev = prev->next_free;
+	}
+
+	block_link_t* next = prev->next_free;
+
+	if(next && (((uintptr_t)block + block->size) == (uintptr_t)next))
+	{
+		block->size += next->size;
+		next = next->next_free;
+	}
+
+	if((prev != &free_list_) && (((uintptr_t)prev + prev->size) == (uintptr_t)block))
+	{
+		prev->size += block->size;
+		prev->next_free = next;
+	}
+	else
+	{
+		block->next_free = next;
+		prev->next_free = block;
+	}
+}
+
+#pragma mark - Heap -
+
+void vPortDefineHeapRegions(const HeapRegion_t* const pxHeapRegions)
+{
+	rtos_host_lock();
+
+	for(const HeapRegion_t* region = pxHeapRegions; region->xSizeInBytes > 0; region++)
+	{
+		uintptr_t start = align_up((uintptr_t)region->pucStartAddress, HEAP_ALIGNMENT);
+		uintptr_t end =
+			((uintptr_t)region->pucStartAddress + region->xSizeInBytes) & ~(HEAP_ALIGNMENT - 1);
+
+		if((end > start) && ((end - start) >= MINIMUM_BLOCK_SIZE))
+		{
+			block_link_t* block = (block_link_t*)start;
+			block->size = end - start;
+			free_bytes_ += block->size;
+			insert_free_block(block);
+		}
+	}
+
+	min_free_bytes_ = free_bytes_;
+
+	rtos_host_unlock();
+}
+
+void* pvPortMalloc(size_t xWantedSize)
+{
+	void* ptr = NULL;
+
+	if((xWantedSize == 0) || (xWantedSize >= (BLOCK_ALLOCATED_BIT - sizeof(block_link_t))))
+	{
+		return NULL;
+	}
+
+	size_t size = align_up(xWantedSize + sizeof(block_link_t), HEAP_ALIGNMENT);
+
+	rtos_host_lock();
+
+	for(block_link_t* prev = &free_list_; prev->next_free; prev = prev->next_free)
+	{
+		block_link_t* block = prev->next_free;
+
+		if(block->size < size)
+		{
+			continue;
+		}
+
+		if((block->size - size) > MINIMUM_BLOCK_SIZE)
+		{
+			block_link_t* rest = (block_link_t*)((uintptr_t)block + size);
+			rest->size = block->size - size;
+			rest->next_free = block->next_free;
+			block->size = size;
+			prev->next_free = rest;
+		}
+		else
+		{
+			prev->next_free = block->next_free;
+		}
+
+		free_bytes_ -= block->size;
+		min_free_bytes_ = (free_bytes_ < min_free_bytes_) ? free_bytes_ : min_free_bytes_;
+
+		block->size |= BLOCK_ALLOCATED_BIT;
+		block->next_free = NULL;
+		ptr = block + 1;
+		break;
+	}
+
+	rtos_host_unlock();
+
+	return ptr;
+}
+
+void vPortFree(void* pv)
+{
+	if(pv)
+	{
+		block_link_t* block = (block_link_t*)pv - 1;
+
+		assert((block->size & BLOCK_ALLOCATED_BIT) && "vPortFree() called with a free block");
+
+		rtos_host_lock();
+
+		block->size &= ~BLOCK_ALLOCATED_BIT;
+		free_bytes_ += block->size;
+		insert_free_block(block);
+
+		rtos_host_unlock();
+	}
+}
+
+size_t xPortGetFreeHeapSize(void)
+{
+	return free_bytes_;
+}
+
+size_t xPortGetMinimumEverFreeHeapSize(void)
+{
+	return min_free_bytes_;
+}
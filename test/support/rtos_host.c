@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+// Needed for clock_gettime(), nanosleep(), and recursive mutexes in strict C11 mode
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <support/rtos_host.h>
+#include <time.h>
+
+#pragma mark - Declarations -
+
+static pthread_once_t init_once_ = PTHREAD_ONCE_INIT;
+static pthread_mutex_t kernel_lock_;
+static pthread_cond_t kernel_changed_;
+static struct timespec start_time_;
+
+#pragma mark - Private Functions -
+
+static void rtos_host_init(void)
+{
+	pthread_mutexattr_t mutex_attr;
+	pthread_mutexattr_init(&mutex_attr);
+	pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&kernel_lock_, &mutex_attr);
+	pthread_mutexattr_destroy(&mutex_attr);
+
+	// Timeouts are measured in ticks, which must not jump with the wall clock
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&kernel_changed_, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time_);
+}
+
+static uint64_t elapsed_ms(const struct timespec* now)
+{
+	return ((uint64_t)(now->tv_sec - start_time_.tv_sec) * 1000) +
+		   (uint64_t)((now->tv_nsec - start_time_.tv_nsec) / 1000000);
+}
+
+#pragma mark - APIs -
+
+uint32_t rtos_host_tick_count(void)
+{
+	struct timespec now;
+
+	pthread_once(&init_once_, rtos_host_init);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint32_t)elapsed_ms(&now);
+}
+
+void rtos_host_sleep(uint32_t ticks)
+{
+	struct timespec duration = {.tv_sec = ticks / 1000, .tv_nsec = (long)(ticks % 1000) * 1000000};
+
+	while(nanosleep(&duration, &duration) != 0)
+	{
+		// Interrupted by a signal: sleep for the rest of the time
+	}
+}
+
+void rtos_host_yield(void)
+{
+	sched_yield();
+}
+
+void rtos_host_lock(void)
+{
+	pthread_once(&init_once_, rtos_host_init);
+	pthread_mutex_lock(&kernel_lock_);
+}
+
+void rtos_host_unlock(void)
+{
+	pthread_mutex_unlock(&kernel_lock_);
+}
+
+bool rtos_host_wait(uint32_t start, uint32_t ticks)
+{
+	if(ticks == RTOS_HOST_WAIT_FOREVER)
+	{
+		pthread_cond_wait(&kernel_changed_, &kernel_lock_);
+		return true;
+	}
+
+	uint32_t elapsed = rtos_host_tick_count() - start;
+
+	if(elapsed >= ticks)
+	{
+		return false;
+	}
+
+	struct timespec deadline;
+	uint32_t remaining = ticks - elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += remaining / 1000;
+	deadline.tv_nsec += (long)(remaining % 1000) * 1000000;
+
+	if(deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	// Spurious wakeups are fine: callers check their object and wait again
+	pthread_cond_timedwait(&kernel_changed_, &kernel_lock_, &deadline);
+
+	return true;
+}
+
+void rtos_host_notify(void)
+{
+	pthread_cond_broadcast(&kernel_changed_);
+}
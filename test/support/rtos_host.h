@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef RTOS_HOST_H_
+#define RTOS_HOST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**
+ * @brief Kernel services shared by the host stand-ins for ThreadX and FreeRTOS
+ *
+ * The stand-ins let the RTOS backends be tested and benchmarked on the build machine. RTOS tasks
+ *	are pthreads, and a tick is one millisecond. Kernel objects are protected by one recursive
+ *	lock, like the scheduler lock of a single-core kernel, and waiting tasks are woken whenever
+ *	any object changes.
+ */
+
+/// Timeout which never expires
+#define RTOS_HOST_WAIT_FOREVER UINT32_MAX
+
+/// Milliseconds since the first call. Wraps around like an RTOS tick counter.
+uint32_t rtos_host_tick_count(void);
+
+/// Sleep for a number of ticks
+void rtos_host_sleep(uint32_t ticks);
+
+/// Let other threads run
+void rtos_host_yield(void);
+
+/// Lock the kernel objects. Calls may nest.
+void rtos_host_lock(void);
+void rtos_host_unlock(void);
+
+/**
+ * @brief Wait for a kernel object to change
+ *
+ * The caller must hold the kernel lock once. The lock is released while waiting.
+ *
+ * @param start Tick count when the caller started waiting.
+ * @param ticks Timeout, relative to `start`, or RTOS_HOST_WAIT_FOREVER.
+ *
+ * @return false if the timeout has elapsed.
+ */
+bool rtos_host_wait(uint32_t start, uint32_t ticks);
+
+/// Wake the waiting threads, so they check whether the object they wait for has changed
+void rtos_host_notify(void);
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif // RTOS_HOST_H_
@@ -0,0 +1,382 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+/**
+ * NOTE: This file is a host stand-in for the ThreadX services used by malloc_threadx.c.
+ *
+ * It is built with TX_DISABLE_ERROR_CHECKING, so the APIs map to the core _tx_* functions.
+ * Byte pools are first-fit lists of blocks in address order, with ThreadX's block layout: each
+ * block header points to the next block and to its owning pool, so tx_byte_release() finds the
+ * pool from the pointer alone. Adjacent free blocks are merged while searching.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <support/rtos_host.h>
+#include <support/threadx_host.h>
+#include <threadx/tx_api.h>
+
+#pragma mark - Definitions -
+
+/// Header in front of each byte pool block
+typedef struct byte_block
+{
+	/// The next block in address order, or NULL for the sentinel which ends the pool
+	struct byte_block* next;
+	/// The owning pool if the block is allocated, NULL if it is free
+	TX_BYTE_POOL* owner;
+} byte_block_t;
+
+/// Byte pool allocations are rounded to the header size, which keeps every block aligned to it
+#define BYTE_POOL_GRANULE sizeof(byte_block_t)
+
+#define align_up(num, align) (((num) + ((align)-1)) & ~((align)-1))
+
+/// Control block IDs, which ThreadX uses to check that an object was created
+#define TX_BYTE_POOL_ID ((ULONG)0x42595445)
+#define TX_BLOCK_POOL_ID ((ULONG)0x424C4F43)
+#define TX_EVENT_FLAGS_ID ((ULONG)0x4456444E)
+
+#pragma mark - Private Functions -
+
+static inline ULONG block_bytes(const byte_block_t* block)
+{
+	return (ULONG)((uintptr_t)block->next - (uintptr_t)(block + 1));
+}
+
+/// Convert a ThreadX wait option to a host timeout
+static inline uint32_t wait_ticks(ULONG wait_option)
+{
+	return (wait_option == TX_WAIT_FOREVER) ? RTOS_HOST_WAIT_FOREVER : (uint32_t)wait_option;
+}
+
+/// Allocate from a byte pool. The caller must hold the kernel lock.
+static void* byte_pool_search(TX_BYTE_POOL* pool, ULONG size)
+{
+	for(byte_block_t* block = (byte_block_t*)pool->tx_byte_pool_list; block->next;
+		block = block->next)
+	{
+		if(block->owner)
+		{
+			continue;
+		}
+
+		while(block->next->next && !block->next->owner)
+		{
+			block->next = block->next->next;
+			pool->tx_byte_pool_fragments--;
+			pool->tx_byte_pool_available += sizeof(byte_block_t);
+		}
+
+		if(block_bytes(block) < size)
+		{
+			continue;
+		}
+
+		// Split off the rest of the block if it can hold another allocation
+		if(block_bytes(block) >= (size + sizeof(byte_block_t) + BYTE_POOL_GRANULE))
+		{
+			byte_block_t* rest = (byte_block_t*)((uintptr_t)(block + 1) + size);
+			rest->next = block->next;
+			rest->owner = NULL;
+			block->next = rest;
+			pool->tx_byte_pool_fragments++;
+			pool->tx_byte_pool_available -= sizeof(byte_block_t);
+		}
+
+		block->owner = pool;
+		pool->tx_byte_pool_available -= block_bytes(block);
+
+		return block + 1;
+	}
+
+	return NULL;
+}
+
+#pragma mark - Byte Pools -
+
+UINT tx_byte_pool_create(TX_BYTE_POOL* pool_ptr, const CHAR* name_ptr, VOID* pool_start,
+						 ULONG pool_size)
+{
+	uintptr_t start = align_up((uintptr_t)pool_start, BYTE_POOL_GRANULE);
+	uintptr_t end = ((uintptr_t)pool_start + pool_size) & ~(BYTE_POOL_GRANULE - 1);
+
+	if((end <= start) || ((end - start) < (3 * sizeof(byte_block_t))))
+	{
+		return TX_SIZE_ERROR;
+	}
+
+	memset(pool_ptr, 0, sizeof(TX_BYTE_POOL));
+
+	// One free block covers the pool, followed by an allocated sentinel
+	byte_block_t* block = (byte_block_t*)start;
+	byte_block_t* sentinel = (byte_block_t*)(end - sizeof(byte_block_t));
+	block->next = sentinel;
+	block->owner = NULL;
+	sentinel->next = NULL;
+	sentinel->owner = pool_ptr;
+
+	pool_ptr->tx_byte_pool_name = name_ptr;
+	pool_ptr->tx_byte_pool_start = (UCHAR*)start;
+	pool_ptr->tx_byte_pool_size = (ULONG)(end - start);
+	pool_ptr->tx_byte_pool_list = (UCHAR*)block;
+	pool_ptr->tx_byte_pool_search = (UCHAR*)block;
+	pool_ptr->tx_byte_pool_fragments = 2;
+	pool_ptr->tx_byte_pool_available = block_bytes(block);
+	pool_ptr->tx_byte_pool_id = TX_BYTE_POOL_ID;
+
+	return TX_SUCCESS;
+}
+
+UINT tx_byte_allocate(TX_BYTE_POOL* pool_ptr, VOID** memory_ptr, ULONG memory_size,
+					  ULONG wait_option)
+{
+	uint32_t start = rtos_host_tick_count();
+	ULONG size = align_up(memory_size, BYTE_POOL_GRANULE);
+
+	*memory_ptr = NULL;
+
+	rtos_host_lock();
+
+	while(!(*memory_ptr = byte_pool_search(pool_ptr, size)) && (wait_option != TX_NO_WAIT) &&
+		  rtos_host_wait(start, wait_ticks(wait_option)))
+	{
+		// Wait for memory to be released to the pool
+	}
+
+	rtos_host_unlock();
+
+	return *memory_ptr ? TX_SUCCESS : TX_NO_MEMORY;
+}
+
+UINT tx_byte_release(VOID* memory_ptr)
+{
+	byte_block_t* block = (byte_block_t*)memory_ptr - 1;
+
+	rtos_host_lock();
+
+	TX_BYTE_POOL* pool = block->owner;
+
+	if(!pool)
+	{
+		rtos_host_unlock();
+		return TX_PTR_ERROR;
+	}
+
+	block->owner = NULL;
+	pool->tx_byte_pool_available += block_bytes(block);
+	rtos_host_notify();
+
+	rtos_host_unlock();
+
+	return TX_SUCCESS;
+}
+
+#pragma mark - Block Pools -
+
+UINT tx_block_pool_create(TX_BLOCK_POOL* pool_ptr, const CHAR* name_ptr, ULONG block_size,
+						  VOID* pool_start, ULONG pool_size)
+{
+	// Like ThreadX, each block is preceded by a pointer: the next free block while the block is
+	// free, and the owning pool while it is allocated
+	block_size = align_up(block_size, sizeof(void*));
+	ULONG stride = block_size + sizeof(void*);
+	UINT total = (UINT)(pool_size / stride);
+
+	if(total == 0)
+	{
+		return TX_SIZE_ERROR;
+	}
+
+	memset(pool_ptr, 0, sizeof(TX_BLOCK_POOL));
+
+	UCHAR* block = pool_start;
+
+	for(UINT i = 0; i < total; i++, block += stride)
+	{
+		*(UCHAR**)block = (i + 1 < total) ? (block + stride) : NULL;
+	}
+
+	pool_ptr->tx_block_pool_name = name_ptr;
+	pool_ptr->tx_block_pool_start = pool_start;
+	pool_ptr->tx_block_pool_size = pool_size;
+	pool_ptr->tx_block_pool_block_size = (UINT)block_size;
+	pool_ptr->tx_block_pool_total = total;
+	pool_ptr->tx_block_pool_available = total;
+	pool_ptr->tx_block_pool_available_list = pool_start;
+	pool_ptr->tx_block_pool_id = TX_BLOCK_POOL_ID;
+
+	return TX_SUCCESS;
+}
+
+UINT tx_block_allocate(TX_BLOCK_POOL* pool_ptr, VOID** block_ptr, ULONG wait_option)
+{
+	uint32_t start = rtos_host_tick_count();
+	UINT status = TX_NO_MEMORY;
+
+	*block_ptr = NULL;
+
+	rtos_host_lock();
+
+	while(!pool_ptr->tx_block_pool_available_list && (wait_option != TX_NO_WAIT) &&
+		  rtos_host_wait(start, wait_ticks(wait_option)))
+	{
+		// Wait for a block to be released to the pool
+	}
+
+	UCHAR* block = pool_ptr->tx_block_pool_available_list;
+
+	if(block)
+	{
+		pool_ptr->tx_block_pool_available_list = *(UCHAR**)block;
+		pool_ptr->tx_block_pool_available--;
+		*(TX_BLOCK_POOL**)block = pool_ptr;
+		*block_ptr = block + sizeof(void*);
+		status = TX_SUCCESS;
+	}
+
+	rtos_host_unlock();
+
+	return status;
+}
+
+UINT tx_block_release(VOID* block_ptr)
+{
+	UCHAR* block = (UCHAR*)block_ptr - sizeof(void*);
+
+	rtos_host_lock();
+
+	TX_BLOCK_POOL* pool = *(TX_BLOCK_POOL**)block;
+	*(UCHAR**)block = pool->tx_block_pool_available_list;
+	pool->tx_block_pool_available_list = block;
+	pool->tx_block_pool_available++;
+	rtos_host_notify();
+
+	rtos_host_unlock();
+
+	return TX_SUCCESS;
+}
+
+#pragma mark - Event Flags -
+
+UINT tx_event_flags_create(TX_EVENT_FLAGS_GROUP* group_ptr, const CHAR* name_ptr)
+{
+	memset(group_ptr, 0, sizeof(TX_EVENT_FLAGS_GROUP));
+	group_ptr->tx_event_flags_group_name = name_ptr;
+	group_ptr->tx_event_flags_group_id = TX_EVENT_FLAGS_ID;
+
+	return TX_SUCCESS;
+}
+
+UINT tx_event_flags_get(TX_EVENT_FLAGS_GROUP* group_ptr, ULONG requested_flags, UINT get_option,
+						ULONG* actual_flags_ptr, ULONG wait_option)
+{
+	uint32_t start = rtos_host_tick_count();
+	bool all = (get_option == TX_AND) || (get_option == TX_AND_CLEAR);
+	bool clear = (get_option == TX_AND_CLEAR) || (get_option == TX_OR_CLEAR);
+	bool satisfied = false;
+
+	rtos_host_lock();
+
+	for(;;)
+	{
+		ULONG current = group_ptr->tx_event_flags_group_current & requested_flags;
+		satisfied = all ? (current == requested_flags) : (current != 0);
+
+		if(satisfied || (wait_option == TX_NO_WAIT) ||
+		   !rtos_host_wait(start, wait_ticks(wait_option)))
+		{
+			break;
+		}
+	}
+
+	*actual_flags_ptr = group_ptr->tx_event_flags_group_current;
+
+	if(satisfied && clear)
+	{
+		group_ptr->tx_event_flags_group_current &= ~requested_flags;
+	}
+
+	rtos_host_unlock();
+
+	return satisfied ? TX_SUCCESS : TX_NO_EVENTS;
+}
+
+UINT tx_event_flags_set(TX_EVENT_FLAGS_GROUP* group_ptr, ULONG flags_to_set, UINT set_option)
+{
+	rtos_host_lock();
+
+	if(set_option == TX_AND)
+	{
+		group_ptr->tx_event_flags_group_current &= flags_to_set;
+	}
+	else
+	{
+		group_ptr->tx_event_flags_group_current |= flags_to_set;
+		rtos_host_notify();
+	}
+
+	rtos_host_unlock();
+
+	return TX_SUCCESS;
+}
+
+#pragma mark - Threads and Time -
+
+UINT tx_thread_sleep(ULONG timer_ticks)
+{
+	rtos_host_sleep((uint32_t)timer_ticks);
+
+	return TX_SUCCESS;
+}
+
+VOID tx_thread_relinquish(VOID)
+{
+	rtos_host_yield();
+}
+
+/// Disabling interrupts holds the kernel lock, which keeps other threads out of the kernel
+UINT _tx_thread_interrupt_control(UINT new_posture)
+{
+	static UINT posture = TX_INT_ENABLE;
+
+	if(new_posture == TX_INT_DISABLE)
+	{
+		rtos_host_lock();
+	}
+
+	UINT old_posture = posture;
+	posture = new_posture;
+
+	if(new_posture == TX_INT_ENABLE)
+	{
+		rtos_host_unlock();
+	}
+
+	return old_posture;
+}
+
+ULONG tx_time_get(VOID)
+{
+	return rtos_host_tick_count();
+}
+
+#pragma mark - Test Access -
+
+TX_BLOCK_POOL* threadx_host_block_pool_of(const void* ptr)
+{
+	// Both pool types store the owner in the pointer in front of the block, and each control
+	// block starts with its ID
+	TX_BLOCK_POOL* pool = *((TX_BLOCK_POOL* const*)ptr - 1);
+
+	return (pool && (pool->tx_block_pool_id == TX_BLOCK_POOL_ID)) ? pool : NULL;
+}
+
+TX_BYTE_POOL* threadx_host_byte_pool_of(const void* ptr)
+{
+	TX_BYTE_POOL* pool = *((TX_BYTE_POOL* const*)ptr - 1);
+
+	return (pool && (pool->tx_byte_pool_id == TX_BYTE_POOL_ID)) ? pool : NULL;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright © 2022 Embedded Artistry LLC.
+ * License: MIT. See LICENSE file for details.
+ */
+
+#ifndef THREADX_HOST_H_
+#define THREADX_HOST_H_
+
+#include <threadx/tx_api.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**
+ * @brief Test access to the ThreadX stand-in
+ *
+ * ThreadX keeps a pointer to the owning pool in front of each allocated block. These functions
+ *	read it, so tests can check which pool served an allocation.
+ */
+
+/// The block pool which `ptr` was allocated from, or NULL if it came from a byte pool
+TX_BLOCK_POOL* threadx_host_block_pool_of(const void* ptr);
+
+/// The byte pool which `ptr` was allocated from, or NULL if it came from a block pool
+TX_BYTE_POOL* threadx_host_byte_pool_of(const void* ptr);
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif // THREADX_HOST_H_
@@ -1,7 +1,37 @@
 #ifndef TEST_H__
 #define TEST_H__
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 int malloc_tests(void);
 int aligned_malloc_tests(void);
+int arena_tests(void);
+int malloc_instrumentation_tests(void);
+int malloc_region_tests(void);
+int malloc_removeblock_tests(void);
+int malloc_morecore_tests(void);
+int malloc_profiler_tests(void);
+int malloc_deferred_free_tests(void);
+int malloc_size_index_tests(void);
+int malloc_heap_tests(void);
+int malloc_heap_policy_tests(void);
+int malloc_new_delete_tests(void);
+int malloc_memory_resource_tests(void);
+int malloc_remote_free_tests(void);
+int malloc_isr_free_tests(void);
+int malloc_stats_tests(void);
+int malloc_timed_tests(void);
+int malloc_isr_pool_tests(void);
+int malloc_bitmap_tests(void);
+int malloc_rtos_tests(void);
+int malloc_threadx_tests(void);
+int malloc_framework_rtos_tests(void);
+int malloc_freertos_provider_tests(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
 
 #endif // TEST_H_